@@ -28,12 +28,21 @@
 *
 *	Example session:
 *	- wait for serial
+*	- optionally receive an R followed by the address range of the data,
+*	used to plan erasing (no response unless the range is invalid.)
 *	- receive an H for hex download, start waiting for lines
 *	- respond with *
 *	- receive a line/process a line
-*	- respond with *
+*	- respond with *, or with < followed by an address in hex and a newline
+*	when the host needs to resend the data starting at that address (see
+*	WriteBlock.)
 *	- loop till end hex command hit.
 *
+*	Dump session:
+*	- receive a D followed by the address range to dump, e.g. D0,10000\n
+*	- respond with the range as binary frames, the last one empty (see
+*	DumpRange.)
+*
 *	At any time if anything other than a line start is received when expected 
 *	or an invalid character, respond with a ? follwed by an error message.
 *
@@ -47,42 +56,155 @@
 #include <SPI.h>
 
 
+// The target can also be defined externally, e.g. by the Simulator build.
+#if !defined TARGET_AT24C && !defined TARGET_NORFLASH && !defined TARGET_SD
 #define TARGET_AT24C	1
 //#define TARGET_NORFLASH	1
 //#define TARGET_SD		1	// Used to load data onto an SD card treated as a block device.
+#endif
 
 #ifdef TARGET_AT24C
 #include <AT24C.h>
+#include <AT24CBank.h>
 #include <Wire.h>
 const uint8_t kAT24CDeviceAddr = 0x50;
-const uint8_t kAT24CDeviceCapacity = 32;	// Value at end of AT24Cxxx xxx/8
+const uint16_t kAT24CDeviceCapacity = 32;	// Value at end of AT24Cxxx xxx/8, M01 = 128, M02 = 256
+// 400KHz, or 1MHz (1000000) if the chip supports it (check the datasheet.)
+const uint32_t kAT24CBusSpeed = 400000;
 AT24C	eeprom(kAT24CDeviceAddr, kAT24CDeviceCapacity);
+/*
+*	Several chips on the bus can be loaded as one device by listing them
+*	here, e.g. {&eeprom, &eeprom2} where eeprom2 is the same type of chip at
+*	the next device address (kAT24CDeviceAddr + 1, or + 2 for the M01, + 4
+*	for the M02.)  The second chip's data follows the first's.
+*/
+AT24C* const	kEEPROMs[] = {&eeprom};
+AT24CBank	eeproms(kEEPROMs, sizeof(kEEPROMs)/sizeof(kEEPROMs[0]));
+BlockDevice&	device = eeproms;
 #define BAUD_RATE	19200
 
 #elif defined TARGET_SD
 #include <SdFat.h>
+#include <BlockDevice.h>
 const uint8_t kSdChipSelect = 10;
 Sd2Card card;
 SdVolume vol;
+/*
+*	Presents the card as a BlockDevice.  Only whole 512 byte blocks can be
+*	programmed or read.
+*
+*	Within the range passed to BeginProgramming, blocks are written using a
+*	multiple block write (CMD25) that continues for as long as the blocks are
+*	contiguous.  The card is told how many blocks to pre-erase (ACMD23), only
+*	the blocks of the data passed to ProgramRange.  The rest of the range may
+*	not be written (a hex file can skip blocks) and a pre-erased block that
+*	isn't written is left with undefined contents.  Each block of a multiple
+*	block write avoids the command overhead and most of the busy time of a
+*	single block write.  A gap in the blocks ends the multiple block write, the next block
+*	starts a new one.  Blocks outside of the range are written individually.
+*/
+class SdBlockDevice : public BlockDevice
+{
+public:
+							SdBlockDevice(
+								Sd2Card&				inCard)
+								: mCard(inCard), mRangeEnd(0), mNextBlock(0),
+								  mStreaming(false){}
+	virtual uint32_t		GetCapacity(void)
+							{
+								uint32_t	blocks = mCard.cardSize();
+								// Addresses are 32 bit, so the max is 4GB
+								return(blocks < 0x800000 ? blocks * 512 : 0xFFFFFFFF);
+							}
+	virtual uint16_t		GetProgramSize(void)
+								{return(512);}
+	virtual uint32_t		GetEraseSize(void)
+								{return(0);}	// The card manages erasing
+	virtual bool			ProgramRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								const uint8_t*			inData)
+							{
+								bool	success = ((inAddr | inLength) & 0x1FF) == 0;
+								for (uint32_t offset = 0; success && offset < inLength; offset += 512)
+								{
+									uint32_t	address = inAddr + offset;
+									uint32_t	block = address/512;
+									if (mStreaming &&
+										block != mNextBlock)
+									{
+										success = StopStreaming();
+									}
+									if (!mStreaming &&
+										address < mRangeEnd)
+									{
+										success = success && mCard.writeStart(block, (inLength - offset)/512);
+										mStreaming = success;
+										mNextBlock = block;
+									}
+									if (mStreaming)
+									{
+										success = mCard.writeData(&inData[offset]);
+										mNextBlock++;
+									} else
+									{
+										success = success && mCard.writeBlock(block, &inData[offset]);
+									}
+								}
+								return(success);
+							}
+	virtual bool			ReadRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								uint8_t*				outData)
+							{
+								bool	success = ((inAddr | inLength) & 0x1FF) == 0 &&
+													StopStreaming();
+								for (uint32_t offset = 0; success && offset < inLength; offset += 512)
+								{
+									success = mCard.readBlock((inAddr + offset)/512, &outData[offset]);
+								}
+								return(success);
+							}
+	virtual bool			EraseRange(
+								uint32_t				inAddr,
+								uint32_t				inLength)
+								{return(true);}
+	virtual bool			IsBusy(void)
+								{return(false);}	// Sd2Card waits internally
+	virtual void			BeginProgramming(
+								uint32_t				inAddr,
+								uint32_t				inLength)
+								{mRangeEnd = inLength ? inAddr + inLength : 0;}
+	virtual bool			EndProgramming(void)
+							{
+								mRangeEnd = 0;
+								return(StopStreaming());
+							}
+protected:
+	Sd2Card&	mCard;
+	uint32_t	mRangeEnd;
+	uint32_t	mNextBlock;		// Next block of the multiple block write
+	bool		mStreaming;		// A multiple block write is in progress
+	
+	bool					StopStreaming(void)
+							{
+								bool	success = !mStreaming || mCard.writeStop();
+								mStreaming = false;
+								return(success);
+							}
+};
+SdBlockDevice	sdDevice(card);
+BlockDevice&	device = sdDevice;
 #define BAUD_RATE	9600
 #elif defined TARGET_NORFLASH
 #include "SPIMem.h"
 const uint8_t kNFChipSelect = 10;
 SPIMem flash(kNFChipSelect);
+BlockDevice&	device = flash;
 #define BAUD_RATE	19200
 #endif
 
-enum EIntelHexLineState
-{
-	// Start code   Byte count   Address H/L   Record type   Data   Checksum
-	eGetByteCount,
-	eGetAddressH,
-	eGetAddressL,
-	eGetRecordType,
-	eGetData,
-	eGetChecksum
-};
-
 enum EIntelHexRecordType
 {
 	eRecordTypeData,		// 0
@@ -100,7 +222,42 @@ enum EIntelHexStatus
 	eError
 };
 
-#ifndef TARGET_SD
+enum EHexLineStatus
+{
+	eLineValid,
+	eLineInvalidChar,
+	eLineInvalidLength,
+	eLineChecksumError
+};
+
+/*
+*	kHexNibble maps every ASCII character to its hex digit value (upper or
+*	lowercase.)  Characters that aren't hex digits map to XX.  Because XX has
+*	the high nibble set, ORing the two nibbles of a byte and testing the high
+*	nibble validates both characters with a single test.
+*/
+#define XX	0xFF
+static const uint8_t kHexNibble[256] PROGMEM =
+{
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x00
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x10
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x20
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, XX, XX, XX, XX, XX, XX,	// 0x30
+	XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x40
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x50
+	XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x60
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x70
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x80
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0x90
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0xA0
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0xB0
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0xC0
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0xD0
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,	// 0xE0
+	XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX 	// 0xF0
+};
+#undef XX
+
 // Note that kBlockSize is simply the granularity of the hex data, i.e. where
 // the hex lines will break within the hex file when "Omit nulls when possible"
 // is checked within the SerialHexLoader application.  When checked, this should
@@ -108,20 +265,44 @@ enum EIntelHexStatus
 // multiple of 16 can be used when "Omit nulls when possible" is  unchecked
 // because the granularity at that point is 16 (no nulls being omitted therefore
 // all lines are <= 16 data bytes.)
-// Having said all that, note that WriteBlock in this ino assumes a 512 byte
-// block size, so any changes to kBlockSize will necessitate modifying
-// WriteBlock.
+// WriteBlock programs each block in the device's native program units, so
+// kBlockSize must be a multiple of device.GetProgramSize() (or smaller than it
+// when the program size is larger than a block.)  For the SD target it must be
+// 512, the size of the volume cache used as the block buffer.
 const uint32_t	kBlockSize = 512;
-#ifdef TARGET_NORFLASH
 static bool		sEraseBeforeWrite;
-static uint32_t	sCurrent64KBlk;
-#endif
+/*
+*	sEraseStart and sEraseEnd is the range of the data about to be downloaded
+*	as sent by the host via the R command.  When sEraseEnd is zero the range
+*	isn't known.  It's used to plan erasing, and is passed to the device via
+*	BeginProgramming.  sErasedFrom to sErasedTo is the range erased so far.
+*/
+static uint32_t	sEraseStart;
+static uint32_t	sEraseEnd;
+static uint32_t	sErasedFrom;
+static uint32_t	sErasedTo;
+/*
+*	sSectorFirstBlock is the address of the first block written within the
+*	current sector (smallest erase unit.)  When erasing the sector would
+*	destroy blocks already written, the host is asked to resend the data
+*	starting at this address (see WriteBlock.)  sRewindAddr is set to the
+*	address the host should resend from, else it's kNoRewind.
+*/
+const uint32_t	kNoRewind = 0xFFFFFFFF;
+static uint32_t	sSectorFirstBlock;
+static uint32_t	sRewindAddr = kNoRewind;
+#ifndef TARGET_SD
 static uint8_t	sBuffer[kBlockSize];
+static uint8_t	sReadBuffer[256];	// Used to compare, verify and blank check
 static bool		sVerifyAfterWrite = true;
+static bool		sCompareBeforeWrite = true;
+#else
+// The SD card can only be read in whole blocks and there's no room for a
+// second block buffer, so there's no verify after write.
+static bool		sCompareBeforeWrite = false;
 #endif
 #define MAX_HEX_LINE_LEN	45
 static uint8_t	sLineBuffer[MAX_HEX_LINE_LEN];
-static uint8_t*	sLineBufferPtr;
 static uint8_t*	sEndOfLineBufferPtr;
 
 #ifdef TARGET_NORFLASH
@@ -148,12 +329,108 @@ void DumpJDECInfo(void)
 		}
 		Serial.print(", capacity = ");
 		Serial.print(capacity/0x100000);
-		Serial.println("MB");
+		Serial.print("MB");
+		if (flash.HasSFDP())
+		{
+			Serial.print(", page = ");
+			Serial.print(flash.GetProgramSize());
+			Serial.print(", sector = ");
+			Serial.print(flash.GetEraseSize());
+			Serial.print(" (SFDP)");
+		}
+		Serial.println();
 	} else
 	{
 		Serial.println("?failed to read the JEDEC ID");
 	}
 }
+
+#endif
+
+#if (defined TARGET_NORFLASH && defined SPIMEM_BUSY_STATS) || \
+	(defined TARGET_AT24C && defined DEBUG_AT24C)
+/****************************** PrintBusyStats ********************************/
+/*
+*	Prints the counts following the operation name.
+*/
+void PrintBusyStats(
+	uint32_t	inCount,
+	uint32_t	inBusyTime,
+	uint32_t	inMaxBusyTime,
+	uint32_t	inWaitTime,
+	const char*	inPollName,
+	uint32_t	inPolls)
+{
+	Serial.print(": ");
+	Serial.print(inCount);
+	Serial.print(", busy ");
+	Serial.print(inBusyTime);
+	Serial.print(", max ");
+	Serial.print(inMaxBusyTime);
+	Serial.print(", waited ");
+	Serial.print(inWaitTime);
+	Serial.print(inPollName);
+	Serial.print(inPolls);
+	Serial.print('\n');
+}
+
+/******************************* DumpBusyStats ********************************/
+/*
+*	Prints the time the chip was busy with each type of operation since the
+*	last time the stats were dumped, then clears them.  Times are in
+*	microseconds.  "waited" is the busy time the sketch spent blocked waiting
+*	for the chip, the rest was overlapped with receiving data.
+*/
+void DumpBusyStats(void)
+{
+	bool	none = true;
+#ifdef TARGET_NORFLASH
+	for (uint8_t op = 0; op < SPIMem::eNumBusyOps; op++)
+	{
+		const SPIMem::SBusyStats&	stats = flash.GetBusyStats(op);
+		if (stats.count == 0)continue;
+		none = false;
+		if (op == SPIMem::eProgramOp)
+		{
+			Serial.print("Program");
+		} else if (op == SPIMem::eChipEraseOp)
+		{
+			Serial.print("Chip erase");
+		} else
+		{
+			Serial.print("Erase ");
+			Serial.print(flash.GetEraseTypeSize(op - SPIMem::eEraseOp)/1024);
+			Serial.print("KB");
+		}
+		PrintBusyStats(stats.count, stats.busyTime, stats.maxBusyTime,
+						stats.waitTime, ", status reads ", stats.statusReads);
+	}
+	flash.ResetBusyStats();
+#else
+	for (uint8_t i = 0; i < eeproms.GetChipCount(); i++)
+	{
+		AT24C*	chip = eeproms.GetChip(i);
+		const AT24C::SBusyStats&	stats = chip->GetBusyStats();
+		if (stats.count)
+		{
+			none = false;
+			Serial.print("Write");
+			if (eeproms.GetChipCount() > 1)
+			{
+				Serial.print(" 0x");
+				Serial.print(chip->GetDeviceAddress(), HEX);
+			}
+			PrintBusyStats(stats.count, stats.busyTime, stats.maxBusyTime,
+							stats.waitTime, ", ack poll NACKs ", stats.nacks);
+		}
+		chip->ResetBusyStats();
+	}
+#endif
+	if (none)
+	{
+		Serial.print("No busy operations\n");
+	}
+}
 #endif
 
 /********************************** setup *************************************/
@@ -174,6 +451,8 @@ void setup(void)
 	DumpJDECInfo();
 #elif defined TARGET_AT24C
 	Wire.begin();
+	eeprom.SetBusSpeed(kAT24CBusSpeed);
+	SetCompareBeforeWrite(sCompareBeforeWrite);
 #endif
 }
 
@@ -183,17 +462,15 @@ void loop()
 	while (!Serial.available());
 	switch (Serial.read())
 	{
-#ifdef TARGET_SD
-		case 'h':
-		case 'H':	// Erase before write (default)
-			HexDownload();
+		case 'R':	// Range of the data about to be downloaded
+			if (!LoadRange(sEraseStart, sEraseEnd))
+			{
+				Serial.print("?Invalid range\n");
+			}
 			break;
-#else
 		case 'H':	// Erase before write
-	#ifdef TARGET_NORFLASH
 			sEraseBeforeWrite = true;
-			sCurrent64KBlk = 0xF0000000;
-	#endif
+			sErasedFrom = sErasedTo = 0;
 			HexDownload();
 			break;
 		/*
@@ -201,13 +478,16 @@ void loop()
 		*	For all other NOR Flash chips you must erase before write because
 		*	writing only clears bits, it doesn't set them.  Erasing sets all
 		*	bits to 1.
+		*	Erase before write is ignored by devices that don't need erasing.
 		*/
 		case 'h':	// Don't erase before write
-	#ifdef TARGET_NORFLASH
 			sEraseBeforeWrite = false;
-	#endif
 			HexDownload();
 			break;
+		case 'D':	// Dump a range of the device
+			DumpRange();
+			break;
+#ifndef TARGET_SD
 		case 'E':
 			FullErase();
 			break;
@@ -219,16 +499,56 @@ void loop()
 			sVerifyAfterWrite = false;
 			Serial.println("Verify after write OFF");
 			break;
+		/*
+		*	When compare before write is on, each block is read before it's
+		*	written.  Program units that already hold the data are skipped,
+		*	and NOR Flash is only erased when the data needs a bit set that is
+		*	currently clear.
+		*/
+		case 'C':
+			SetCompareBeforeWrite(true);
+			Serial.println("Compare before write ON");
+			break;
+		case 'c':
+			SetCompareBeforeWrite(false);
+			Serial.println("Compare before write OFF");
+			break;
 	#ifdef TARGET_NORFLASH
 		case 'j':
 			flash.LoadJEDECInfo();
 			DumpJDECInfo();
 			break;
 	#endif
+	#if (defined TARGET_NORFLASH && defined SPIMEM_BUSY_STATS) || \
+		(defined TARGET_AT24C && defined DEBUG_AT24C)
+		case 'b':	// Busy time stats
+			DumpBusyStats();
+			break;
+	#endif
 #endif
 	}
 }
 
+#ifndef TARGET_SD
+/*************************** SetCompareBeforeWrite ****************************/
+/*
+*	The AT24C library compares each page as it writes (reading the chip
+*	through Wire without a buffer), so for AT24C the compare is left to the
+*	library rather than done by WriteBlock.
+*/
+void SetCompareBeforeWrite(
+	bool	inCompareBeforeWrite)
+{
+	sCompareBeforeWrite = inCompareBeforeWrite;
+#ifdef TARGET_AT24C
+	for (uint8_t i = 0; i < eeproms.GetChipCount(); i++)
+	{
+		eeproms.GetChip(i)->SetCompareBeforeWrite(inCompareBeforeWrite);
+	}
+#endif
+}
+#endif
+
 /******************************** FullErase ***********************************/
 void FullErase(void)
 {
@@ -258,7 +578,270 @@ uint8_t* ClearBuffer(void)
 	return(buffer);
 }
 
+/********************************* LoadRange **********************************/
+/*
+*	Loads an address range sent by the host as two hex addresses, start and
+*	end (exclusive), separated by a comma and terminated by a newline, e.g.
+*	1000,2a400\n
+*	outStart and outEnd are only changed when the range is valid.
+*
+*	The range sent with the R command is the range of the data about to be
+*	downloaded.  It's used by the next download.  When erasing before write (H)
+*	the range is used to erase exactly the erase units the data will occupy.
+*	The range is also passed to the device (see SdBlockDevice.)
+*/
+bool LoadRange(
+	uint32_t&	outStart,
+	uint32_t&	outEnd)
+{
+	uint32_t	range[2];
+	uint8_t		thisChar = 0;
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		uint32_t	value = 0;
+		uint8_t		digits = 0;
+		while (true)
+		{
+			thisChar = GetChar();
+			uint8_t	nibble = pgm_read_byte(&kHexNibble[thisChar]);
+			if (nibble & 0xF0)
+			{
+				break;
+			}
+			value = (value << 4) + nibble;
+			digits++;
+		}
+		if (digits == 0 ||
+			digits > 8 ||
+			thisChar != (i ? '\n' : ','))
+		{
+			return(false);
+		}
+		range[i] = value;
+	}
+	if (range[0] < range[1])
+	{
+		outStart = range[0];
+		outEnd = range[1];
+		return(true);
+	}
+	return(false);
+}
+
+/********************************** Crc16 *************************************/
+/*
+*	CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF), the CRC used
+*	by the dump frames.
+*/
+uint16_t Crc16(
+	uint16_t		inCrc,
+	const uint8_t*	inData,
+	uint16_t		inLength)
+{
+	while (inLength--)
+	{
+		inCrc ^= (uint16_t)*(inData++) << 8;
+		for (uint8_t i = 0; i < 8; i++)
+		{
+			inCrc = (inCrc & 0x8000) ? (inCrc << 1) ^ 0x1021 : inCrc << 1;
+		}
+	}
+	return(inCrc);
+}
+
+/******************************** SendFrame ***********************************/
+/*
+*	Sends a dump frame:
+*	'#', length (2 bytes), address (4 bytes), data, CRC (2 bytes)
+*	Multibyte values are big endian.  The CRC covers the length, address and
+*	data.  A frame with a length of zero ends the dump.
+*/
+void SendFrame(
+	uint32_t		inAddr,
+	const uint8_t*	inData,
+	uint16_t		inLength)
+{
+	uint8_t	header[6];
+	header[0] = inLength >> 8;
+	header[1] = inLength;
+	header[2] = inAddr >> 24;
+	header[3] = inAddr >> 16;
+	header[4] = inAddr >> 8;
+	header[5] = inAddr;
+	uint16_t	crc = Crc16(Crc16(0xFFFF, header, sizeof(header)), inData, inLength);
+	Serial.write('#');
+	Serial.write(header, sizeof(header));
+	Serial.write(inData, inLength);
+	Serial.write((uint8_t)(crc >> 8));
+	Serial.write((uint8_t)crc);
+}
+
+/********************************* DumpRange **********************************/
+/*
+*	Sends the range of the device requested by the host (D command) as binary
+*	frames (see SendFrame), one block per frame.  There are no acks, the host
+*	checks each frame's CRC and requests any bad frames again with another D
+*	command once the dump ends.  The dump stops if the host sends anything
+*	(e.g. S to stop.)
+*/
+void DumpRange(void)
+{
+	uint32_t	address, endAddress;
+	if (!LoadRange(address, endAddress) ||
+		endAddress > device.GetCapacity())
+	{
+		Serial.print("?Invalid range\n");
+		return;
+	}
+	uint8_t*	buffer = ClearBuffer();
+	while (address < endAddress)
+	{
+		if (Serial.available())
+		{
+			Serial.print("?Stopped by user\n");
+			return;
+		}
+		uint32_t	blockAddress = address - (address % kBlockSize);
+		uint32_t	frameEnd = blockAddress + kBlockSize;
+		if (frameEnd > endAddress)
+		{
+			frameEnd = endAddress;
+		}
+		uint16_t	frameLength = frameEnd - address;
+#ifdef TARGET_SD
+		// The card can only be read in whole blocks.
+		const uint8_t*	frameData = &buffer[address - blockAddress];
+		if (!device.ReadRange(blockAddress, kBlockSize, buffer))
+#else
+		const uint8_t*	frameData = buffer;
+		if (!device.ReadRange(address, frameLength, buffer))
+#endif
+		{
+			Serial.print("?Failed reading data\n");
+			return;
+		}
+		SendFrame(address, frameData, frameLength);
+		address = frameEnd;
+	}
+	SendFrame(endAddress, NULL, 0);
+}
+
+#ifndef TARGET_SD
+/********************************** IsBlank ***********************************/
+/*
+*	Returns true if the range is erased (all 0xFF).  Returns as soon as a byte
+*	that isn't 0xFF is found.
+*/
+bool IsBlank(
+	uint32_t	inAddr,
+	uint32_t	inLength)
+{
+	uint32_t	endAddr = inAddr + inLength;
+	for (; inAddr < endAddr; inAddr += sizeof(sReadBuffer))
+	{
+		if (!device.ReadRange(inAddr, sizeof(sReadBuffer), sReadBuffer))
+		{
+			return(false);
+		}
+		for (uint16_t i = 0; i < sizeof(sReadBuffer); i++)
+		{
+			if (sReadBuffer[i] == 0xFF)continue;
+			return(false);
+		}
+	}
+	return(true);
+}
+#endif
+
+/******************************** EraseBlock **********************************/
+/*
+*	Makes sure the range inAddr to inEndAddr is erased before it's written.
+*
+*	Rather than always erasing 64KB blocks, this erases the range the data
+*	occupies using the fewest erase units: sectors up to the first 32KB/64KB
+*	boundary, then the largest units that fit within the data, then
+*	smaller units for whatever remains at the end.  When the host didn't send
+*	the range, the end of the device is used as the end of the range.
+*
+*	When inBlankCheck is true, erase units that are already blank aren't
+*	erased.  This costs a read of the unit (stopping at the first byte that
+*	isn't 0xFF), which is much faster than an erase.
+*
+*	Note that the first and last erase units are erased in full, so any data
+*	in the first sector before the start address and in the last sector after
+*	the end address is lost.  HexDownload warns when the range isn't aligned
+*	to the erase size.
+*
+*	The erases are started without waiting for them to complete (the device
+*	waits before its next operation), so the last erase overlaps whatever
+*	follows, e.g. receiving the block's data when erasing ahead (see
+*	HexDownload.)
+*/
+bool EraseBlock(
+	uint32_t	inAddr,
+	uint32_t	inEndAddr,
+	bool		inBlankCheck)
+{
+	bool		success = true;
+	uint32_t	eraseSize = device.GetEraseSize();
+	uint32_t	rangeEnd = sEraseEnd ? sEraseEnd : device.GetCapacity();
+	if (rangeEnd < inEndAddr)
+	{
+		rangeEnd = inEndAddr;
+	}
+	// Round up to the erase size
+	rangeEnd = ((rangeEnd + eraseSize - 1)/eraseSize) * eraseSize;
+	/*
+	*	If the block isn't within or contiguous with what was erased so far
+	*	(e.g. the first block written) THEN
+	*	start erasing at the erase unit containing the block.
+	*/
+	if (inAddr < sErasedFrom ||
+		inAddr > sErasedTo)
+	{
+		sErasedFrom = sErasedTo = inAddr - (inAddr % eraseSize);
+	}
+	while (sErasedTo < inEndAddr)
+	{
+		uint32_t	eraseUnit = device.GetEraseUnit(sErasedTo, rangeEnd - sErasedTo);
+#ifndef TARGET_SD
+		if (!inBlankCheck ||
+			!IsBlank(sErasedTo, eraseUnit))
+#endif
+		{
+			success = device.StartErase(sErasedTo, eraseUnit);
+			if (!success)
+			{
+				Serial.print("?Block erase failed\n");
+				break;
+			}
+			Serial.write('=');
+		}
+		sErasedTo += eraseUnit;
+	}
+	return(success);
+}
+
 /******************************* WriteBlock ***********************************/
+/*
+*	Writes a block received from the host to the device.
+*
+*	When compare before write is on, the block is first read from the device
+*	and compared, one program unit at a time.  Units that already hold the data
+*	aren't programmed.  For NOR Flash, when the new data only clears bits
+*	((old & new) == new) the block is programmed without erasing.  Only when a
+*	bit needs to be set is the sector erased.  If blocks were already written
+*	to that sector during this download, erasing the sector destroys them, so
+*	sRewindAddr is set to ask the host to resend the data starting with the
+*	first of those blocks.  After the erase the resent blocks are known to be
+*	blank so there's never more than one rewind per sector.
+*
+*	When the range of the data is known (R command), only the part of the
+*	first and last blocks within the range is compared, programmed and
+*	verified.  The bytes of those blocks outside of the range aren't changed
+*	(unless the sector has to be erased.)  Not for SD, a card can only be
+*	written in whole blocks.
+*/
 bool WriteBlock(
 	uint8_t*	inData,
 	uint32_t	inBlockIndex)
@@ -266,130 +849,163 @@ bool WriteBlock(
 	bool success = true;
 	if (inData)
 	{
-#ifdef TARGET_SD
-		success = card.writeBlock(inBlockIndex, inData);
-#elif defined TARGET_NORFLASH
 		uint32_t	address = inBlockIndex*kBlockSize;
+		uint32_t	endAddress = address + kBlockSize;
+		uint32_t	eraseSize = sEraseBeforeWrite ? device.GetEraseSize() : 0;
+		uint32_t	programSize = device.GetProgramSize();
+		if (programSize > kBlockSize)
+		{
+			programSize = kBlockSize;
+		}
+		uint32_t	unitsToWrite = 0xFFFFFFFF;	// A bit per program unit
 		/*
-		*	If erase before write is enabled AND
-		*	the address just stepped over a 64KB block boundary THEN
-		*	Erase the block. (this assumes all addresses are increasing)
+		*	dataStart to dataEnd is the offset range within the block to be
+		*	written.
 		*/
-		//Serial.write('+');
-		if (sEraseBeforeWrite &&
-			(address/0x10000) != sCurrent64KBlk)
+		uint32_t	dataStart = 0;
+		uint32_t	dataEnd = kBlockSize;
+#ifndef TARGET_SD
+		if (sEraseEnd)
+		{
+			if (sEraseStart > address)
+			{
+				dataStart = sEraseStart < endAddress ? sEraseStart - address : kBlockSize;
+			}
+			if (sEraseEnd < endAddress)
+			{
+				dataEnd = sEraseEnd > address ? sEraseEnd - address : 0;
+			}
+		}
+#endif
+#ifdef TARGET_AT24C
+		bool		compare = false;	// The library compares (see SetCompareBeforeWrite)
+#else
+		bool		compare = sCompareBeforeWrite &&
+								programSize <= 256 &&
+								(kBlockSize/programSize) <= 32;
+#endif
+		bool		blank = false;
+		
+		if (eraseSize)
 		{
-			sCurrent64KBlk = address/0x10000;
-			success = flash.Erase64KBlock(address);
-			if (success)
+			if (sSectorFirstBlock == kNoRewind ||
+				(address / eraseSize) != (sSectorFirstBlock / eraseSize))
 			{
-				Serial.write('=');
+				sSectorFirstBlock = address;
 			}
+			// If the block was already erased during this download...
+			blank = address >= sErasedFrom && endAddress <= sErasedTo;
 		}
-		//Serial.write('-');
-		if (success)
+#ifndef TARGET_SD
+		if (compare &&
+			!blank)
 		{
-			success = flash.WritePage(address, inData) &&
-						flash.WritePage(address+256, &inData[256]);
-			if (sVerifyAfterWrite)
+			bool	bitsClearOnly = true;
+			unitsToWrite = 0;
+			for (uint32_t offset = 0, unit = 1; offset < kBlockSize; offset += programSize, unit <<= 1)
 			{
-				uint8_t	verifyBuff[256];
-				#if 0
-				success = flash.Read(address, 256, verifyBuff) &&
-					memcmp(inData, verifyBuff, 256) == 0 &&
-					flash.Read(address+256, 256, verifyBuff) &&
-					memcmp(&inData[256], verifyBuff, 256) == 0;
-				#else
-				success = flash.Read(address, 256, verifyBuff);
-				if (success)
+				success = device.ReadRange(address + offset, programSize, sReadBuffer);
+				if (!success)
 				{
-					success = memcmp(inData, verifyBuff, 256) == 0;
-					if (success)
-					{
-						success = flash.Read(address+256, 256, verifyBuff);
-						if (success)
-						{
-							success = memcmp(&inData[256], verifyBuff, 256) == 0;
-							if (!success)
-							{
-								Serial.print("?Failed compare data[256]\n");
-								/*Serial.write((const char*)verifyBuff, 256);
-								Serial.print("\n\n");
-								Serial.write((const char*)&inData[256], 256);
-								Serial.print("\n\n");*/
-							}
-						} else
-						{
-							Serial.print("?Failed reading data[256]\n");
-						}
-					} else
-					{
-						Serial.print("?Failed compare data[0]\n");
-						/*Serial.write((const char*)verifyBuff, 256);
-						Serial.print("\n\n");
-						Serial.write((const char*)inData, 256);
-						Serial.print("\n\n");*/
-					}
-				} else
+					Serial.print("?Failed reading data[");
+					Serial.print(offset);
+					Serial.print("]\n");
+					return(false);
+				}
+				const uint8_t*	newData = &inData[offset];
+				for (uint16_t i = 0; i < programSize; i++)
+				{
+					uint8_t	oldByte = sReadBuffer[i];
+					if (oldByte == newData[i] ||
+						offset + i < dataStart ||
+						offset + i >= dataEnd)continue;
+					unitsToWrite |= unit;
+					if ((oldByte & newData[i]) == newData[i])continue;
+					bitsClearOnly = false;
+					break;
+				}
+			}
+			if (eraseSize &&
+				!bitsClearOnly)
+			{
+				success = EraseBlock(address, endAddress, true);
+				if (!success)
 				{
-					Serial.print("?Failed reading data[0]\n");
+					return(false);
 				}
-				#endif
+				if (sSectorFirstBlock < address)
+				{
+					sRewindAddr = sSectorFirstBlock;
+					return(true);
+				}
+				blank = true;
 			}
 		} else
+#endif
+		if (eraseSize &&
+			!blank)
 		{
-			Serial.print("?Block erase failed\n");
+			success = EraseBlock(address, endAddress, compare);
+			blank = true;
 		}
-#elif defined TARGET_AT24C
-		uint32_t	address = inBlockIndex*kBlockSize;
+		/*
+		*	Programming 0xFF into an erased unit does nothing, so skip it.
+		*/
+		if (blank)
 		{
-			success = eeprom.Write(address, 256, inData) +
-						eeprom.Write(address+256, 256, inData+256) == kBlockSize;
-
-			if (sVerifyAfterWrite)
+			unitsToWrite = 0;
+			for (uint32_t offset = 0, unit = 1; offset < kBlockSize; offset += programSize, unit <<= 1)
 			{
-				uint8_t	verifyBuff[256];
-				#if 0
-				success = (eeprom.Read(address, 256, verifyBuff) == 256 &&
-					memcmp(inData, verifyBuff, 256) == 0 &&
-					eeprom.Read(address+256, 256, verifyBuff) == 256 &&
-					memcmp(&inData[256], verifyBuff, 256) == 0;
-				#else
-				success = eeprom.Read(address, 256, verifyBuff) == 256;
+				for (uint16_t i = 0; i < programSize; i++)
+				{
+					if (inData[offset + i] == 0xFF ||
+						offset + i < dataStart ||
+						offset + i >= dataEnd)continue;
+					unitsToWrite |= unit;
+					break;
+				}
+			}
+		}
+		for (uint32_t offset = 0, unit = 1; success && offset < kBlockSize; offset += programSize, unit <<= 1)
+		{
+			if (unitsToWrite & unit)
+			{
+				uint32_t	unitStart = offset > dataStart ? offset : dataStart;
+				uint32_t	unitEnd = offset + programSize < dataEnd ? offset + programSize : dataEnd;
+				if (unitStart < unitEnd)
+				{
+					success = device.ProgramRange(address + unitStart, unitEnd - unitStart, &inData[unitStart]);
+				}
+			}
+		}
+#ifndef TARGET_SD
+		if (success &&
+			sVerifyAfterWrite &&
+			unitsToWrite)
+		{
+			uint32_t	verifySize = programSize < sizeof(sReadBuffer) ? programSize : sizeof(sReadBuffer);
+			for (uint32_t offset = dataStart; offset < dataEnd; offset += verifySize)
+			{
+				if (verifySize > dataEnd - offset)
+				{
+					verifySize = dataEnd - offset;
+				}
+				success = device.ReadRange(address + offset, verifySize, sReadBuffer);
 				if (success)
 				{
-					success = memcmp(inData, verifyBuff, 256) == 0;
+					success = memcmp(&inData[offset], sReadBuffer, verifySize) == 0;
 					if (success)
 					{
-						success = eeprom.Read(address+256, 256, verifyBuff) == 256;
-						if (success)
-						{
-							success = memcmp(&inData[256], verifyBuff, 256) == 0;
-							if (!success)
-							{
-								Serial.print("?Failed compare data[256]\n");
-								/*Serial.write((const char*)verifyBuff, 256);
-								Serial.print("\n\n");
-								Serial.write((const char*)&inData[256], 256);
-								Serial.print("\n\n");*/
-							}
-						} else
-						{
-							Serial.print("?Failed reading data[256]\n");
-						}
-					} else
-					{
-						Serial.print("?Failed compare data[0]\n");
-						/*Serial.write((const char*)verifyBuff, 256);
-						Serial.print("\n\n");
-						Serial.write((const char*)inData, 256);
-						Serial.print("\n\n");*/
+						continue;
 					}
+					Serial.print("?Failed compare data[");
 				} else
 				{
-					Serial.print("?Failed reading data[0]\n");
+					Serial.print("?Failed reading data[");
 				}
-				#endif
+				Serial.print(offset);
+				Serial.print("]\n");
+				break;
 			}
 		}
 #endif
@@ -398,14 +1014,6 @@ bool WriteBlock(
 	return(success);
 }
 
-/****************************** HexAsciiToBin *********************************/
-// Assumes 0-9, A-Z (uppercase)
-uint8_t	HexAsciiToBin(
-	uint8_t	inByte)
-{
-	 return (inByte <= '9' ? (inByte - '0') : (inByte - ('A' - 10)));
-}
-
 /********************************* GetChar ************************************/
 uint8_t GetChar(void)
 {
@@ -418,20 +1026,12 @@ uint8_t GetChar(void)
 	return(Serial.read());
 }
 
-/**************************** GetNexHextLineChar ******************************/
-uint8_t GetNexHextLineChar(void)
-{
-	uint8_t	thisChar = sEndOfLineBufferPtr > sLineBufferPtr ? *(sLineBufferPtr++) : 'O';
-	return(thisChar);
-}
-
 /******************************* LoadHexLine **********************************/
 bool LoadHexLine(void)
 {
 	uint8_t	thisChar = GetChar();
 	uint8_t*	bufferPtr = sLineBuffer;
 	uint8_t*	endBufferPtr = &sLineBuffer[MAX_HEX_LINE_LEN];
-	sLineBufferPtr = sLineBuffer;
 	while (thisChar != ':')
 	{
 		switch (thisChar)
@@ -466,36 +1066,79 @@ bool LoadHexLine(void)
 	return(thisChar == '\n');
 }
 
+/****************************** DecodeHexLine *********************************/
+/*
+*	Converts the hex line loaded in sLineBuffer to binary in one pass.  The
+*	binary record overwrites the line in place starting at sLineBuffer[0]:
+*	byte count, address H, address L, record type, data, checksum.  This is
+*	safe because the binary is written two characters behind the read.
+*
+*	The line is rejected if it contains anything other than hex digits, if the
+*	number of digits doesn't agree with the byte count, or if the checksum
+*	fails.  Nothing is changed in the block buffer until the line is valid.
+*/
+uint8_t DecodeHexLine(void)
+{
+	const uint8_t*	charPtr = &sLineBuffer[1];	// Skip the start code
+	const uint8_t*	endCharPtr = sEndOfLineBufferPtr;
+	uint8_t*		recordPtr = sLineBuffer;
+	uint8_t			checksum = 0;
+	
+	if (endCharPtr > charPtr &&
+		endCharPtr[-1] == '\r')
+	{
+		endCharPtr--;
+	}
+	if ((endCharPtr - charPtr) & 1)
+	{
+		return(eLineInvalidLength);
+	}
+	while (charPtr < endCharPtr)
+	{
+		uint8_t	hiNibble = pgm_read_byte(&kHexNibble[*(charPtr++)]);
+		uint8_t	loNibble = pgm_read_byte(&kHexNibble[*(charPtr++)]);
+		if ((hiNibble | loNibble) & 0xF0)
+		{
+			return(eLineInvalidChar);
+		}
+		uint8_t	thisByte = (hiNibble << 4) | loNibble;
+		checksum += thisByte;
+		*(recordPtr++) = thisByte;
+	}
+	/*
+	*	A record is the byte count, 2 address bytes, record type, data, and
+	*	the checksum, so a valid record is always 5 bytes + byte count.
+	*/
+	uint8_t	recordLength = recordPtr - sLineBuffer;
+	if (recordLength < 5 ||
+		recordLength != (sLineBuffer[0] + 5))
+	{
+		return(eLineInvalidLength);
+	}
+	return(checksum == 0 ? eLineValid : eLineChecksumError);
+}
+
 /******************************* HexDownload **********************************/
 void HexDownload(void)
 {
-	uint8_t	    thisChar;
-	uint8_t		thisByte = 0;
-	uint8_t		state = 0;
 	uint8_t		status = eProcessing;
-	uint32_t	byteCount = 0;
-	uint32_t	address = 0;
 	uint32_t	currentBlockIndex = 0xFFFFFFFF;
 	uint32_t	baseAddress = 0;
-	uint8_t		recordType = eRecordTypeData;
-	uint8_t		checksum = 0;
-	uint8_t		hiLow = 1;
 	uint8_t*	data = NULL;
-	uint8_t*	dataPtr = NULL;
-	uint32_t	dataIndex = 0;
 	
+	sSectorFirstBlock = sRewindAddr = kNoRewind;
+	device.BeginProgramming(sEraseStart, sEraseEnd ? sEraseEnd - sEraseStart : 0);
 	Serial.write('*');	// Tell the host the mode change was successful
 	while(status == eProcessing)
 	{
-		LoadHexLine();
-		thisChar = GetNexHextLineChar();
-		if (thisChar != ':')
+		bool	lineLoaded = LoadHexLine();
+		if (sLineBuffer[0] != ':')
 		{
 			/*
 			*	If this isn't the character 'S' for stop THEN
 			*	report the invalid character.
 			*/
-			switch (thisChar)
+			switch (sLineBuffer[0])
 			{
 				case 'S':
 					Serial.print("?Stopped by user\n");
@@ -509,143 +1152,193 @@ void HexDownload(void)
 			}
 			status = eError;
 			break;
-		} else
+		}
+		if (!lineLoaded)
+		{
+			Serial.print("?Line too long\n");
+			status = eError;
+			break;
+		}
+		switch (DecodeHexLine())
+		{
+			case eLineValid:
+				break;
+			case eLineInvalidChar:
+				Serial.print("?Invalid character\n");
+				status = eError;
+				continue;
+			case eLineInvalidLength:
+				Serial.print("?Invalid line length\n");
+				status = eError;
+				continue;
+			default:
+				Serial.print("?Checksum error\n");
+				status = eError;
+				continue;
+		}
+		
+		uint8_t			byteCount = sLineBuffer[0];
+		uint16_t		address = ((uint16_t)sLineBuffer[1] << 8) + sLineBuffer[2];
+		const uint8_t*	recordData = &sLineBuffer[4];
+		switch (sLineBuffer[3])	// Record type
 		{
-			while(status == eProcessing)
+			case eRecordTypeData:
 			{
-				thisChar = GetNexHextLineChar();
-				hiLow++;	// nibble toggle
+				uint32_t newBlockIndex = (baseAddress + address) / kBlockSize;
 				/*
-				*	If this is the high nibble THEN
-				*	process the complete byte
+				*	If the block changed THEN
+				*	write the current block (if any) and
+				*	initialize the new block data buffer.
 				*/
-				if (hiLow & 1)
+				if (currentBlockIndex != newBlockIndex)
 				{
-					thisByte = (thisByte << 4) + HexAsciiToBin(thisChar);
-					checksum += thisByte;
-					switch (state)
+					if (!WriteBlock(data, currentBlockIndex))
+					{
+						Serial.print("?Failed writing data\n");
+						status = eError;
+						break;
+					}
+					if (sRewindAddr != kNoRewind)
+					{
+						break;
+					}
+					currentBlockIndex = newBlockIndex;
+					data = ClearBuffer();
+					/*
+					*	When erasing before write without comparing, the
+					*	block will be erased before it's written.  Start
+					*	erasing now so that the erase runs while the rest of
+					*	the block's data is being received.
+					*
+					*	With compare on, a sector is only erased once the
+					*	compare finds data that needs a bit set.  From then
+					*	on the download is replacing what's on the device,
+					*	so the sectors that follow the erased region are
+					*	erased ahead too (unless already blank.)  If one of
+					*	them did already hold the data, the cost is an erase
+					*	and programming the block in full, nothing is lost.
+					*/
+					if (sEraseBeforeWrite &&
+						device.GetEraseSize())
 					{
-						case eGetByteCount:
+						uint32_t	newAddress = newBlockIndex*kBlockSize;
+						bool		eraseAhead = !sCompareBeforeWrite ||
+											(sErasedTo > sErasedFrom &&
+											newAddress >= sErasedFrom &&
+											newAddress <= sErasedTo);
+						if (eraseAhead &&
+							!EraseBlock(newAddress, newAddress + kBlockSize, sCompareBeforeWrite))
 						{
-							byteCount = thisByte;
-							address = 0;
-							state++;
-							continue;
-						}
-						case eGetAddressH:
-						case eGetAddressL:
-							address = (address << 8) + thisByte;
-							state++;
-							continue;
-						case eGetRecordType:
-							recordType = thisByte;
-							state++;
-							dataIndex = 0;
-							if (recordType == eRecordTypeData)
-							{
-								uint32_t newBlockIndex = (baseAddress + address) / kBlockSize;
-								/*
-								*	If the block changed THEN
-								*	write the current block (if any) and
-								*	initialize the new block data buffer.
-								*/
-								if (currentBlockIndex != newBlockIndex)
-								{
-									if (WriteBlock(data, currentBlockIndex))
-									{
-										currentBlockIndex = newBlockIndex;
-										data = ClearBuffer();
-									} else
-									{
-										Serial.print("?Failed writing data\n");
-										status = eError;
-										break;
-									}
-								}
-								dataPtr = &data[address % kBlockSize];
-								/*
-								*	For whatever the choosen page size in
-								*	SerialHexLoader, a hex line must stay within
-								*	the current page.
-								*
-								*	If this line spans two pages THEN
-								*	fail.
-								*	This can happen if the hex file was created
-								*	with a larger page size than kBlockSize.
-								*/
-								if ((&dataPtr[byteCount] - data) > kBlockSize)
-								{
-									Serial.print("?Line spans two pages\n");
-									status = eError;
-									break;
-								}
-							} else if (recordType == eRecordTypeExLinAddr)
-							{
-								address = 0;	// The data contains the address
-								if (byteCount != 2)
-								{
-									Serial.print("?byteCount for RecordTypeExLinAddr not 2\n");
-									status = eError;
-								}
-							} else if (recordType == eRecordTypeEOF)
-							{
-								state++;	// Skip eGetData
-							} else
-							{
-								Serial.print("?Unsupported type\n");
-								status = eError;
-							}
-							continue;
-						case eGetData:
-							if (recordType == eRecordTypeData)
-							{
-								dataPtr[dataIndex] = thisByte;
-							} else
-							{
-								address = (address << 8) + thisByte;
-							}
-							dataIndex++;
-							if (dataIndex < byteCount)
-							{
-								continue;
-							}
-							state++;
-							continue;
-						case eGetChecksum:
-							if (checksum == 0)
-							{
-								state = 0;
-								if (recordType == eRecordTypeExLinAddr)
-								{
-									baseAddress = address << 16;
-								} else if (recordType == eRecordTypeEOF)
-								{
-									status = eDone;
-								}
-								Serial.write('*');
-								break;
-							}
-							Serial.print("?Checksum error\n");
 							status = eError;
 							break;
+						}
 					}
+				}
+				uint32_t	blockOffset = address % kBlockSize;
+				/*
+				*	For whatever the choosen page size in SerialHexLoader, a
+				*	hex line must stay within the current page.
+				*
+				*	If this line spans two pages THEN
+				*	fail.
+				*	This can happen if the hex file was created with a larger
+				*	page size than kBlockSize.
+				*/
+				if ((blockOffset + byteCount) > kBlockSize)
+				{
+					Serial.print("?Line spans two pages\n");
+					status = eError;
 					break;
+				}
+				memcpy(&data[blockOffset], recordData, byteCount);
+				break;
+			}
+			case eRecordTypeExLinAddr:
+				if (byteCount == 2)
+				{
+					baseAddress = ((uint32_t)recordData[0] << 24) +
+									((uint32_t)recordData[1] << 16);
 				} else
 				{
-					thisByte = HexAsciiToBin(thisChar);
+					Serial.print("?byteCount for RecordTypeExLinAddr not 2\n");
+					status = eError;
 				}
-			}
+				break;
+			case eRecordTypeEOF:
+				if (!WriteBlock(data, currentBlockIndex))
+				{
+					Serial.print("?Failed writing data\n");
+					status = eError;
+				} else if (sRewindAddr == kNoRewind)
+				{
+					status = eDone;
+				}
+				break;
+			default:
+				Serial.print("?Unsupported type\n");
+				status = eError;
+				break;
+		}
+		/*
+		*	If writing the block requires a sector to be erased that contains
+		*	blocks already written THEN
+		*	ask the host to resend starting with the first of those blocks by
+		*	replying <address\n rather than *.  The block being loaded is
+		*	discarded, it will be resent.
+		*/
+		if (sRewindAddr != kNoRewind)
+		{
+			Serial.write('<');
+			Serial.print(sRewindAddr, HEX);
+			Serial.write('\n');
+			baseAddress = sRewindAddr & 0xFFFF0000;
+			currentBlockIndex = 0xFFFFFFFF;
+			data = NULL;
+			sRewindAddr = kNoRewind;
+		} else if (status != eError)
+		{
+			Serial.write('*');
 		}
 	}
+	/*
+	*	Complete any programming still in progress before reporting success.
+	*/
+	if (!device.EndProgramming() &&
+		status == eDone)
+	{
+		Serial.print("?Failed writing data\n");
+		status = eError;
+	}
 	if (status == eDone)
 	{
-		WriteBlock(data, currentBlockIndex);
 		Serial.print("* success!\n");
 	}
+	/*
+	*	Warn that data outside of the range may have been erased with the
+	*	sectors at its ends.  This follows the reply because the hosts stop
+	*	the download on any other text.
+	*/
+	uint32_t	eraseSize = device.GetEraseSize();
+	if (sEraseBeforeWrite &&
+		eraseSize &&
+		sEraseEnd &&
+		((sEraseStart | sEraseEnd) % eraseSize) != 0)
+	{
+		Serial.print("Warning: the range 0x");
+		Serial.print(sEraseStart, HEX);
+		Serial.print(" to 0x");
+		Serial.print(sEraseEnd, HEX);
+		Serial.print(" isn't aligned to the 0x");
+		Serial.print(eraseSize, HEX);
+		Serial.print(" byte erase size, the sectors at its ends were erased in full\n");
+	}
+	// The range only applies to a single download
+	sEraseStart = 0;
+	sEraseEnd = 0;
 	// Clean out the rest of the serial buffer, if any
 	delay(1000);
 	while (Serial.available())
 	{
 		Serial.read();
 	}
-}
\ No newline at end of file
+}
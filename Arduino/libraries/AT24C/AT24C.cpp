@@ -25,14 +25,28 @@
 #include "AT24C.h"
 #include <Wire.h>
 
+#ifdef __AVR__
+#include <util/twi.h>
+/*
+*	Writes and ack polls bypass Wire.  Wire's 32 byte buffer limits a write
+*	to 30 data bytes, so a 64 or 128 byte page would take several write
+*	cycles.  With the polled TWI routines below a full page is written in a
+*	single write cycle.  Reads still use Wire.
+*/
+static const uint16_t	kMaxWriteLength = 0xFFFF;
+#elif defined BUFFER_LENGTH
+static const uint16_t	kMaxWriteLength = BUFFER_LENGTH - 2;
+#else
+static const uint16_t	kMaxWriteLength = 30;
+#endif
+
 /*********************************** AT24C ************************************/
 AT24C::AT24C(
 	uint8_t	inDeviceAddress,
-	uint8_t	inCapacity)
-	: mDeviceAddress(inDeviceAddress)
-#ifdef DEBUG_AT24C
-		, mMaxWaitTime(0)
-#endif
+	uint16_t	inCapacity)
+	: mDeviceAddress(inDeviceAddress),
+	  mCapacity((uint32_t)inCapacity * 1024), mWriting(false),
+	  mCompareBeforeWrite(false)
 {
 	switch(inCapacity)
 	{
@@ -47,35 +61,69 @@ AT24C::AT24C(
 		case 64:
 			mPageSize = 128;
 			break;
+		case 128:
+		case 256:
+			mPageSize = 256;
+			break;
 		default:
 			mPageSize = 32;
 			break;
 	}
+#ifdef DEBUG_AT24C
+	mWriteEnd = 0;
+	ResetBusyStats();
+#endif
+}
+
+/******************************** SetBusSpeed *********************************/
+void AT24C::SetBusSpeed(
+	uint32_t	inHz)
+{
+	Wire.setClock(inHz);
 }
 
 /************************************ Read ************************************/
-uint16_t AT24C::Read(
-	uint16_t	inDataAddress,
-	uint16_t	inLength,
+/*
+*	For chips larger than 64KB the read is split at 64KB boundaries because
+*	the device address holds the data address bits above 16.
+*/
+uint32_t AT24C::Read(
+	uint32_t	inDataAddress,
+	uint32_t	inLength,
 	uint8_t*	outBuffer)
 {
 	/*
-	*	Setup the AT24C to inDataAddress
+	*	The chip doesn't respond till the write cycle of the last write
+	*	completes.
 	*/
-	Wire.beginTransmission(mDeviceAddress);
-	Wire.write(inDataAddress >> 8);
-	Wire.write(inDataAddress & 0xFF);
-	Wire.endTransmission(true);
-	
-	uint16_t	bytesRead = 0;
-	uint16_t	bytes2Read = inLength;
+	if (!WaitTillReady())
+	{
+		return(0);
+	}
+	uint8_t		bytesRead = 0;
+	uint32_t	bytes2Read = inLength;
+	uint32_t	bytesLeftInSegment = 0;
+	uint8_t		deviceAddress = mDeviceAddress;
 	while (bytes2Read)
 	{
+		if (bytesLeftInSegment == 0)
+		{
+			SetDataAddress(inDataAddress);
+			deviceAddress = DeviceAddress(inDataAddress);
+			bytesLeftInSegment = 0x10000 - (inDataAddress & 0xFFFF);
+		}
+		uint8_t	bytes2Request = bytes2Read >= 32 ? 32 : bytes2Read;
+		if (bytes2Request > bytesLeftInSegment)
+		{
+			bytes2Request = bytesLeftInSegment;
+		}
 		// The most you can read/request from Wire is 32 bytes.
-		bytesRead = Wire.requestFrom(mDeviceAddress, (uint8_t)(bytes2Read >= 32 ? 32 : bytes2Read), (uint8_t)true);
+		bytesRead = Wire.requestFrom(deviceAddress, bytes2Request, (uint8_t)true);
 		if (bytesRead > 0)
 		{
 			bytes2Read -= bytesRead;
+			inDataAddress += bytesRead;
+			bytesLeftInSegment -= bytesRead;
 			for (uint8_t i = bytesRead; i != 0; i--)
 			{
 				*(outBuffer++) = (uint8_t)Wire.read();
@@ -88,66 +136,284 @@ uint16_t AT24C::Read(
 	return(inLength);
 }
 
+/******************************* SetDataAddress *******************************/
+/*
+*	Setup the AT24C to inDataAddress for the reads that follow.
+*/
+void AT24C::SetDataAddress(
+	uint32_t	inDataAddress)
+{
+	Wire.beginTransmission(DeviceAddress(inDataAddress));
+	Wire.write((inDataAddress >> 8) & 0xFF);
+	Wire.write(inDataAddress & 0xFF);
+	Wire.endTransmission(true);
+}
+
+/********************************** Matches ***********************************/
+/*
+*	Returns true if the chip already holds inData at inDataAddress.  The data
+*	is compared as it's read (a sequential read), so no buffer is needed.
+*	A read error returns false so that the data gets written.
+*/
+bool AT24C::Matches(
+	uint32_t		inDataAddress,
+	uint16_t		inLength,
+	const uint8_t*	inData)
+{
+	SetDataAddress(inDataAddress);
+	uint8_t	deviceAddress = DeviceAddress(inDataAddress);
+	while (inLength)
+	{
+		// The most you can read/request from Wire is 32 bytes.
+		uint8_t	bytesRead = Wire.requestFrom(deviceAddress, (uint8_t)(inLength >= 32 ? 32 : inLength), (uint8_t)true);
+		if (bytesRead == 0)
+		{
+			return(false);
+		}
+		inLength -= bytesRead;
+		for (; bytesRead != 0; bytesRead--)
+		{
+			if ((uint8_t)Wire.read() == *(inData++))continue;
+			return(false);
+		}
+	}
+	return(true);
+}
+
+#ifdef __AVR__
+/********************************** TWIWait ***********************************/
+/*
+*	Waits for the current TWI operation to complete.  Returns true if the
+*	resulting status is inStatus.  The timeout only guards against a hung bus.
+*/
+static bool TWIWait(
+	uint8_t	inStatus)
+{
+	for (uint16_t i = 0xFFFF; i; i--)
+	{
+		if ((TWCR & _BV(TWINT)) == 0)continue;
+		return(TW_STATUS == inStatus);
+	}
+	return(false);
+}
+
+/********************************* TWIStart ***********************************/
+/*
+*	Sends a start followed by the device address for writing.  Returns true
+*	if the device acknowledged its address.
+*/
+static bool TWIStart(
+	uint8_t	inDeviceAddress)
+{
+	TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+	if (TWIWait(TW_START))
+	{
+		TWDR = inDeviceAddress << 1;
+		TWCR = _BV(TWINT) | _BV(TWEN);
+		return(TWIWait(TW_MT_SLA_ACK));
+	}
+	return(false);
+}
+
+/********************************* TWIWrite ***********************************/
+static bool TWIWrite(
+	uint8_t	inData)
+{
+	TWDR = inData;
+	TWCR = _BV(TWINT) | _BV(TWEN);
+	return(TWIWait(TW_MT_DATA_ACK));
+}
+
+/********************************** TWIStop ***********************************/
+/*
+*	Sends a stop and leaves the TWI the way Wire expects to find it.
+*/
+static void TWIStop(void)
+{
+	TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+	for (uint16_t i = 0xFFFF; i && (TWCR & _BV(TWSTO)); i--){}
+	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+}
+#endif
+
+/********************************** Address ***********************************/
+/*
+*	Sends the device address and returns true if the chip acknowledged it.
+*	The AT24C doesn't acknowledge its address while a write cycle is in
+*	progress.  Any of the chip's device addresses will do.
+*/
+bool AT24C::Address(void)
+{
+#ifdef __AVR__
+	bool	acked = TWIStart(mDeviceAddress);
+	TWIStop();
+	return(acked);
+#else
+	Wire.beginTransmission(mDeviceAddress);
+	return(Wire.endTransmission(true) == 0);
+#endif
+}
+
 /******************************* WaitTillReady ********************************/
 /*
 *	Waits till ready or a timeout occurs, whichever occurs first.
-*	Returns true if ready, else false for a timeout.
+*	Returns true if ready, else false for a timeout.  The chip is polled
+*	continuously, each poll only takes the time to send the address (about
+*	25us at 400KHz), so the end of the write cycle is seen almost
+*	immediately.
 */
 bool AT24C::WaitTillReady(void)
 {
-	uint32_t timeout = micros() + 10000;	// timeout after 10ms
+	if (!mWriting)
+	{
+		return(true);
+	}
+	uint32_t	start = micros();
+	uint32_t	nacks = 0;
 	do
 	{
-		Wire.beginTransmission(mDeviceAddress);
-		if (Wire.endTransmission(true))
+		if (!Address())
 		{
+			nacks++;
 			continue;
 		}
+		EndBusy(micros() - start, nacks);
+		return(true);
+	} while (micros() - start < 10000);	// timeout after 10ms
 #ifdef DEBUG_AT24C
-		uint32_t	waitTime = micros() - timeout + 10000;
-		if (waitTime > mMaxWaitTime)
+	mBusyStats.waitTime += micros() - start;
+	mBusyStats.nacks += nacks;
+#endif
+	return(false);
+}
+
+/*********************************** IsBusy ***********************************/
+bool AT24C::IsBusy(void)
+{
+	if (mWriting)
+	{
+		if (Address())
+		{
+			EndBusy(0, 0);
+		} else
 		{
-			mMaxWaitTime = waitTime;
+		#ifdef DEBUG_AT24C
+			mBusyStats.nacks++;
+		#endif
+			return(true);
 		}
+	}
+	return(false);
+}
+
+/********************************** EndBusy ***********************************/
+/*
+*	Called when the chip acknowledges its address after a write.
+*/
+void AT24C::EndBusy(
+	uint32_t	inWaitTime,
+	uint32_t	inNacks)
+{
+#ifdef DEBUG_AT24C
+	uint32_t	busyTime = micros() - mWriteEnd;
+	mBusyStats.count++;
+	mBusyStats.busyTime += busyTime;
+	if (busyTime > mBusyStats.maxBusyTime)
+	{
+		mBusyStats.maxBusyTime = busyTime;
+	}
+	mBusyStats.waitTime += inWaitTime;
+	mBusyStats.nacks += inNacks;
 #endif
-		return(true);
-	} while (timeout > micros());
+	mWriting = false;
+}
+
 #ifdef DEBUG_AT24C
-	mMaxWaitTime = 10000;
+/******************************* ResetBusyStats *******************************/
+void AT24C::ResetBusyStats(void)
+{
+	memset(&mBusyStats, 0, sizeof(mBusyStats));
+}
 #endif
-	return(false);
+
+/********************************* WritePage **********************************/
+/*
+*	Writes inLength bytes within a single page as one write transaction.  The
+*	chip starts its write cycle when the transaction stops.
+*/
+bool AT24C::WritePage(
+	uint32_t		inDataAddress,
+	uint16_t		inLength,
+	const uint8_t*	inBuffer)
+{
+#ifdef __AVR__
+	bool	success = TWIStart(DeviceAddress(inDataAddress)) &&
+						TWIWrite((inDataAddress >> 8) & 0xFF) &&
+						TWIWrite(inDataAddress & 0xFF);
+	for (; success && inLength; inLength--)
+	{
+		success = TWIWrite(*(inBuffer++));
+	}
+	TWIStop();
+#else
+	Wire.beginTransmission(DeviceAddress(inDataAddress));
+	Wire.write((inDataAddress >> 8) & 0xFF);
+	Wire.write(inDataAddress & 0xFF);
+	Wire.write(inBuffer, inLength);
+	bool	success = Wire.endTransmission(true) == 0;
+#endif
+	if (success)
+	{
+		mWriting = true;
+	#ifdef DEBUG_AT24C
+		mWriteEnd = micros();
+	#endif
+	}
+	return(success);
 }
 
 /*********************************** Write ************************************/
-uint16_t AT24C::Write(
-	uint16_t		inDataAddress,
-	uint16_t		inLength,
+/*
+*	Constraints:
+*	- The AT24Cxx only allows you to write to a single page at a time:
+*		32/64 - 32 byte page (low 5 bits is the address within the page)
+*		128/256 - 64 byte page (low 6 bits is the address within the page)
+*		512 - 128 byte page (low 7 bits is the address within the page)
+*		M01/M02 - 256 byte page (low 8 bits is the address within the page)
+*	- Each write transaction costs a write cycle (about 5ms) so as much of a
+*	page as possible is written in one transaction (see kMaxWriteLength.)
+*	Continuing a page write after a repeated start doesn't work, each
+*	transaction starts its own write cycle.
+*
+*	Write returns without waiting for the last write cycle to complete, the
+*	next read or write waits for it.  The data can be received in the
+*	meantime.
+*
+*	When compare before write is on, pieces that already hold the data are
+*	skipped.
+*/
+uint32_t AT24C::Write(
+	uint32_t		inDataAddress,
+	uint32_t		inLength,
 	const uint8_t*	inBuffer)
 {
-	/*
-	*	Constraints:
-	*	- Wire only allows you to write 32 bytes at a time (including the 2 data address bytes).
-	*	- The AT24Cxx only allows you to write to a single page at a time:
-	*		32/64 - 32 byte page (low 5 bits is the address within the page)
-	*		128/256 - 64 byte page (low 6 bits is the address within the page)
-	*		512 - 128 byte page (low 7 bits is the address within the page)
-	*/
-	uint16_t	lowerAddressMask = 0x7F >> (2 - (mPageSize >> 6)); // results in one of 0x1F, 0x3F, 0x7F
-	uint16_t	bytesLeftInPage = mPageSize - (inDataAddress & lowerAddressMask);
-	uint16_t	bytesLeft2Write = inLength;
+	uint16_t	bytesLeftInPage = mPageSize - (inDataAddress & (mPageSize - 1));
+	uint32_t	bytesLeft2Write = inLength;
 	uint16_t	bytes2Write;
-	while (WaitTillReady() &&
-		bytesLeft2Write)
+	while (bytesLeft2Write &&
+		WaitTillReady())
 	{
-		bytes2Write = bytesLeftInPage > 30 ? 30 : bytesLeftInPage;
-		Wire.beginTransmission(mDeviceAddress);
-		Wire.write(inDataAddress >> 8);
-		Wire.write(inDataAddress & 0xFF);
+		bytes2Write = bytesLeftInPage > kMaxWriteLength ? kMaxWriteLength : bytesLeftInPage;
 		if (bytes2Write > bytesLeft2Write)
 		{
 			bytes2Write = bytesLeft2Write;
 		}
-		Wire.write(inBuffer, bytes2Write);
+		if ((!mCompareBeforeWrite ||
+			!Matches(inDataAddress, bytes2Write, inBuffer)) &&
+			!WritePage(inDataAddress, bytes2Write, inBuffer))
+		{
+			break;
+		}
 		inBuffer += bytes2Write;
 		inDataAddress += bytes2Write;
 		bytesLeft2Write -= bytes2Write;
@@ -156,27 +422,6 @@ uint16_t AT24C::Write(
 		{
 			bytesLeftInPage = mPageSize;
 		}
-		/*
-		This was an attempt to continue to write to the eeprom till the page is
-		full and only then end the transmission with a stop.  This doesn't work.
-		
-		while (bytesLeft2Write &&
-			bytesLeftInPage)
-		{
-			Wire.endTransmission(false);
-			Wire.beginTransmission(mDeviceAddress);
-			bytes2Write = bytesLeftInPage > 32 ? 32 : bytesLeftInPage;
-			if (bytes2Write > bytesLeft2Write)
-			{
-				bytes2Write = bytesLeft2Write;
-			}
-			Wire.write(inBuffer, bytes2Write);
-			inBuffer += bytes2Write;
-			inDataAddress += bytes2Write;
-			bytesLeft2Write -= bytes2Write;
-			bytesLeftInPage -= bytes2Write;
-		}*/
-		Wire.endTransmission(true);
 	}
 	return(bytesLeft2Write == 0 ? inLength : 0);
 }
@@ -26,35 +26,121 @@
 
 // AT24C01A -> C16A aren't supported
 // Only tested with C32 and C128 (32 byte and 64 byte pages resp.)
+// The AT24CM01 and AT24CM02 (256 byte pages) have 17 and 18 bit data
+// addresses, the bits above 16 are the low bits of the device address.
 #define DEBUG_AT24C 1
-class AT24C
+#include "BlockDevice.h"
+
+class AT24C : public BlockDevice
 {
 public:
 							AT24C(
 								uint8_t					inDeviceAddress,
-								uint8_t					inCapacity); // KB, one of: 4, 8, 16, 32, 64
-	uint16_t				Read(
-								uint16_t				inDataAddress,
-								uint16_t				inLength,
+								uint16_t				inCapacity); // KB, one of: 4, 8, 16, 32, 64, 128, 256
+	uint32_t				Read(
+								uint32_t				inDataAddress,
+								uint32_t				inLength,
 								uint8_t*				outBuffer);
-	uint16_t				Write(
-								uint16_t				inDataAddress,
-								uint16_t				inLength,
+	uint32_t				Write(
+								uint32_t				inDataAddress,
+								uint32_t				inLength,
 								const uint8_t*			inBuffer);
+	uint8_t					GetDeviceAddress(void) const
+								{return(mDeviceAddress);}
 	/*
 	*	Rather than use some large software delay, this routine polls the AT24C
 	*	chip waiting for it to return 0 after it enables itself after writing.
 	*/
 	bool					WaitTillReady(void);
+	/*
+	*	The I2C clock in Hz, 400000 or, for chips that support it, 1000000.
+	*	Call after Wire.begin().
+	*/
+	void					SetBusSpeed(
+								uint32_t				inHz);
+	/*
+	*	When on, Write reads each page first and only writes it when it
+	*	differs from the data.  This saves a write cycle (and wear) for every
+	*	page that's unchanged.  Off by default.
+	*/
+	void					SetCompareBeforeWrite(
+								bool					inCompareBeforeWrite)
+								{mCompareBeforeWrite = inCompareBeforeWrite;}
+	// BlockDevice
+	virtual uint32_t		GetCapacity(void)
+								{return(mCapacity);}
+	virtual uint16_t		GetProgramSize(void)
+								{return(mPageSize);}
+	virtual uint32_t		GetEraseSize(void)
+								{return(0);}	// No erase needed
+	virtual bool			ProgramRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								const uint8_t*			inData)
+								{return(Write(inAddr, inLength, inData) == inLength);}
+	virtual bool			ReadRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								uint8_t*				outData)
+								{return(Read(inAddr, inLength, outData) == inLength);}
+	virtual bool			EraseRange(
+								uint32_t				inAddr,
+								uint32_t				inLength)
+								{return(true);}
+	virtual bool			IsBusy(void);
+	virtual bool			EndProgramming(void)
+								{return(WaitTillReady());}
 #ifdef DEBUG_AT24C
+	/*
+	*	Times are in microseconds.  busyTime is from the end of a write till
+	*	the chip acknowledges its address again.  waitTime is the part of
+	*	busyTime spent blocked in WaitTillReady.  nacks is the number of
+	*	ack polls the chip didn't acknowledge.
+	*/
+	struct SBusyStats
+	{
+		uint32_t	count;
+		uint32_t	busyTime;
+		uint32_t	maxBusyTime;
+		uint32_t	waitTime;
+		uint32_t	nacks;
+	};
+	const SBusyStats&		GetBusyStats(void) const
+								{return(mBusyStats);}
+	void					ResetBusyStats(void);
 	uint32_t				MaxWaitTime(void)
-								{return(mMaxWaitTime);}
-	uint32_t mMaxWaitTime;
+								{return(mBusyStats.maxBusyTime);}
 #endif
 private:
 	uint8_t		mDeviceAddress;	// 0x50 + N low address bits.
-								// 3 bits for C32 -> C64, 2 bits for C128 -> C512
-	uint8_t		mPageSize;		// Initialized to one of: 32, 64, 128
+								// 3 bits for C32 -> C64, 2 bits for C128 -> C512,
+								// 2 bits for M01, 1 bit for M02
+	uint16_t	mPageSize;		// Initialized to one of: 32, 64, 128, 256
+	uint32_t	mCapacity;		// In bytes
+	bool		mWriting;		// A write cycle may be in progress
+	bool		mCompareBeforeWrite;
+#ifdef DEBUG_AT24C
+	uint32_t	mWriteEnd;		// micros() at the end of the last write
+	SBusyStats	mBusyStats;
+#endif
+
+	bool					Address(void);
+	uint8_t					DeviceAddress(
+								uint32_t				inDataAddress) const
+								{return(mDeviceAddress | (uint8_t)(inDataAddress >> 16));}
+	void					SetDataAddress(
+								uint32_t				inDataAddress);
+	bool					Matches(
+								uint32_t				inDataAddress,
+								uint16_t				inLength,
+								const uint8_t*			inData);
+	void					EndBusy(
+								uint32_t				inWaitTime,
+								uint32_t				inNacks);
+	bool					WritePage(
+								uint32_t				inDataAddress,
+								uint16_t				inLength,
+								const uint8_t*			inBuffer);
 };
 
 #endif
\ No newline at end of file
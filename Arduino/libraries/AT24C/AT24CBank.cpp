@@ -0,0 +1,143 @@
+/*
+*	AT24CBank.cpp, Copyright Jonathan Mackey 2019
+*	Several AT24C chips on one bus accessed as one device.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+
+#include "Arduino.h"
+#include "AT24CBank.h"
+
+/********************************* AT24CBank **********************************/
+AT24CBank::AT24CBank(
+	AT24C* const*	inChips,
+	uint8_t			inChipCount)
+	: mChips(inChips), mChipCount(inChipCount)
+{
+}
+
+/******************************** GetCapacity *********************************/
+uint32_t AT24CBank::GetCapacity(void)
+{
+	uint32_t	capacity = 0;
+	for (uint8_t i = 0; i < mChipCount; i++)
+	{
+		capacity += mChips[i]->GetCapacity();
+	}
+	return(capacity);
+}
+
+/********************************** FindChip **********************************/
+/*
+*	Returns the chip holding ioAddr, or NULL if ioAddr is beyond the last
+*	chip.  ioAddr is changed to the address within the chip, and ioLength is
+*	clipped to the end of the chip.
+*/
+AT24C* AT24CBank::FindChip(
+	uint32_t&	ioAddr,
+	uint32_t&	ioLength) const
+{
+	for (uint8_t i = 0; i < mChipCount; i++)
+	{
+		uint32_t	capacity = mChips[i]->GetCapacity();
+		if (ioAddr >= capacity)
+		{
+			ioAddr -= capacity;
+			continue;
+		}
+		if (ioLength > capacity - ioAddr)
+		{
+			ioLength = capacity - ioAddr;
+		}
+		return(mChips[i]);
+	}
+	return(NULL);
+}
+
+/******************************** ProgramRange ********************************/
+bool AT24CBank::ProgramRange(
+	uint32_t		inAddr,
+	uint32_t		inLength,
+	const uint8_t*	inData)
+{
+	while (inLength)
+	{
+		uint32_t	addr = inAddr;
+		uint32_t	length = inLength;
+		AT24C*		chip = FindChip(addr, length);
+		if (chip &&
+			chip->ProgramRange(addr, length, inData))
+		{
+			inAddr += length;
+			inLength -= length;
+			inData += length;
+			continue;
+		}
+		return(false);
+	}
+	return(true);
+}
+
+/********************************* ReadRange **********************************/
+bool AT24CBank::ReadRange(
+	uint32_t	inAddr,
+	uint32_t	inLength,
+	uint8_t*	outData)
+{
+	while (inLength)
+	{
+		uint32_t	addr = inAddr;
+		uint32_t	length = inLength;
+		AT24C*		chip = FindChip(addr, length);
+		if (chip &&
+			chip->ReadRange(addr, length, outData))
+		{
+			inAddr += length;
+			inLength -= length;
+			outData += length;
+			continue;
+		}
+		return(false);
+	}
+	return(true);
+}
+
+/*********************************** IsBusy ***********************************/
+bool AT24CBank::IsBusy(void)
+{
+	for (uint8_t i = 0; i < mChipCount; i++)
+	{
+		if (mChips[i]->IsBusy())
+		{
+			return(true);
+		}
+	}
+	return(false);
+}
+
+/******************************* EndProgramming *******************************/
+bool AT24CBank::EndProgramming(void)
+{
+	bool	success = true;
+	for (uint8_t i = 0; i < mChipCount; i++)
+	{
+		success = mChips[i]->EndProgramming() && success;
+	}
+	return(success);
+}
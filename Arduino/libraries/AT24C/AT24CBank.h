@@ -0,0 +1,77 @@
+/*
+*	AT24CBank.h, Copyright Jonathan Mackey 2019
+*	Several AT24C chips on one bus accessed as one device.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef AT24CBank_h
+#define AT24CBank_h
+
+#include "AT24C.h"
+
+/*
+*	The chips follow each other in the bank's address space in the order
+*	they're listed, e.g. two AT24C256 chips at 0x50 and 0x51 are addresses
+*	0 to 0xFFFF.  The chips should be the same type, the program size is
+*	that of the first chip.
+*
+*	Because each chip has its own write cycle, a range that spans two chips
+*	continues on the second chip while the first completes its last write.
+*/
+class AT24CBank : public BlockDevice
+{
+public:
+							AT24CBank(
+								AT24C* const*			inChips,
+								uint8_t					inChipCount);
+	uint8_t					GetChipCount(void) const
+								{return(mChipCount);}
+	AT24C*					GetChip(
+								uint8_t					inIndex) const
+								{return(mChips[inIndex]);}
+	// BlockDevice
+	virtual uint32_t		GetCapacity(void);
+	virtual uint16_t		GetProgramSize(void)
+								{return(mChips[0]->GetProgramSize());}
+	virtual uint32_t		GetEraseSize(void)
+								{return(0);}	// No erase needed
+	virtual bool			ProgramRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								const uint8_t*			inData);
+	virtual bool			ReadRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								uint8_t*				outData);
+	virtual bool			EraseRange(
+								uint32_t				inAddr,
+								uint32_t				inLength)
+								{return(true);}
+	virtual bool			IsBusy(void);
+	virtual bool			EndProgramming(void);
+protected:
+	AT24C* const*	mChips;
+	uint8_t			mChipCount;
+
+	AT24C*					FindChip(
+								uint32_t&				ioAddr,
+								uint32_t&				ioLength) const;
+};
+
+#endif // AT24CBank_h
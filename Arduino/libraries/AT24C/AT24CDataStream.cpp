@@ -22,22 +22,68 @@
 */
 #include "AT24CDataStream.h"
 #include "AT24C.h"
+#include <string.h>
+
+static const uint32_t	kNoLine = 0xFFFFFFFF;
 
 /****************************** AT24CDataStream *******************************/
 AT24CDataStream::AT24CDataStream(
 	AT24C*		inAT24C,
 	const void*	inStartAddress,
 	uint32_t	inLength)
-	: DataStreamImpl(inStartAddress, inLength), mAT24C(inAT24C)
+	: DataStreamImpl(inStartAddress, inLength), mAT24C(inAT24C),
+	  mLineAddr(kNoLine), mValidStart(0), mValidEnd(0), mDirtyStart(0),
+	  mDirtyEnd(0)
 {
+	uint16_t	pageSize = inAT24C->GetProgramSize();
+	mLineSize = pageSize < AT24C_STREAM_CACHE_SIZE ? pageSize : AT24C_STREAM_CACHE_SIZE;
+}
+
+/****************************** ~AT24CDataStream ******************************/
+AT24CDataStream::~AT24CDataStream(void)
+{
+	Flush();
 }
 
 /************************************ Read ************************************/
+/*
+*	Whole lines that aren't cached are read directly into outBuffer.
+*	Anything less is read a line at a time through the cache.
+*/
 uint32_t AT24CDataStream::Read(
 	uint32_t	inLength,
 	void*		outBuffer)
 {
-	uint32_t	bytesRead = mAT24C->Read((uint16_t)mCurrent, Clip(inLength), (uint8_t*)outBuffer);
+	uint32_t	length = Clip(inLength);
+	uint32_t	bytesRead = 0;
+	uint8_t*	buffer = (uint8_t*)outBuffer;
+	while (bytesRead < length)
+	{
+		uint32_t	addr = mCurrent + bytesRead;
+		uint16_t	start = addr & (mLineSize - 1);
+		uint16_t	bytes2Read = mLineSize - start;
+		if (bytes2Read > length - bytesRead)
+		{
+			bytes2Read = length - bytesRead;
+		}
+		if (bytes2Read == mLineSize &&
+			addr != mLineAddr)
+		{
+			if (mAT24C->Read(addr, bytes2Read, &buffer[bytesRead]) != bytes2Read)
+			{
+				break;
+			}
+		} else
+		{
+			if (!LoadLine(addr - start) ||
+				!Fill(0, mLineSize))
+			{
+				break;
+			}
+			memcpy(&buffer[bytesRead], &mCache[start], bytes2Read);
+		}
+		bytesRead += bytes2Read;
+	}
 	mCurrent+=bytesRead;
 	return(bytesRead);
 }
@@ -49,8 +95,137 @@ uint32_t AT24CDataStream::Write(
 {
 	// Space needs to be preallocated via the constructor, the end doesn't
 	// automatically extend.
-	uint32_t	bytesWritten = mAT24C->Write((uint16_t)mCurrent, Clip(inLength), (const uint8_t*)inBuffer);
+	uint32_t		length = Clip(inLength);
+	uint32_t		bytesWritten = 0;
+	const uint8_t*	buffer = (const uint8_t*)inBuffer;
+	while (bytesWritten < length)
+	{
+		uint32_t	addr = mCurrent + bytesWritten;
+		uint16_t	start = addr & (mLineSize - 1);
+		uint16_t	bytes2Write = mLineSize - start;
+		if (bytes2Write > length - bytesWritten)
+		{
+			bytes2Write = length - bytesWritten;
+		}
+		uint16_t	end = start + bytes2Write;
+		if (!LoadLine(addr - start))
+		{
+			break;
+		}
+		/*
+		*	The valid range has to stay contiguous, so any gap between it and
+		*	the data is read from the chip.
+		*/
+		if (mValidStart == mValidEnd)
+		{
+			mValidStart = start;
+			mValidEnd = end;
+		} else if ((start > mValidEnd && !Fill(mValidEnd, start)) ||
+					(end < mValidStart && !Fill(end, mValidStart)))
+		{
+			break;
+		}
+		memcpy(&mCache[start], &buffer[bytesWritten], bytes2Write);
+		if (start < mValidStart)
+		{
+			mValidStart = start;
+		}
+		if (end > mValidEnd)
+		{
+			mValidEnd = end;
+		}
+		if (mDirtyStart == mDirtyEnd)
+		{
+			mDirtyStart = start;
+			mDirtyEnd = end;
+		} else
+		{
+			if (start < mDirtyStart)
+			{
+				mDirtyStart = start;
+			}
+			if (end > mDirtyEnd)
+			{
+				mDirtyEnd = end;
+			}
+		}
+		bytesWritten += bytes2Write;
+		// A full line won't change any further, write it now.
+		if (mDirtyEnd - mDirtyStart == mLineSize &&
+			!Flush())
+		{
+			break;
+		}
+	}
 	mCurrent+=bytesWritten;
 	return(bytesWritten);
 }
 
+/*********************************** Flush ************************************/
+bool AT24CDataStream::Flush(void)
+{
+	bool	success = true;
+	if (mDirtyStart != mDirtyEnd)
+	{
+		uint16_t	length = mDirtyEnd - mDirtyStart;
+		success = mAT24C->Write(mLineAddr + mDirtyStart, length, &mCache[mDirtyStart]) == length;
+		mDirtyStart = mDirtyEnd = 0;
+	}
+	return(success);
+}
+
+/********************************** LoadLine **********************************/
+/*
+*	Makes inLineAddr the cached line, writing the cached line first if it has
+*	data that hasn't been written.  Nothing is read, the new line starts out
+*	empty.
+*/
+bool AT24CDataStream::LoadLine(
+	uint32_t	inLineAddr)
+{
+	bool	success = true;
+	if (inLineAddr != mLineAddr)
+	{
+		success = Flush();
+		mLineAddr = inLineAddr;
+		mValidStart = mValidEnd = 0;
+	}
+	return(success);
+}
+
+/************************************ Fill ************************************/
+/*
+*	Reads the part of inStart to inEnd that isn't valid from the chip so that
+*	the valid range covers inStart to inEnd.  inStart to inEnd must touch or
+*	overlap the valid range, if there is one.
+*/
+bool AT24CDataStream::Fill(
+	uint16_t	inStart,
+	uint16_t	inEnd)
+{
+	bool	success = true;
+	if (mValidStart == mValidEnd)
+	{
+		mValidStart = mValidEnd = inStart;
+	}
+	if (inStart < mValidStart)
+	{
+		uint16_t	length = mValidStart - inStart;
+		success = mAT24C->Read(mLineAddr + inStart, length, &mCache[inStart]) == length;
+		if (success)
+		{
+			mValidStart = inStart;
+		}
+	}
+	if (success &&
+		inEnd > mValidEnd)
+	{
+		uint16_t	length = inEnd - mValidEnd;
+		success = mAT24C->Read(mLineAddr + mValidEnd, length, &mCache[mValidEnd]) == length;
+		if (success)
+		{
+			mValidEnd = inEnd;
+		}
+	}
+	return(success);
+}
@@ -26,6 +26,23 @@
 #include "DataStream.h"
 class AT24C;
 
+/*
+*	The cache holds one line of AT24C_STREAM_CACHE_SIZE bytes, or the page
+*	size if it's smaller.  Lines are aligned to their size, so a line never
+*	spans two pages.  Define a larger size (a power of 2) for chips with
+*	larger pages if there's RAM for it.
+*/
+#ifndef AT24C_STREAM_CACHE_SIZE
+#define AT24C_STREAM_CACHE_SIZE	128
+#endif
+
+/*
+*	Writes are cached and written to the chip when a write or read moves to
+*	another line, when the line is full, on Flush, and on destruction.
+*	Sequential writes of any size then cost one write cycle per line rather
+*	than one per Write call.  Small sequential reads are served from the
+*	cached line.
+*/
 class AT24CDataStream : public DataStreamImpl
 {
 public:
@@ -33,14 +50,33 @@ public:
 								AT24C*					inAT24C,
 								const void*				inStartAddress,
 								uint32_t				inLength);
+	virtual					~AT24CDataStream(void);
 	virtual uint32_t		Read(
 								uint32_t				inLength,
 								void*					outBuffer);
 	virtual uint32_t		Write(
 								uint32_t				inLength,
 								const void*				inBuffer);
+	/*
+	*	Writes the cached data to the chip.  Returns false if the write
+	*	failed.
+	*/
+	bool					Flush(void);
 protected:
 	AT24C*		mAT24C;
+	uint32_t	mLineAddr;		// Of the cached line, kNoLine if none
+	uint16_t	mLineSize;
+	uint16_t	mValidStart;	// The range of the line that holds valid data
+	uint16_t	mValidEnd;
+	uint16_t	mDirtyStart;	// The range of the line not yet written
+	uint16_t	mDirtyEnd;
+	uint8_t		mCache[AT24C_STREAM_CACHE_SIZE];
+
+	bool					LoadLine(
+								uint32_t				inLineAddr);
+	bool					Fill(
+								uint16_t				inStart,
+								uint16_t				inEnd);
 };
 
-#endif // AT24CDataStream_h
\ No newline at end of file
+#endif // AT24CDataStream_h
@@ -0,0 +1,106 @@
+/*
+*	BlockDevice.h, Copyright Jonathan Mackey 2019
+*	Minimal interface to a memory device that can be read, programmed and
+*	(optionally) erased.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef BlockDevice_h
+#define BlockDevice_h
+
+#include <inttypes.h>
+
+/*
+*	All addresses and lengths are in bytes.  A client that programs in
+*	multiples of GetProgramSize(), aligned to GetProgramSize(), gets the best
+*	throughput the device is capable of.
+*/
+class BlockDevice
+{
+public:
+	virtual uint32_t		GetCapacity(void) = 0;
+	/*
+	*	The native program unit, e.g. the page size of a NOR Flash or AT24C
+	*	chip, or the block size of an SD card.
+	*/
+	virtual uint16_t		GetProgramSize(void) = 0;
+	/*
+	*	The smallest erase unit.  0 is returned for devices that don't need to
+	*	be erased before being programmed.
+	*/
+	virtual uint32_t		GetEraseSize(void) = 0;
+	/*
+	*	Returns the largest erase unit that can be erased starting at inAddr
+	*	without erasing beyond inAddr + inLength.  inAddr and inLength must be
+	*	multiples of GetEraseSize().  Devices with more than one erase size
+	*	override this so that a range can be erased with the fewest (and
+	*	fastest) erase operations.
+	*/
+	virtual uint32_t		GetEraseUnit(
+								uint32_t				inAddr,
+								uint32_t				inLength)
+								{return(GetEraseSize());}
+	virtual bool			ProgramRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								const uint8_t*			inData) = 0;
+	virtual bool			ReadRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								uint8_t*				outData) = 0;
+	/*
+	*	inAddr and inLength must be multiples of GetEraseSize().  For devices
+	*	that don't need erasing this does nothing and returns true.
+	*/
+	virtual bool			EraseRange(
+								uint32_t				inAddr,
+								uint32_t				inLength) = 0;
+	/*
+	*	Starts erasing a single erase unit (inLength is a value returned by
+	*	GetEraseUnit) and returns without waiting for the erase to complete.
+	*	IsBusy returns true till it does.  Any following program, read or
+	*	erase waits for it.  Devices that can't erase in the background erase
+	*	the unit before returning.
+	*/
+	virtual bool			StartErase(
+								uint32_t				inAddr,
+								uint32_t				inLength)
+								{return(EraseRange(inAddr, inLength));}
+	/*
+	*	Returns true while the device is busy completing a program or erase.
+	*/
+	virtual bool			IsBusy(void) = 0;
+	/*
+	*	Called before programming a range of data, e.g. a download.  inAddr and
+	*	inLength is the range the data occupies, if known (inLength is 0 when
+	*	it isn't.)  Devices that can program a run of blocks faster than
+	*	individual blocks use this as a hint.
+	*/
+	virtual void			BeginProgramming(
+								uint32_t				inAddr,
+								uint32_t				inLength){}
+	/*
+	*	Completes any programming still in progress.  Returns false if it
+	*	failed.
+	*/
+	virtual bool			EndProgramming(void)
+								{return(true);}
+};
+
+#endif // BlockDevice_h
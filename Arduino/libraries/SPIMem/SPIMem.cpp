@@ -35,14 +35,30 @@ enum
 	eWriteDisableCmd,
 	eReadStat1Cmd,
 	eWriteEnableCmd,
+	eFastReadCmd	= 0x0B,
+	eFastRead4BCmd	= 0x0C,
+	ePageProg4BCmd	= 0x12,
+	eWriteBankCmd	= 0x17,
 	eEraseSectorCmd	= 0x20,
+	eEraseSect4BCmd	= 0x21,
 	eErase32KBlkCmd	= 0x52,
+	eErase32K4BCmd	= 0x5C,
 	eChipEraseCmd	= 0x60,
 	eErase64KBlkCmd	= 0xD8,
+	eErase64K4BCmd	= 0xDC,
 	eReadJEDECIDCmd	= 0x9F,
+	eReadSFDPCmd	= 0x5A,
+	eEnter4ByteCmd	= 0xB7,
 	
 	eChipBusyBit	=	1,
-	eWriteEnabledBit
+	eWriteEnabledBit,
+	
+	// SFDP DWORD 16 bits 31:24, the ways the chip enters 4 byte address mode
+	eEnter4ByteB7		= 0x01,
+	eEnter4ByteWrenB7	= 0x02,
+	eEnter4ByteBankReg	= 0x08,	// Bank register (17h) bit 7
+	eEnter4ByteCmdSet	= 0x20,	// Dedicated 4 byte address instruction set
+	eAlways4Byte		= 0x40
 };
 
 /*********************************** SPIMem ************************************/
@@ -51,6 +67,14 @@ SPIMem::SPIMem(
 	// According to the Winbond doc their chips are rated at 133MHz
 	: mCSPin(inCSPin), mSPISettings(133000000, MSBFIRST, SPI_MODE0)
 {
+	mBusyTimeout = 0;
+	mAddressBytes = 3;
+	LoadDefaultGeometry();
+#ifdef SPIMEM_BUSY_STATS
+	mBusyOp = eProgramOp;
+	mBusyStart = 0;
+	ResetBusyStats();
+#endif
 }
 
 /*********************************** begin ************************************/
@@ -77,6 +101,11 @@ void SPIMem::Unselect(void)
 }
 
 /******************************* LoadJEDECInfo ********************************/
+/*
+*	Loads the JEDEC ID and the chip's geometry and timing.  The geometry and
+*	timing come from the chip's SFDP tables when it has them, otherwise the
+*	capacity is derived from the JEDEC ID and the rest is Winbond's.
+*/
 void SPIMem::LoadJEDECInfo(void)
 {
 	SendCmd(eReadJEDECIDCmd);
@@ -84,6 +113,261 @@ void SPIMem::LoadJEDECInfo(void)
 	mMemoryType = SPI.transfer(0);
 	mCapacity = 1L<<(SPI.transfer(0));
 	Unselect();
+	LoadDefaultGeometry();
+	mHasSFDP = LoadSFDP();
+	/*
+	*	Chips larger than 16MB need 4 byte addresses.  The SFDP read command
+	*	always takes a 3 byte address.
+	*/
+	mAddressBytes = mCapacity > 0x1000000 ? 4 : 3;
+	if (mAddressBytes == 4)
+	{
+		Enter4ByteMode();
+	}
+}
+
+/******************************* Enter4ByteMode *******************************/
+/*
+*	Puts the chip in 4 byte address mode the way its SFDP DWORD 16 says to.
+*	The chip is put in 4 byte address mode rather than using the 4 byte
+*	address commands because not all chips have a 4 byte version of every
+*	erase command.  The 4 byte commands are only used when the chip has no
+*	other way, erase types without a 4 byte version are then dropped.
+*
+*	Without DWORD 16 (or a method this supports) B7h is sent write enabled.
+*	Some chips (e.g. Micron) ignore B7h unless write enabled, the rest ignore
+*	the write enable.
+*/
+void SPIMem::Enter4ByteMode(void)
+{
+	if (mEnter4Byte & eAlways4Byte)
+	{
+		return;
+	}
+	if (mEnter4Byte & eEnter4ByteB7)
+	{
+		SendCmd(eEnter4ByteCmd);
+		Unselect();
+		return;
+	}
+	if (mEnter4Byte & eEnter4ByteBankReg)
+	{
+		SendCmd(eWriteBankCmd);
+		SPI.transfer(0x80);
+		Unselect();
+		return;
+	}
+	if ((mEnter4Byte & (eEnter4ByteWrenB7 | eEnter4ByteCmdSet)) == eEnter4ByteCmdSet)
+	{
+		static const uint8_t	k4ByteEraseCmd[][2] =
+		{
+			{eEraseSectorCmd, eEraseSect4BCmd},
+			{eErase32KBlkCmd, eErase32K4BCmd},
+			{eErase64KBlkCmd, eErase64K4BCmd}
+		};
+		uint8_t	eraseTypes = 0;
+		for (uint8_t i = 0; i < mEraseTypes; i++)
+		{
+			for (uint8_t j = 0; j < 3; j++)
+			{
+				if (mEraseType[i].command != k4ByteEraseCmd[j][0])continue;
+				mEraseType[eraseTypes] = mEraseType[i];
+				mEraseType[eraseTypes].command = k4ByteEraseCmd[j][1];
+				eraseTypes++;
+				break;
+			}
+		}
+		if (eraseTypes)
+		{
+			mEraseTypes = eraseTypes;
+			mReadCmd = eFastRead4BCmd;
+			mProgramCmd = ePageProg4BCmd;
+			return;
+		}
+	}
+	WriteEnable();
+	SendCmd(eEnter4ByteCmd);
+	Unselect();
+	SendCmd(eWriteDisableCmd);
+	Unselect();
+}
+
+/**************************** LoadDefaultGeometry *****************************/
+/*
+*	Winbond W25Qxx page size, erase types and maximum times (the timeouts
+*	include some margin.)
+*/
+void SPIMem::LoadDefaultGeometry(void)
+{
+	static const SEraseType	kDefaultEraseTypes[] =
+	{
+		{0x1000, 1000, eEraseSectorCmd},	// Max time to erase a sector is 400ms
+		{0x8000, 2000, eErase32KBlkCmd},	// Max time to erase a 32K block is 1.6s
+		{0x10000, 2500, eErase64KBlkCmd}	// Max time to erase a 64K block is 2s
+	};
+	memcpy(mEraseType, kDefaultEraseTypes, sizeof(kDefaultEraseTypes));
+	mEraseTypes = sizeof(kDefaultEraseTypes)/sizeof(SEraseType);
+	mPageSize = 256;
+	mProgramTimeout = 100;
+	// From AC Electrical Characteristics:
+	//	Chip Erase Time 08 = 6 seconds
+	//	Chip Erase Time 32 = 15 seconds
+	//	Chip Erase Time 64 = 100 seconds
+	mChipEraseTimeout = 150 * 1000UL;	// Max time to erase a 8MB chip (W25Q64)
+	mHasSFDP = false;
+	mEnter4Byte = 0;
+	mReadCmd = eFastReadCmd;
+	mProgramCmd = ePageProgCmd;
+}
+
+/********************************** ReadSFDP **********************************/
+void SPIMem::ReadSFDP(
+	uint32_t	inAddr,
+	uint16_t	inLength,
+	uint8_t*	outData)
+{
+	SendCmd(eReadSFDPCmd);
+	SPI.transfer(inAddr >> 16);
+	SPI.transfer(inAddr >>  8);
+	SPI.transfer(inAddr);
+	SPI.transfer(0);	// Dummy byte
+	ReadBytes(outData, inLength);
+	Unselect();
+}
+
+/********************************** LoadSFDP **********************************/
+/*
+*	Loads the capacity, page size, erase types and timing from the JEDEC
+*	Basic Flash Parameter Table (JESD216.)  Returns false if the chip doesn't
+*	have one, the defaults are left as is.
+*
+*	The timing DWORDs (10 and 11) were added by JESD216A.  The maximum time of
+*	an operation is its typical time times a multiplier.  When the table is
+*	the original 9 DWORD version the default timeouts are kept.  DWORD 16,
+*	how to enter 4 byte address mode, was added by JESD216B.
+*/
+bool SPIMem::LoadSFDP(void)
+{
+	uint8_t	buffer[64];	// Big enough for the 16 DWORD JESD216B table
+	ReadSFDP(0, 16, buffer);
+	/*
+	*	The SFDP header is followed by the parameter headers, the first is
+	*	always the Basic Flash Parameter Table (ID 0x00, major revision 1.)
+	*/
+	if (buffer[0] != 'S' || buffer[1] != 'F' || buffer[2] != 'D' || buffer[3] != 'P' ||
+		buffer[8] != 0 || buffer[10] != 1 || buffer[11] < 9)
+	{
+		return(false);
+	}
+	uint8_t		dwords = buffer[11] < 16 ? buffer[11] : 16;
+	uint32_t	tableAddr = ((uint32_t)buffer[14] << 16) + ((uint16_t)buffer[13] << 8) + buffer[12];
+	ReadSFDP(tableAddr, dwords * 4, buffer);
+	
+	// DWORDs 8 and 9, erase types 1 to 4 (size as a power of 2, command)
+	mEraseTypes = 0;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		uint8_t	sizeLog2 = buffer[7*4 + i*2];
+		if (sizeLog2 == 0 ||
+			sizeLog2 > 31)
+		{
+			continue;	// Erase type not supported
+		}
+		SEraseType	eraseType;
+		eraseType.size = (uint32_t)1 << sizeLog2;
+		eraseType.command = buffer[7*4 + i*2 + 1];
+		eraseType.timeout = 2500;
+		if (dwords >= 10)
+		{
+			/*
+			*	DWORD 10, typical erase times: a 5 bit count and 2 bit units
+			*	per erase type.
+			*/
+			static const uint16_t	kEraseUnits[] = {1, 16, 128, 1000};	// ms
+			uint32_t	dword10 = DWord(buffer, 10);
+			uint32_t	typical = (((dword10 >> (4 + i*7)) & 0x1F) + 1) *
+										kEraseUnits[(dword10 >> (9 + i*7)) & 3];
+			eraseType.timeout = typical * (((dword10 & 0xF) + 1) * 2);
+		}
+		// Insert sorted by size, smallest first
+		uint8_t	j = mEraseTypes;
+		for (; j > 0 && mEraseType[j-1].size > eraseType.size; j--)
+		{
+			mEraseType[j] = mEraseType[j-1];
+		}
+		mEraseType[j] = eraseType;
+		mEraseTypes++;
+	}
+	if (mEraseTypes == 0)
+	{
+		LoadDefaultGeometry();
+		return(false);
+	}
+	
+	// DWORD 2, density in bits
+	uint32_t	density = DWord(buffer, 2);
+	if (density & 0x80000000)
+	{
+		density &= 0x7FFFFFFF;
+		if (density >= 3 &&
+			density < 35)
+		{
+			mCapacity = (uint32_t)1 << (density - 3);
+		}
+	} else
+	{
+		mCapacity = (density >> 3) + 1;
+	}
+	
+	if (dwords >= 11)
+	{
+		/*
+		*	DWORD 11, page size, typical page program time (5 bit count, 8 or
+		*	64us units) and typical chip erase time (5 bit count, 2 bit units.)
+		*/
+		static const uint32_t	kChipEraseUnits[] = {16, 256, 4000, 64000};	// ms
+		uint32_t	dword11 = DWord(buffer, 11);
+		uint32_t	multiplier = ((dword11 & 0xF) + 1) * 2;
+		mPageSize = 1 << ((dword11 >> 4) & 0xF);
+		uint32_t	programTime = (((dword11 >> 8) & 0x1F) + 1) * ((dword11 & 0x2000) ? 64 : 8);	// us
+		mProgramTimeout = (programTime * multiplier)/1000 + 2;	// ms, +2 for millis() granularity
+		mChipEraseTimeout = (((dword11 >> 24) & 0x1F) + 1) *
+								kChipEraseUnits[(dword11 >> 29) & 3] * multiplier;
+	}
+	if (dwords >= 16)
+	{
+		mEnter4Byte = DWord(buffer, 16) >> 24;
+	}
+	return(true);
+}
+
+/*********************************** DWord ************************************/
+/*
+*	Returns the 1 based DWORD inIndex of an SFDP table (little endian.)
+*/
+uint32_t SPIMem::DWord(
+	const uint8_t*	inTable,
+	uint8_t			inIndex)
+{
+	const uint8_t*	dword = &inTable[(inIndex - 1) * 4];
+	return(((uint32_t)dword[3] << 24) + ((uint32_t)dword[2] << 16) +
+				((uint16_t)dword[1] << 8) + dword[0]);
+}
+
+/******************************** SendAddress *********************************/
+/*
+*	Sends the 3 or 4 byte address of the command just sent.
+*/
+void SPIMem::SendAddress(
+	uint32_t	inAddr)
+{
+	if (mAddressBytes == 4)
+	{
+		SPI.transfer(inAddr >> 24);
+	}
+	SPI.transfer(inAddr >> 16);
+	SPI.transfer(inAddr >>  8);
+	SPI.transfer(inAddr);
 }
 
 /********************************** SendCmd ***********************************/
@@ -94,56 +378,188 @@ void SPIMem::SendCmd(
 	SPI.transfer(inCmd);
 }
 
+/********************************** IsBusy ************************************/
+bool SPIMem::IsBusy(void)
+{
+	SendCmd(eReadStat1Cmd);
+	bool	busy = (SPI.transfer(0) & eChipBusyBit) != 0;
+	Unselect();
+#ifdef SPIMEM_BUSY_STATS
+	if (mBusyTimeout)
+	{
+		mBusyStats[mBusyOp].statusReads++;
+	}
+#endif
+	if (!busy)
+	{
+		EndBusy();
+	}
+	return(busy);
+}
+
 /******************************* WaitTillReady ********************************/
+/*
+*	When inTimeout is 0 the timeout is that of the program or erase last
+*	started (mBusyTimeout), or 100ms if none is in progress.
+*
+*	The status register is read continuously within a single read status
+*	command, the chip outputs the current status with every byte clocked out.
+*	Compared to a command per read this saves the command byte and the CS and
+*	transaction overhead, so the end of the operation is seen sooner.  The
+*	timeout is checked every 16 reads rather than every read.
+*/
 bool SPIMem::WaitTillReady(
 	uint32_t	inTimeout)
 {
-	uint8_t  status;
-	uint32_t timeout = millis() + inTimeout;
+	if (inTimeout == 0)
+	{
+		inTimeout = mBusyTimeout ? mBusyTimeout : 100;
+	}
+#ifdef SPIMEM_BUSY_STATS
+	uint32_t	waitStart = micros();
+	uint32_t	statusReads = 0;
+#endif
+	uint32_t	start = millis();
+	bool		busy;
 
-	do {
-		SendCmd(eReadStat1Cmd);
-		status = SPI.transfer(0);
-		Unselect();
-		if (millis() < timeout)
+	SendCmd(eReadStat1Cmd);
+	do
+	{
+		for (uint8_t i = 16; i; i--)
 		{
-			continue;
+		#ifdef SPIMEM_BUSY_STATS
+			statusReads++;
+		#endif
+			busy = (SPI.transfer(0) & eChipBusyBit) != 0;
+			if (busy)continue;
+			break;
 		}
-		return(false);
-	} while(status & eChipBusyBit);
+	} while (busy && millis() - start < inTimeout);
+	Unselect();
+#ifdef SPIMEM_BUSY_STATS
+	if (mBusyTimeout)
+	{
+		SBusyStats&	stats = mBusyStats[mBusyOp];
+		stats.waitTime += micros() - waitStart;
+		stats.statusReads += statusReads;
+	}
+#endif
+	if (!busy)
+	{
+		EndBusy();
+	}
+	return(!busy);
+}
 
-	return(true);
+/********************************* StartBusy **********************************/
+/*
+*	Called when a program or erase command has been sent.  The chip is busy
+*	till it completes, at most inTimeout ms.
+*/
+void SPIMem::StartBusy(
+	uint8_t		inOp,
+	uint32_t	inTimeout)
+{
+	mBusyTimeout = inTimeout;
+#ifdef SPIMEM_BUSY_STATS
+	mBusyOp = inOp;
+	mBusyStart = micros();
+#endif
+}
+
+/********************************** EndBusy ***********************************/
+void SPIMem::EndBusy(void)
+{
+#ifdef SPIMEM_BUSY_STATS
+	if (mBusyTimeout)
+	{
+		uint32_t	busyTime = micros() - mBusyStart;
+		SBusyStats&	stats = mBusyStats[mBusyOp];
+		stats.count++;
+		stats.busyTime += busyTime;
+		if (busyTime > stats.maxBusyTime)
+		{
+			stats.maxBusyTime = busyTime;
+		}
+	}
+#endif
+	mBusyTimeout = 0;
 }
 
+#ifdef SPIMEM_BUSY_STATS
+/******************************* ResetBusyStats *******************************/
+void SPIMem::ResetBusyStats(void)
+{
+	memset(mBusyStats, 0, sizeof(mBusyStats));
+}
+#endif
+
 /********************************* WritePage **********************************/
+/*
+*	Writes the entire page containing inAddr.
+*/
 bool SPIMem::WritePage(
 	uint32_t		inAddr,
 	const uint8_t*	inData)
 {
-	bool	success = inAddr < mCapacity && WaitTillReady() && WriteEnable();
-	
-	if (success)
+	return(Write(inAddr & ~(uint32_t)(mPageSize - 1), mPageSize, inData));
+}
+
+/*********************************** Write ************************************/
+/*
+*	Writes any number of bytes starting at any address.  The data is split at
+*	page boundaries, a page program command can't cross one (the address wraps
+*	to the start of the page.)  Partial pages are programmed as is, the bytes
+*	of the page outside of the data aren't changed.
+*
+*	The chip clears the write enable latch when each page program completes so
+*	there's no need to disable writes.  Each page waits for the previous one to
+*	complete.  The last page is waited on before returning.
+*/
+bool SPIMem::Write(
+	uint32_t		inAddr,
+	uint32_t		inLength,
+	const uint8_t*	inData)
+{
+	bool		success = inAddr + inLength <= mCapacity;
+	uint32_t	endAddr = inAddr + inLength;
+	while (success && inAddr < endAddr)
 	{
-		SendCmd(ePageProgCmd);
-		SPI.transfer(inAddr >> 16);
-		SPI.transfer(inAddr >>  8);
-		/*
-		*	If an entire 256 byte page is to be programmed, the last address
-		*	byte (the 8 least significant address bits) should be set to 0.
-		*/
-		SPI.transfer(0);
-		for (int i=0; i<256; i++)
+		uint32_t	length = mPageSize - (inAddr & (mPageSize - 1));	// Bytes left in the page
+		if (length > endAddr - inAddr)
 		{
-			SPI.transfer(inData[i]);
+			length = endAddr - inAddr;
+		}
+		success = WaitTillReady() && WriteEnable();
+		if (success)
+		{
+			SendCmd(mProgramCmd);
+			SendAddress(inAddr);
+			WriteBytes(inData, length);
+			Unselect();
+			StartBusy(eProgramOp, mProgramTimeout);
+			inAddr += length;
+			inData += length;
 		}
-		Unselect();
-		success = WaitTillReady();
-		WriteDisable();
 	}
-	return(success);
+	return(success && WaitTillReady());
+}
+
+/******************************** ProgramRange ********************************/
+bool SPIMem::ProgramRange(
+	uint32_t		inAddr,
+	uint32_t		inLength,
+	const uint8_t*	inData)
+{
+	return(Write(inAddr, inLength, inData));
 }
 
 /*********************************** Read *************************************/
+/*
+*	Uses Fast Read.  Read Data (03h) is limited to 50MHz on most chips, Fast
+*	Read runs at the chip's full clock rate at the cost of a dummy byte after
+*	the address.
+*/
 bool SPIMem::Read(
 	uint32_t	inAddr,
 	uint32_t	inDataLen,
@@ -152,19 +568,84 @@ bool SPIMem::Read(
 	bool	success = inAddr+inDataLen <= mCapacity && WaitTillReady();
 	if (success)
 	{
-		SendCmd(eReadDataCmd);
-		SPI.transfer(inAddr >> 16);
-		SPI.transfer(inAddr >>  8);
-		SPI.transfer(inAddr);
-		for (uint32_t i = 0; i < inDataLen; i++)
-		{
-			outData[i] = SPI.transfer(0);
-		}
+		SendCmd(mReadCmd);
+		SendAddress(inAddr);
+		SPI.transfer(0);	// Dummy byte
+		ReadBytes(outData, inDataLen);
 		Unselect();
 	}
 	return(success);
 }
 
+/********************************* ReadBytes **********************************/
+/*
+*	Reads inLength bytes from the selected chip.
+*
+*	Calling SPI.transfer for each byte wastes a good part of each byte time in
+*	call overhead.  On AVR the SPI data register is read and the next transfer
+*	started as soon as a byte completes, then the byte is stored while the next
+*	one is being shifted in.  Other cores are passed the entire buffer, which
+*	lets cores that support it use a FIFO or DMA.
+*/
+void SPIMem::ReadBytes(
+	uint8_t*	outData,
+	uint32_t	inLength)
+{
+#ifdef __AVR__
+	if (inLength)
+	{
+		SPDR = 0;
+		while (--inLength)
+		{
+			while (!(SPSR & _BV(SPIF)));
+			uint8_t	thisByte = SPDR;
+			SPDR = 0;
+			*(outData++) = thisByte;
+		}
+		while (!(SPSR & _BV(SPIF)));
+		*outData = SPDR;
+	}
+#else
+	SPI.transfer(outData, inLength);
+#endif
+}
+
+/********************************* WriteBytes *********************************/
+/*
+*	Writes inLength bytes to the selected chip.  Same as ReadBytes, the next
+*	byte is loaded while the current byte is being shifted out.  The buffer
+*	version of SPI.transfer overwrites the buffer with the data received so on
+*	other cores the data is copied to a small buffer first.
+*/
+void SPIMem::WriteBytes(
+	const uint8_t*	inData,
+	uint16_t		inLength)
+{
+#ifdef __AVR__
+	if (inLength)
+	{
+		SPDR = *(inData++);
+		while (--inLength)
+		{
+			uint8_t	thisByte = *(inData++);
+			while (!(SPSR & _BV(SPIF)));
+			SPDR = thisByte;
+		}
+		while (!(SPSR & _BV(SPIF)));
+	}
+#else
+	uint8_t	buffer[32];
+	while (inLength)
+	{
+		uint16_t	length = inLength < sizeof(buffer) ? inLength : sizeof(buffer);
+		memcpy(buffer, inData, length);
+		SPI.transfer(buffer, length);
+		inData += length;
+		inLength -= length;
+	}
+#endif
+}
+
 /******************************** WriteEnable *********************************/
 bool SPIMem::WriteEnable(void)
 {
@@ -176,68 +657,100 @@ bool SPIMem::WriteEnable(void)
 	return((status & eWriteEnabledBit) != 0);
 }
 
-/******************************** WriteDisable ********************************/
-void SPIMem::WriteDisable(void)
-{
-	SendCmd(eWriteDisableCmd);
-	Unselect();
-}
-
-/********************************* EraseSector ********************************/
-bool SPIMem::EraseSector(
-	uint32_t	inAddr)
+/******************************** StartCommand ********************************/
+/*
+*	Starts an erase command and returns without waiting for it to complete.
+*	The next command waits for it (see WaitTillReady.)  The write enable latch
+*	is cleared by the chip when the erase completes.
+*/
+bool SPIMem::StartCommand(
+	uint8_t		inCmd,
+	uint32_t	inAddr,
+	uint32_t	inTimeout)
 {
-
 	bool success = WaitTillReady() && WriteEnable();
 	if (success)
 	{
-		SendCmd(eEraseSectorCmd);
-		SPI.transfer(inAddr >> 16);
-		SPI.transfer(inAddr >>  8);
-		SPI.transfer(inAddr);
+		SendCmd(inCmd);
+		SendAddress(inAddr);
 		Unselect();
-		success = WaitTillReady(1000);	// Max time to erase a sector is 400ms
-		WriteDisable();
+		uint8_t	op = eEraseOp;
+		for (uint8_t i = 0; i < mEraseTypes; i++)
+		{
+			if (mEraseType[i].command != inCmd)continue;
+			op = eEraseOp + i;
+			break;
+		}
+		StartBusy(op, inTimeout);
 	}
 	return success;
 }
 
-/******************************** Erase32KBlock ********************************/
-bool SPIMem::Erase32KBlock(
-	uint32_t	inAddr)
+/*********************************** Erase ************************************/
+bool SPIMem::Erase(
+	uint8_t		inCmd,
+	uint32_t	inAddr,
+	uint32_t	inTimeout)
 {
+	return(StartCommand(inCmd, inAddr, inTimeout) && WaitTillReady());
+}
 
-	bool success = WaitTillReady() && WriteEnable();
-	if (success)
+/********************************* StartErase *********************************/
+/*
+*	Starts erasing the erase unit at inAddr.  inLength must be one of the
+*	chip's erase sizes and inAddr must be aligned to it.  Returns without
+*	waiting for the erase to complete, use IsBusy to poll it.
+*/
+bool SPIMem::StartErase(
+	uint32_t	inAddr,
+	uint32_t	inLength)
+{
+	const SEraseType*	eraseType = GetEraseType(inLength);
+	return(eraseType &&
+			(inAddr & (inLength - 1)) == 0 &&
+			StartCommand(eraseType->command, inAddr, eraseType->timeout));
+}
+
+/******************************** GetEraseType ********************************/
+/*
+*	Returns the erase type of inSize, or NULL if the chip doesn't have one.
+*/
+const SPIMem::SEraseType* SPIMem::GetEraseType(
+	uint32_t	inSize) const
+{
+	for (uint8_t i = 0; i < mEraseTypes; i++)
 	{
-		SendCmd(eErase32KBlkCmd);
-		SPI.transfer(inAddr >> 16);
-		SPI.transfer(inAddr >>  8);
-		SPI.transfer(inAddr);
-		Unselect();
-		success = WaitTillReady(2000);	// Max time to erase a 32K block is 1.6s
-		WriteDisable();
+		if (mEraseType[i].size != inSize)continue;
+		return(&mEraseType[i]);
 	}
-	return success;
+	return(NULL);
+}
+
+/********************************* EraseSector ********************************/
+bool SPIMem::EraseSector(
+	uint32_t	inAddr)
+{
+	const SEraseType*	eraseType = GetEraseType(0x1000);
+	return(Erase(eraseType ? eraseType->command : eEraseSectorCmd, inAddr,
+				eraseType ? eraseType->timeout : 1000));
+}
+
+/******************************** Erase32KBlock ********************************/
+bool SPIMem::Erase32KBlock(
+	uint32_t	inAddr)
+{
+	const SEraseType*	eraseType = GetEraseType(0x8000);
+	return(Erase(eraseType ? eraseType->command : eErase32KBlkCmd, inAddr,
+				eraseType ? eraseType->timeout : 2000));
 }
 
 /******************************* Erase64KBlock ********************************/
 bool SPIMem::Erase64KBlock(
 	uint32_t	inAddr)
 {
-
-	bool success = WaitTillReady() && WriteEnable();
-	if (success)
-	{
-		SendCmd(eErase64KBlkCmd);
-		SPI.transfer(inAddr >> 16);
-		SPI.transfer(inAddr >>  8);
-		SPI.transfer(inAddr);
-		Unselect();
-		success = WaitTillReady(2500);	// Max time to erase a 64K block is 2s
-		WriteDisable();
-	}
-	return success;
+	const SEraseType*	eraseType = GetEraseType(0x10000);
+	return(Erase(eraseType ? eraseType->command : eErase64KBlkCmd, inAddr,
+				eraseType ? eraseType->timeout : 2500));
 }
 
 /********************************* ChipErase **********************************/
@@ -248,12 +761,50 @@ bool SPIMem::ChipErase(void)
 	{
 		SendCmd(eChipEraseCmd);
 		Unselect();
-		// From AC Electrical Characteristics:
-		//	Chip Erase Time 08 = 6 seconds
-		//	Chip Erase Time 32 = 15 seconds
-		//	Chip Erase Time 64 = 100 seconds
-		success = WaitTillReady(150 * 1000UL);	// Max time to erase a 8MB chip (W25Q64)
-		WriteDisable();
+		StartBusy(eChipEraseOp, mChipEraseTimeout);
+		success = WaitTillReady();
 	}
 	return success;
 }
+
+/******************************** GetEraseUnit ********************************/
+/*
+*	The erase units are nested and naturally aligned so picking the largest
+*	unit that fits at each step results in the fewest erase operations.
+*	Fewer is also faster: a 64KB block erases in a fraction of the time it
+*	takes to erase its 16 sectors.
+*/
+uint32_t SPIMem::GetEraseUnit(
+	uint32_t	inAddr,
+	uint32_t	inLength)
+{
+	for (uint8_t i = mEraseTypes - 1; i > 0; i--)
+	{
+		uint32_t	size = mEraseType[i].size;
+		if ((inAddr & (size - 1)) == 0 && inLength >= size)
+		{
+			return(size);
+		}
+	}
+	return(mEraseType[0].size);
+}
+
+/********************************* EraseRange *********************************/
+/*
+*	Erases the range using the largest erase commands the alignment allows.
+*	inAddr and inLength must be multiples of the smallest erase size.
+*/
+bool SPIMem::EraseRange(
+	uint32_t	inAddr,
+	uint32_t	inLength)
+{
+	bool		success = ((inAddr | inLength) & (GetEraseSize() - 1)) == 0;
+	uint32_t	endAddr = inAddr + inLength;
+	while (success && inAddr < endAddr)
+	{
+		const SEraseType*	eraseType = GetEraseType(GetEraseUnit(inAddr, endAddr - inAddr));
+		success = Erase(eraseType->command, inAddr, eraseType->timeout);
+		inAddr += eraseType->size;
+	}
+	return(success);
+}
@@ -28,8 +28,17 @@
 #ifndef SPIMem_H
 #define SPIMem_H
 #include <SPI.h>
+#include "BlockDevice.h"
 
-class SPIMem
+/*
+*	When defined, the time the chip spends busy with each type of operation
+*	is counted (see GetBusyStats.)  It's off by default to save the RAM and
+*	the micros() calls.  Uncomment, or define it for the whole build (e.g.
+*	-DSPIMEM_BUSY_STATS for the simulator), to turn it on.
+*/
+//#define SPIMEM_BUSY_STATS	1
+
+class SPIMem : public BlockDevice
 {
 public:
 							SPIMem(
@@ -46,32 +55,149 @@ public:
 								{return(mManufacturerID);}
 	uint8_t					GetMemoryType(void)
 								{return(mMemoryType);}
-	uint32_t				GetCapacity(void)
+	virtual uint32_t		GetCapacity(void)
 								{return(mCapacity);}
+	bool					HasSFDP(void) const
+								{return(mHasSFDP);}
+	virtual uint16_t		GetProgramSize(void)
+								{return(mPageSize);}
+	virtual uint32_t		GetEraseSize(void)
+								{return(mEraseType[0].size);}	// Usually a 4KB sector
+	virtual uint32_t		GetEraseUnit(
+								uint32_t				inAddr,
+								uint32_t				inLength);
 	bool					WritePage(
 								uint32_t				inAddr,
 								const uint8_t*			inData);
+	bool					Write(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								const uint8_t*			inData);
 	bool					Read(
 								uint32_t				inAddr,
 								uint32_t				inDataLen,
 								uint8_t*				outData);
 	void					LoadJEDECInfo(void);
+	// BlockDevice
+	virtual bool			ProgramRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								const uint8_t*			inData);
+	virtual bool			ReadRange(
+								uint32_t				inAddr,
+								uint32_t				inLength,
+								uint8_t*				outData)
+								{return(Read(inAddr, inLength, outData));}
+	virtual bool			EraseRange(
+								uint32_t				inAddr,
+								uint32_t				inLength);
+	virtual bool			IsBusy(void);
+	virtual bool			StartErase(
+								uint32_t				inAddr,
+								uint32_t				inLength);
+	enum EBusyOp
+	{
+		eProgramOp,
+		eChipEraseOp,
+		eEraseOp,	// + the index of the erase type, see GetEraseTypeSize
+		eNumBusyOps	= eEraseOp + 4
+	};
+#ifdef SPIMEM_BUSY_STATS
+	/*
+	*	Busy times are in microseconds, from the end of the command till the
+	*	chip is seen to be ready.  waitTime is the part of busyTime spent
+	*	blocked in WaitTillReady, the rest overlapped other work.
+	*/
+	struct SBusyStats
+	{
+		uint32_t	count;
+		uint32_t	busyTime;
+		uint32_t	maxBusyTime;
+		uint32_t	waitTime;
+		uint32_t	statusReads;
+	};
+	const SBusyStats&		GetBusyStats(
+								uint8_t					inOp) const
+								{return(mBusyStats[inOp]);}
+	uint32_t				GetEraseTypeSize(
+								uint8_t					inIndex) const
+								{return(inIndex < mEraseTypes ? mEraseType[inIndex].size : 0);}
+	void					ResetBusyStats(void);
+#endif
 
 protected:
+	struct SEraseType
+	{
+		uint32_t	size;
+		uint32_t	timeout;	// ms
+		uint8_t		command;
+	};
 	uint8_t		mCSPin;
 	uint8_t		mManufacturerID;
 	uint8_t		mMemoryType;
 	uint32_t	mCapacity;
 	SPISettings	mSPISettings;
+	/*
+	*	The geometry and timing, from the chip's SFDP tables when it has them.
+	*	The erase types are sorted by size, smallest first.
+	*/
+	SEraseType	mEraseType[4];
+	uint8_t		mEraseTypes;
+	bool		mHasSFDP;
+	uint16_t	mPageSize;
+	uint32_t	mProgramTimeout;	// ms
+	uint32_t	mChipEraseTimeout;	// ms
+	uint32_t	mBusyTimeout;		// ms, of the program or erase in progress
+	uint8_t		mAddressBytes;		// 3, or 4 for chips larger than 16MB
+	uint8_t		mEnter4Byte;		// SFDP DWORD 16 bits 31:24, 0 if unknown
+	uint8_t		mReadCmd;			// Fast Read or its 4 byte address version
+	uint8_t		mProgramCmd;		// Page Program or its 4 byte address version
+#ifdef SPIMEM_BUSY_STATS
+	SBusyStats	mBusyStats[eNumBusyOps];
+	uint32_t	mBusyStart;			// micros() when the operation started
+	uint8_t		mBusyOp;
+#endif
+	
+	void					LoadDefaultGeometry(void);
+	bool					LoadSFDP(void);
+	void					Enter4ByteMode(void);
+	void					ReadSFDP(
+								uint32_t				inAddr,
+								uint16_t				inLength,
+								uint8_t*				outData);
+	static uint32_t			DWord(
+								const uint8_t*			inTable,
+								uint8_t					inIndex);
+	bool					StartCommand(
+								uint8_t					inCmd,
+								uint32_t				inAddr,
+								uint32_t				inTimeout);
+	bool					Erase(
+								uint8_t					inCmd,
+								uint32_t				inAddr,
+								uint32_t				inTimeout);
+	const SEraseType*		GetEraseType(
+								uint32_t				inSize) const;
 	
 	void					SendCmd(
 								uint8_t					inCmd);
+	void					SendAddress(
+								uint32_t				inAddr);
 	void					Select(void);
 	void					Unselect(void);
+	void					ReadBytes(
+								uint8_t*				outData,
+								uint32_t				inLength);
+	void					WriteBytes(
+								const uint8_t*			inData,
+								uint16_t				inLength);
 	bool					WaitTillReady(
-								uint32_t				inTimeout = 100);
+								uint32_t				inTimeout = 0);
+	void					StartBusy(
+								uint8_t					inOp,
+								uint32_t				inTimeout);
+	void					EndBusy(void);
 	bool					WriteEnable(void);
-	void					WriteDisable(void);
 };
 
 #endif
\ No newline at end of file
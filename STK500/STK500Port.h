@@ -0,0 +1,55 @@
+/*
+*	STK500Port.h, Copyright Jonathan Mackey 2019
+*	The serial connection to an STK500 version 1 programmer (e.g. an Arduino
+*	running ArduinoISP.)  STK500Session only talks to the programmer through
+*	this interface so that it doesn't depend on the OS.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef STK500Port_h
+#define STK500Port_h
+
+#include <inttypes.h>
+
+class STK500Port
+{
+public:
+	virtual					~STK500Port(void){}
+	/*
+	*	Returns false if all of the data couldn't be written.
+	*/
+	virtual bool			Write(
+								const uint8_t*			inData,
+								uint32_t				inLength) = 0;
+	/*
+	*	Waits up to inTimeout milliseconds for data to arrive, then returns
+	*	whatever has arrived, up to inLength bytes.  Returns the number of
+	*	bytes read, 0 on timeout, or -1 on error.
+	*/
+	virtual int32_t			Read(
+								uint8_t*				outData,
+								uint32_t				inLength,
+								uint32_t				inTimeout) = 0;
+	/*
+	*	Discards any data received but not yet read.
+	*/
+	virtual void			Flush(void) = 0;
+};
+
+#endif // STK500Port_h
@@ -0,0 +1,587 @@
+/*
+*	STK500Session.cpp, Copyright Jonathan Mackey 2019
+*	Portable STK500 version 1 protocol engine, as implemented by ArduinoISP.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "STK500Session.h"
+#include "STK500v2Session.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+/*
+*	The ArduinoISP doesn't implement STK_CHIP_ERASE.  Like avrdude, the chip
+*	erase is sent as the raw ISP Chip Erase instruction via STK_UNIVERSAL.
+*/
+static const uint8_t kChipEraseInstruction[] = {0xAC, 0x80, 0x00, 0x00};
+
+/******************************* STK500Session ********************************/
+STK500Session::STK500Session(
+	STK500Port&	inPort)
+	: mPort(inPort), mTimeout(2000), mCommandIndex(0), mSendIndex(0),
+	  mBytesReceived(0), mSignature(0), mCalibrationByte(0),
+	  mExpectedResponse(0)
+{
+}
+
+/************************************ Sync ************************************/
+bool STK500Session::Sync(
+	uint32_t	inAttempts)
+{
+	static const uint8_t	kGetSync[] = {STK_GET_SYNC, CRC_EOP};
+	for (uint32_t attempt = 0; attempt < inAttempts; attempt++)
+	{
+		uint8_t		response[2];
+		uint32_t	bytesReceived = 0;
+		mPort.Flush();
+		mPort.Write(kGetSync, sizeof(kGetSync));
+		while (bytesReceived < 2)
+		{
+			int32_t	bytesRead = mPort.Read(&response[bytesReceived], 2 - bytesReceived, 100);
+			if (bytesRead <= 0)
+			{
+				break;
+			}
+			bytesReceived += bytesRead;
+		}
+		if (bytesReceived == 2 &&
+			response[0] == STK_INSYNC &&
+			response[1] == STK_OK)
+		{
+			return(true);
+		}
+	}
+	SetError("Unable to sync with the ISP");
+	return(false);
+}
+
+/********************************** Connect ***********************************/
+STK500Session* STK500Session::Connect(
+	STK500Port&		inPort,
+	std::string&	outError,
+	uint32_t		inAttempts)
+{
+	STK500Session*		v1Session = new STK500Session(inPort);
+	STK500v2Session*	v2Session = new STK500v2Session(inPort);
+	STK500Session*		session = NULL;
+	for (uint32_t attempt = 0; attempt < inAttempts && !session; attempt++)
+	{
+		if (v1Session->Sync(1))
+		{
+			session = v1Session;
+			v1Session = NULL;
+		} else if (v2Session->Sync(1))
+		{
+			session = v2Session;
+			v2Session = NULL;
+		}
+	}
+	if (!session)
+	{
+		outError = "Unable to sync with the ISP";
+	}
+	delete v1Session;
+	delete v2Session;
+	return(session);
+}
+
+/******************************* AppendCommand ********************************/
+SSTK500Command& STK500Session::AppendCommand(
+	uint8_t	inCommand)
+{
+	SSTK500Command	command = {inCommand, 0, 0, 0, std::vector<uint8_t>(), NULL, NULL};
+	mCommands.push_back(command);
+	return(mCommands.back());
+}
+
+/********************************* SetDevice **********************************/
+void STK500Session::SetDevice(
+	const SSDK500ParamBlk&	inDeviceParamBlk)
+{
+	const uint8_t*	paramBlk = (const uint8_t*)&inDeviceParamBlk;
+	AppendCommand(STK_SET_DEVICE).data.assign(paramBlk, &paramBlk[sizeof(SSDK500ParamBlk)]);
+}
+
+/******************************* EnterProgMode ********************************/
+void STK500Session::EnterProgMode(void)
+{
+	AppendCommand(STK_ENTER_PROGMODE);
+}
+
+/******************************* LeaveProgMode ********************************/
+void STK500Session::LeaveProgMode(void)
+{
+	AppendCommand(STK_LEAVE_PROGMODE);
+}
+
+/******************************* ReadSignature ********************************/
+void STK500Session::ReadSignature(void)
+{
+	AppendCommand(STK_READ_SIGN).length = 3;
+}
+
+/****************************** ReadCalibration *******************************/
+void STK500Session::ReadCalibration(void)
+{
+	AppendCommand(STK_READ_OSCCAL).length = 1;
+}
+
+/********************************* ChipErase **********************************/
+/*
+*	Erases the flash (and the eeprom unless the EESAVE fuse is programmed.)
+*	The ISP doesn't wait for the erase to complete, so prog mode is left and
+*	entered again as avrdude does.  Entering prog mode takes longer than the
+*	erase.
+*/
+void STK500Session::ChipErase(void)
+{
+	SSTK500Command&	command = AppendCommand(STK_UNIVERSAL);
+	command.data.assign(kChipEraseInstruction, &kChipEraseInstruction[sizeof(kChipEraseInstruction)]);
+	command.length = 1;
+	AppendCommand(STK_LEAVE_PROGMODE);
+	AppendCommand(STK_ENTER_PROGMODE);
+}
+
+/******************************* AppendProgPage *******************************/
+void STK500Session::AppendProgPage(
+	const uint8_t*	inData,
+	uint32_t		inLength,
+	uint32_t		inAddress,
+	uint8_t			inMemType)
+{
+	AppendCommand(STK_LOAD_ADDRESS).address = inAddress;
+	SSTK500Command&	command = AppendCommand(STK_PROG_PAGE);
+	command.address = inAddress;
+	command.memType = inMemType;
+	command.data.assign(inData, &inData[inLength]);
+}
+
+/******************************* AppendReadPage *******************************/
+/*
+*	Appends a STK_LOAD_ADDRESS and STK_READ_PAGE for each block of the region.
+*	When inExpectedData is set the region is being verified, each block is
+*	compared with its part of inExpectedData and nothing is kept.
+*/
+void STK500Session::AppendReadPage(
+	std::vector<uint8_t>*	outData,
+	uint32_t				inAddress,
+	uint8_t					inMemType,
+	uint32_t				inLength,
+	const uint8_t*			inExpectedData)
+{
+	for (uint32_t dataIndex = 0; dataIndex < inLength; dataIndex += kMaxBlockSize)
+	{
+		uint32_t	bytesRequested = inLength - dataIndex;
+		if (bytesRequested > kMaxBlockSize)
+		{
+			bytesRequested = kMaxBlockSize;
+		}
+		AppendCommand(STK_LOAD_ADDRESS).address = inAddress + dataIndex;
+		SSTK500Command&	command = AppendCommand(STK_READ_PAGE);
+		command.address = inAddress + dataIndex;
+		command.memType = inMemType;
+		command.length = bytesRequested;
+		if (inExpectedData)
+		{
+			command.expectedData = &inExpectedData[dataIndex];
+		} else
+		{
+			command.dataRead = outData;
+		}
+	}
+}
+
+/********************************** ProgPage **********************************/
+void STK500Session::ProgPage(
+	const uint8_t*	inData,
+	uint32_t		inLength,
+	uint32_t		inAddress,
+	uint8_t			inMemType,
+	bool			inVerify,
+	uint32_t		inBlockSize)
+{
+	for (uint32_t dataIndex = 0; dataIndex < inLength; dataIndex += inBlockSize)
+	{
+		uint32_t	bytesToSend = inLength - dataIndex;
+		if (bytesToSend > inBlockSize)
+		{
+			bytesToSend = inBlockSize;
+		}
+		AppendProgPage(&inData[dataIndex], bytesToSend, inAddress + dataIndex, inMemType);
+	}
+	if (inVerify && inLength)
+	{
+		AppendReadPage(NULL, inAddress, inMemType, inLength, inData);
+	}
+}
+
+/********************************** ReadPage **********************************/
+void STK500Session::ReadPage(
+	std::vector<uint8_t>&	outData,
+	uint32_t				inAddress,
+	uint8_t					inMemType,
+	uint32_t				inLength)
+{
+	outData.clear();
+	outData.reserve(inLength);
+	if (inLength)
+	{
+		AppendReadPage(&outData, inAddress, inMemType, inLength, NULL);
+	}
+}
+
+/******************************** IsBlankPage *********************************/
+static bool IsBlankPage(
+	const uint8_t*	inPage,
+	uint32_t		inLength)
+{
+	for (uint32_t i = 0; i < inLength; i++)
+	{
+		if (inPage[i] != 0xFF)
+		{
+			return(false);
+		}
+	}
+	return(true);
+}
+
+/********************************* ProgFlash **********************************/
+void STK500Session::ProgFlash(
+	const uint8_t*	inImage,
+	uint32_t		inLength,
+	uint32_t		inAddress,
+	uint32_t		inPageSize,
+	bool			inVerify)
+{
+	for (uint32_t dataIndex = 0; dataIndex < inLength; dataIndex += inPageSize)
+	{
+		uint32_t	bytesToSend = inLength - dataIndex;
+		if (bytesToSend > inPageSize)
+		{
+			bytesToSend = inPageSize;
+		}
+		if (!IsBlankPage(&inImage[dataIndex], bytesToSend))
+		{
+			AppendProgPage(&inImage[dataIndex], bytesToSend, inAddress + dataIndex, 'F');
+		}
+	}
+	if (inVerify && inLength)
+	{
+		AppendReadPage(NULL, inAddress, 'F', inLength, inImage);
+	}
+}
+
+/******************************* CommandLength ********************************/
+/*
+*	Returns the number of bytes sent for inCommand.
+*/
+uint32_t STK500Session::CommandLength(
+	const SSTK500Command&	inCommand)
+{
+	uint32_t	length = 2 + (uint32_t)inCommand.data.size();	// command, data, Sync_CRC_EOP
+	switch(inCommand.command)
+	{
+		case STK_LOAD_ADDRESS:
+			length += 2;
+			break;
+		case STK_PROG_PAGE:
+		case STK_READ_PAGE:
+			length += 3;
+			break;
+	}
+	return(length);
+}
+
+/******************************* EncodeCommand ********************************/
+/*
+*	Appends inCommand and its parameters to ioData.
+*/
+void STK500Session::EncodeCommand(
+	const SSTK500Command&	inCommand,
+	std::vector<uint8_t>&	ioData)
+{
+	ioData.push_back(inCommand.command);
+	switch(inCommand.command)
+	{
+		case STK_LOAD_ADDRESS: // + addr_low, addr_high, Sync_CRC_EOP (word address)
+			ioData.push_back((inCommand.address/2) & 0xFF);
+			ioData.push_back((inCommand.address/2) >> 8);
+			break;
+		case STK_PROG_PAGE: // + bytes_high, bytes_low, memtype, data, Sync_CRC_EOP
+		case STK_READ_PAGE: // + bytes_high, bytes_low, memtype, Sync_CRC_EOP
+		{
+			uint32_t	length = inCommand.command == STK_PROG_PAGE ?
+										(uint32_t)inCommand.data.size() : inCommand.length;
+			ioData.push_back(length >> 8);		// bytes_high
+			ioData.push_back(length & 0xFF);	// bytes_low
+			ioData.push_back(inCommand.memType);
+			break;
+		}
+	}
+	// STK_SET_DEVICE device data, STK_PROG_PAGE data, STK_UNIVERSAL bytes
+	ioData.insert(ioData.end(), inCommand.data.begin(), inCommand.data.end());
+	ioData.push_back(CRC_EOP);
+}
+
+/******************************** SendCommands ********************************/
+/*
+*	Sends as many of the commands that follow the last command sent as will
+*	fit in the ISP's receive buffer.
+*
+*	Other than STK_LOAD_ADDRESS, the ISP may stop reading the serial port
+*	while it executes a command, e.g. while a page is being written or read.
+*	The bytes of every command sent after the first of these that hasn't
+*	been acknowledged wait in the ISP's receive buffer, so they must fit.
+*/
+bool STK500Session::SendCommands(void)
+{
+	std::vector<uint8_t>	dataToSend;
+	while (mSendIndex < mCommands.size() &&
+		(mSendIndex - mCommandIndex) < kMaxCommandsInFlight)
+	{
+		const SSTK500Command&	command = mCommands[mSendIndex];
+		uint32_t	bytesWaiting = 0;
+		bool		isWaiting = false;
+		for (uint32_t i = mCommandIndex; i < mSendIndex; i++)
+		{
+			if (isWaiting)
+			{
+				bytesWaiting += mSentLength[i % kMaxCommandsInFlight];
+			} else
+			{
+				isWaiting = mCommands[i].command != STK_LOAD_ADDRESS;
+			}
+		}
+		uint32_t	commandLength = CommandLength(command);
+		if (isWaiting &&
+			(bytesWaiting + commandLength) > kISPRxBufferSize)
+		{
+			break;
+		}
+		mSentLength[mSendIndex % kMaxCommandsInFlight] = commandLength;
+		EncodeCommand(command, dataToSend);
+		mSendIndex++;
+	}
+	return(dataToSend.empty() ||
+		mPort.Write(dataToSend.data(), (uint32_t)dataToSend.size()));
+}
+
+/******************************** BeginCommand ********************************/
+/*
+*	Called when the command at mCommandIndex becomes the command whose
+*	response is expected next.
+*/
+void STK500Session::BeginCommand(void)
+{
+	mExpectedResponse = STK_INSYNC;
+	mBytesReceived = 0;
+	switch(mCommands[mCommandIndex].command)
+	{
+		case STK_READ_SIGN:
+			mSignature = 0;
+			break;
+		case STK_READ_OSCCAL:
+			mCalibrationByte = 0;
+			break;
+	}
+}
+
+/****************************** ResponseTimeout *******************************/
+/*
+*	Returns the milliseconds to wait for the response to inCommand: mTimeout,
+*	plus the time it takes the ISP to write the bytes of an eeprom page.
+*/
+uint32_t STK500Session::ResponseTimeout(
+	const SSTK500Command&	inCommand) const
+{
+	uint32_t	timeout = mTimeout;
+	if (inCommand.command == STK_PROG_PAGE &&
+		inCommand.memType == 'E')
+	{
+		timeout += (uint32_t)inCommand.data.size() * kEEPROMByteWriteTime;
+	}
+	return(timeout);
+}
+
+/********************************* SetError ***********************************/
+void STK500Session::SetError(
+	const char*	inFormat,
+				...)
+{
+	char	error[256];
+	va_list	args;
+	va_start(args, inFormat);
+	vsnprintf(error, sizeof(error), inFormat, args);
+	va_end(args);
+	mError = error;
+}
+
+/****************************** ReceivePageData *******************************/
+/*
+*	inData follows the mBytesReceived bytes of page data already received for
+*	ioCommand.  Returns false if ioCommand is verifying and the data doesn't
+*	match.
+*/
+bool STK500Session::ReceivePageData(
+	SSTK500Command&	ioCommand,
+	const uint8_t*	inData,
+	uint32_t		inLength)
+{
+	if (ioCommand.expectedData)
+	{
+		const uint8_t*	expectedData = &ioCommand.expectedData[mBytesReceived];
+		for (uint32_t i = 0; i < inLength; i++)
+		{
+			if (inData[i] != expectedData[i])
+			{
+				SetError("Data verification failed at address 0x%X (read 0x%02X, expected 0x%02X)",
+					ioCommand.address + mBytesReceived + i, inData[i], expectedData[i]);
+				return(false);
+			}
+		}
+	} else if (ioCommand.dataRead)
+	{
+		ioCommand.dataRead->insert(ioCommand.dataRead->end(), inData, &inData[inLength]);
+	}
+	return(true);
+}
+
+/****************************** ProcessResponse *******************************/
+/*
+*	inData may contain any part of the responses to one or more of the
+*	commands in flight.  Returns false if the ISP is out of sync or a verify
+*	fails.
+*/
+bool STK500Session::ProcessResponse(
+	const uint8_t*	inData,
+	uint32_t		inLength)
+{
+	while (inLength &&
+		mCommandIndex < mCommands.size())
+	{
+		SSTK500Command&	command = mCommands[mCommandIndex];
+		if (mExpectedResponse == STK_INSYNC)
+		{
+			if (*inData != STK_INSYNC)
+			{
+				SetError("Sync error, ISP unexpected response 0x%02X (expected STK_INSYNC)", *inData);
+				return(false);
+			}
+			mExpectedResponse = STK_OK;
+			inData++;
+			inLength--;
+			continue;
+		}
+		/*
+		*	Commands that return data.  The data may not be received in a
+		*	single call.  mBytesReceived tracks the total received for this
+		*	command.
+		*/
+		if (mBytesReceived < command.length)
+		{
+			uint32_t	bytesRead = command.length - mBytesReceived;
+			if (bytesRead > inLength)
+			{
+				bytesRead = inLength;
+			}
+			switch (command.command)
+			{
+				case STK_READ_PAGE:
+					if (!ReceivePageData(command, inData, bytesRead))
+					{
+						return(false);
+					}
+					break;
+				case STK_READ_SIGN: // Resp_STK_INSYNC, sign_high, sign_middle, sign_low, Resp_STK_OK
+					for (uint32_t i = 0; i < bytesRead; i++)
+					{
+						mSignature = (mSignature << 8) + inData[i];
+					}
+					break;
+				case STK_READ_OSCCAL: // Resp_STK_INSYNC, OSCCAL, Resp_STK_OK
+					mCalibrationByte = *inData;
+					break;
+				// STK_UNIVERSAL: Resp_STK_INSYNC, result, Resp_STK_OK
+				// The result of the chip erase instruction isn't used.
+			}
+			mBytesReceived += bytesRead;
+			inData += bytesRead;
+			inLength -= bytesRead;
+			continue;
+		}
+		/*
+		*	The byte following the data must be STK_OK
+		*/
+		if (*inData != STK_OK)
+		{
+			SetError("Sync error, ISP unexpected response 0x%02X (expected STK_OK)", *inData);
+			return(false);
+		}
+		inData++;
+		inLength--;
+		mCommandIndex++;
+		if (mCommandIndex < mCommands.size())
+		{
+			BeginCommand();
+		}
+	}
+	if (inLength)
+	{
+		SetError("ISP sent %u unexpected bytes", inLength);
+		return(false);
+	}
+	return(true);
+}
+
+/************************************ Run *************************************/
+bool STK500Session::Run(void)
+{
+	bool	success = true;
+	mError.clear();
+	mCommandIndex = 0;
+	mSendIndex = 0;
+	if (mCommands.size())
+	{
+		BeginCommand();
+	}
+	while (success &&
+		mCommandIndex < mCommands.size())
+	{
+		uint8_t	buffer[512];
+		success = SendCommands();
+		if (success)
+		{
+			int32_t	bytesRead = mPort.Read(buffer, sizeof(buffer),
+										ResponseTimeout(mCommands[mCommandIndex]));
+			if (bytesRead > 0)
+			{
+				success = ProcessResponse(buffer, bytesRead);
+			} else
+			{
+				SetError(bytesRead == 0 ? "ISP is not responding (timeout)" : "Serial port read failed");
+				success = false;
+			}
+		} else
+		{
+			SetError("Serial port write failed");
+		}
+	}
+	mCommands.clear();
+	return(success);
+}
@@ -0,0 +1,200 @@
+/*
+*	STK500Session.h, Copyright Jonathan Mackey 2019
+*	Portable STK500 version 1 protocol engine, as implemented by ArduinoISP.
+*	This is the C++ equivalent of SerialHexLoader's SDK500IOSession.  It's
+*	also the base of STK500v2Session.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef STK500Session_h
+#define STK500Session_h
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "stk500.h"
+#include "STK500Port.h"
+
+/*
+*	An entry in the session's command queue.  Each entry carries everything
+*	needed to send the command and process its response.
+*/
+struct SSTK500Command
+{
+	uint8_t					command;
+	uint8_t					memType;		// for read and prog page, 'E' or 'F'
+	uint32_t				address;		// byte address for load, read and prog page
+	uint32_t				length;			// data bytes in the response
+	std::vector<uint8_t>	data;			// sent following the command
+	std::vector<uint8_t>*	dataRead;		// read page appends to this
+	const uint8_t*			expectedData;	// when set, read page compares with this instead
+};
+
+/*
+*	The session is a queue of commands that are set by calling one or more of
+*	the command functions, then executed in that order by Run.  As with
+*	SDK500IOSession, commands are pipelined: those that follow the command
+*	whose response is expected are sent without waiting for it, as many as
+*	fit in the ISP's receive buffer.
+*
+*	All addresses are byte addresses.  The ISP's load address is a word
+*	address, so addresses must be even.
+*
+*	A subclass for another protocol overrides the command functions that
+*	differ, and how commands are encoded, sent and their responses
+*	processed.
+*/
+class STK500Session
+{
+public:
+							STK500Session(
+								STK500Port&				inPort);
+	virtual					~STK500Session(void){}
+	/*
+	*	Determines which protocol the programmer speaks by trying the version
+	*	1 sync and the version 2 sign-on in turn, up to inAttempts times each.
+	*	Returns a new session for that protocol, or NULL with outError set if
+	*	the programmer doesn't respond to either.
+	*/
+	static STK500Session*	Connect(
+								STK500Port&				inPort,
+								std::string&			outError,
+								uint32_t				inAttempts = 20);
+	/*
+	*	Sends STK_GET_SYNC till the ISP responds, up to inAttempts times.
+	*	An Arduino resets when its port is opened, its bootloader runs for
+	*	a second or two before ArduinoISP starts.
+	*/
+	virtual bool			Sync(
+								uint32_t				inAttempts = 20);
+	virtual uint8_t			GetProtocolVersion(void) const
+								{return(1);}
+	virtual void			SetDevice(
+								const SSDK500ParamBlk&	inDeviceParamBlk);
+	virtual void			EnterProgMode(void);
+	virtual void			LeaveProgMode(void);
+	virtual void			ReadSignature(void);
+	virtual void			ReadCalibration(void);
+	virtual void			ChipErase(void);
+	/*
+	*	The data is sent in blocks of inBlockSize.  With inVerify, the region
+	*	is read back and each block is compared as it's received.
+	*	inData must remain valid till Run returns.
+	*/
+	void					ProgPage(
+								const uint8_t*			inData,
+								uint32_t				inLength,
+								uint32_t				inAddress,
+								uint8_t					inMemType,
+								bool					inVerify,
+								uint32_t				inBlockSize = kMaxBlockSize);
+	void					ReadPage(
+								std::vector<uint8_t>&	outData,
+								uint32_t				inAddress,
+								uint8_t					inMemType,
+								uint32_t				inLength);
+	/*
+	*	Programs inImage one flash page per STK_PROG_PAGE, skipping pages that
+	*	are all 0xFF.  inAddress must be page aligned and inPageSize must be
+	*	the pageSize passed to SetDevice.  This should follow ChipErase.
+	*/
+	void					ProgFlash(
+								const uint8_t*			inImage,
+								uint32_t				inLength,
+								uint32_t				inAddress,
+								uint32_t				inPageSize,
+								bool					inVerify);
+	/*
+	*	Executes the queued commands.  Returns false if the ISP doesn't
+	*	respond, is out of sync, or a verify fails (see GetError.)  The
+	*	queue is emptied either way.
+	*/
+	bool					Run(void);
+	uint32_t				GetSignature(void) const
+								{return(mSignature);}
+	uint8_t					GetCalibrationByte(void) const
+								{return(mCalibrationByte);}
+	const char*				GetError(void) const
+								{return(mError.c_str());}
+	void					SetTimeout(
+								uint32_t				inTimeout)
+								{mTimeout = inTimeout;}
+
+	static const uint32_t	kMaxBlockSize = 256;
+protected:
+	/*
+	*	The ArduinoISP's serial receive buffer is 64 bytes.  Commands are sent
+	*	ahead of their responses as long as the bytes waiting in this buffer
+	*	never exceed kISPRxBufferSize.
+	*/
+	static const uint32_t	kISPRxBufferSize = 63;
+	static const uint32_t	kMaxCommandsInFlight = 8;
+	/*
+	*	ArduinoISP waits 45ms after writing each eeprom byte, so a 256 byte
+	*	STK_PROG_PAGE of eeprom takes over 11 seconds to be answered.
+	*/
+	static const uint32_t	kEEPROMByteWriteTime = 45;	// ms
+
+	STK500Port&					mPort;
+	std::vector<SSTK500Command>	mCommands;
+	std::string	mError;
+	uint32_t	mTimeout;		// milliseconds to wait for a response
+	uint32_t	mCommandIndex;	// the command whose response is expected
+	uint32_t	mSendIndex;		// the next command to be sent
+	uint32_t	mSentLength[kMaxCommandsInFlight];
+	uint32_t	mBytesReceived;	// data bytes received for mCommandIndex
+	uint32_t	mSignature;
+	uint8_t		mCalibrationByte;
+	uint8_t		mExpectedResponse;
+
+	SSTK500Command&			AppendCommand(
+								uint8_t					inCommand);
+	virtual void			AppendProgPage(
+								const uint8_t*			inData,
+								uint32_t				inLength,
+								uint32_t				inAddress,
+								uint8_t					inMemType);
+	virtual void			AppendReadPage(
+								std::vector<uint8_t>*	outData,
+								uint32_t				inAddress,
+								uint8_t					inMemType,
+								uint32_t				inLength,
+								const uint8_t*			inExpectedData);
+	static uint32_t			CommandLength(
+								const SSTK500Command&	inCommand);
+	static void				EncodeCommand(
+								const SSTK500Command&	inCommand,
+								std::vector<uint8_t>&	ioData);
+	virtual bool			SendCommands(void);
+	virtual void			BeginCommand(void);
+	virtual uint32_t		ResponseTimeout(
+								const SSTK500Command&	inCommand) const;
+	bool					ReceivePageData(
+								SSTK500Command&			ioCommand,
+								const uint8_t*			inData,
+								uint32_t				inLength);
+	virtual bool			ProcessResponse(
+								const uint8_t*			inData,
+								uint32_t				inLength);
+	void					SetError(
+								const char*				inFormat,
+														...);
+};
+
+#endif // STK500Session_h
@@ -0,0 +1,353 @@
+/*
+*	STK500Tool.cpp, Copyright Jonathan Mackey 2019
+*	Command line tool that programs an AVR through an STK500 version 1
+*	programmer such as ArduinoISP, or an STK500 version 2 programmer.  The
+*	protocol is chosen by how the programmer responds when connecting.  It
+*	does what the SerialHexLoader SDK500 menu does, for Linux (or any POSIX)
+*	hosts.
+*
+*	Build from the repository root:
+*
+*	g++ -std=c++11 -O2 -ISerialHexLoader STK500/STK500Tool.cpp \
+*		STK500/STK500Session.cpp STK500/STK500v2Session.cpp \
+*		STK500/TermiosPort.cpp SerialHexLoader/IntelHex.cpp -o STK500Tool
+*
+*	Usage: STK500Tool -p port [-B baud] [-P page size] [-E eeprom size]
+*			command [args]
+*	-p port			the programmer's serial port, e.g. /dev/ttyACM0
+*	-B baud			baud rate (default 19200, ArduinoISP's)
+*	-P page size	flash page size in bytes (default 128, the ATmega328P's)
+*	-E eeprom size	eeprom size in bytes (default 512)
+*
+*	Commands (addresses and lengths may be decimal or 0x hex):
+*	sig							read the device signature
+*	cal							read the calibration byte (OSCCAL)
+*	eeread addr length [file]	read eeprom, to a binary file or as a hex
+*								dump
+*	eewrite addr file			write the binary file to eeprom and verify
+*	flash file					erase the chip, program the flash from a
+*								.hex or binary file (at address 0) and verify.
+*								Flash beyond 128KB needs a version 2
+*								programmer.
+*
+*	Exits with 0 on success, 1 on failure.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "STK500v2Session.h"
+#include "TermiosPort.h"
+#include "IntelHex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/******************************* Endian16_Swap ********************************/
+static uint16_t Endian16_Swap(
+	uint16_t	inValue)
+{
+	return((inValue << 8) | (inValue >> 8));
+}
+
+/******************************* Endian32_Swap ********************************/
+static uint32_t Endian32_Swap(
+	uint32_t	inValue)
+{
+	return((Endian16_Swap(inValue) << 16) | Endian16_Swap(inValue >> 16));
+}
+
+/*********************************** Usage ************************************/
+static int Usage(void)
+{
+	fprintf(stderr, "Usage: STK500Tool -p port [-B baud] [-P page size] [-E eeprom size] command [args]\n"
+					"	sig\n"
+					"	cal\n"
+					"	eeread addr length [file]\n"
+					"	eewrite addr file\n"
+					"	flash file\n");
+	return(1);
+}
+
+/********************************* Seconds ************************************/
+static double Seconds(void)
+{
+	struct timespec	now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return(now.tv_sec + (now.tv_nsec / 1e9));
+}
+
+/********************************* LoadFile ***********************************/
+/*
+*	Loads a binary file, or decodes an Intel hex file (.hex) filling any gaps
+*	with inFillByte.  outStartingAddress is 0 for a binary file.
+*/
+static bool LoadFile(
+	const char*				inPath,
+	uint8_t					inFillByte,
+	uint32_t&				outStartingAddress,
+	std::vector<uint8_t>&	outData)
+{
+	outStartingAddress = 0;
+	outData.clear();
+	const char*	extension = strrchr(inPath, '.');
+	if (extension &&
+		strcasecmp(extension, ".hex") == 0)
+	{
+		return(IntelHex::LoadFromFile(inPath, inFillByte, outStartingAddress, outData));
+	}
+	FILE*	file = fopen(inPath, "rb");
+	if (file)
+	{
+		uint8_t	buffer[4096];
+		size_t	bytesRead;
+		while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		{
+			outData.insert(outData.end(), buffer, &buffer[bytesRead]);
+		}
+		fclose(file);
+		return(true);
+	}
+	return(false);
+}
+
+/********************************** HexDump ***********************************/
+static void HexDump(
+	const std::vector<uint8_t>&	inData,
+	uint32_t					inStartAddress)
+{
+	for (uint32_t i = 0; i < inData.size(); i++)
+	{
+		if ((i % 16) == 0)
+		{
+			printf("%s%04X:", i ? "\n" : "", inStartAddress + i);
+		}
+		printf(" %02X", inData[i]);
+	}
+	printf("\n");
+}
+
+/*********************************** main *************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	const char*	portPath = NULL;
+	uint32_t	baudRate = 19200;
+	uint32_t	pageSize = 128;
+	uint32_t	eepromSize = 512;
+	int			option;
+	while ((option = getopt(argc, argv, "p:B:P:E:")) != -1)
+	{
+		switch (option)
+		{
+			case 'p':
+				portPath = optarg;
+				break;
+			case 'B':
+				baudRate = strtoul(optarg, NULL, 0);
+				break;
+			case 'P':
+				pageSize = strtoul(optarg, NULL, 0);
+				break;
+			case 'E':
+				eepromSize = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				return(Usage());
+		}
+	}
+	if (!portPath ||
+		optind >= argc)
+	{
+		return(Usage());
+	}
+	if (pageSize < 2 ||
+		pageSize > STK500Session::kMaxBlockSize ||
+		(pageSize & (pageSize-1)) != 0)
+	{
+		fprintf(stderr, "The flash page size must be a power of 2 from 2 to 256 bytes.\n");
+		return(1);
+	}
+	const char*	command = argv[optind];
+	char**		args = &argv[optind+1];
+	int			argCount = argc - optind - 1;
+	enum ECommand
+	{
+		eReadSignature,
+		eReadCalibration,
+		eReadEEPROM,
+		eWriteEEPROM,
+		eProgFlash
+	} commandID;
+	std::vector<uint8_t>	data;
+	uint32_t	address = 0;
+	uint32_t	length = 0;
+	SSDK500ParamBlk	devParamBlk;
+	memset(&devParamBlk, 0, sizeof(devParamBlk));
+	if (strcmp(command, "sig") == 0 && argCount == 0)
+	{
+		commandID = eReadSignature;
+	} else if (strcmp(command, "cal") == 0 && argCount == 0)
+	{
+		commandID = eReadCalibration;
+	} else if (strcmp(command, "eeread") == 0 && (argCount == 2 || argCount == 3))
+	{
+		commandID = eReadEEPROM;
+		address = strtoul(args[0], NULL, 0);
+		length = strtoul(args[1], NULL, 0);
+	} else if (strcmp(command, "eewrite") == 0 && argCount == 2)
+	{
+		commandID = eWriteEEPROM;
+		if (!LoadFile(args[1], 0xFF, address, data) || data.empty())
+		{
+			fprintf(stderr, "Unable to load %s.\n", args[1]);
+			return(1);
+		}
+		address = strtoul(args[0], NULL, 0);
+		length = (uint32_t)data.size();
+	} else if (strcmp(command, "flash") == 0 && argCount == 1)
+	{
+		commandID = eProgFlash;
+		if (!LoadFile(args[0], 0xFF, address, data) || data.empty())
+		{
+			fprintf(stderr, "Unable to load %s.\n", args[0]);
+			return(1);
+		}
+		/*
+		*	The image is padded with 0xFF to whole pages so that every
+		*	STK_PROG_PAGE starts on a page boundary and is a whole page.
+		*/
+		uint32_t	bytesInPage = address % pageSize;
+		data.insert(data.begin(), bytesInPage, 0xFF);
+		address -= bytesInPage;
+		if (data.size() % pageSize)
+		{
+			data.resize(data.size() + pageSize - (data.size() % pageSize), 0xFF);
+		}
+		length = (uint32_t)data.size();
+		devParamBlk.flashSize = Endian32_Swap(address + length);
+	} else
+	{
+		return(Usage());
+	}
+	if ((commandID == eReadEEPROM || commandID == eWriteEEPROM) &&
+		((address & 1) != 0 || length == 0 || address + length > eepromSize))
+	{
+		fprintf(stderr, "The eeprom address must be even and the range within the eeprom.\n");
+		return(1);
+	}
+
+	TermiosPort	port;
+	if (!port.Open(portPath, baudRate))
+	{
+		fprintf(stderr, "Unable to open %s at %u baud.\n", portPath, baudRate);
+		return(1);
+	}
+	std::string		error;
+	STK500Session*	sessionPtr = STK500Session::Connect(port, error);
+	if (!sessionPtr)
+	{
+		fprintf(stderr, "%s\n", error.c_str());
+		return(1);
+	}
+	STK500Session&	session = *sessionPtr;
+	if (session.GetProtocolVersion() == 2)
+	{
+		printf("STK500 version 2 programmer (%s)\n",
+			((STK500v2Session&)session).GetSignOn());
+	} else if (commandID == eProgFlash &&
+		address + length > 0x20000)
+	{
+		// STK_LOAD_ADDRESS takes a 16 bit word address.
+		fprintf(stderr, "Flash beyond 128KB isn't supported by STK500 version 1.\n");
+		delete sessionPtr;
+		return(1);
+	}
+	devParamBlk.pageSize = Endian16_Swap(pageSize);	// The ISP commits the flash page buffer at page boundaries.
+	devParamBlk.eepromSize = Endian16_Swap(eepromSize);
+	session.SetDevice(devParamBlk);
+	session.EnterProgMode();
+	session.ReadSignature();
+	switch (commandID)
+	{
+		case eReadSignature:
+			break;
+		case eReadCalibration:
+			session.ReadCalibration();
+			break;
+		case eReadEEPROM:
+			session.ReadPage(data, address, 'E', length);
+			break;
+		case eWriteEEPROM:
+			session.ProgPage(data.data(), length, address, 'E', true);
+			break;
+		case eProgFlash:
+			session.ChipErase();
+			session.ProgFlash(data.data(), length, address, pageSize, true);
+			break;
+	}
+	session.LeaveProgMode();
+
+	double	startTime = Seconds();
+	bool	success = session.Run();
+	if (success)
+	{
+		printf("Device signature = 0x%X\n", session.GetSignature());
+		switch (commandID)
+		{
+			case eReadSignature:
+				break;
+			case eReadCalibration:
+				printf("Calibration byte (OSCCAL) = 0x%02X\n", session.GetCalibrationByte());
+				break;
+			case eReadEEPROM:
+				if (argCount == 3)
+				{
+					FILE*	file = fopen(args[2], "wb");
+					success = file && fwrite(data.data(), 1, data.size(), file) == data.size();
+					if (file)
+					{
+						fclose(file);
+					}
+					if (!success)
+					{
+						fprintf(stderr, "Unable to write %s.\n", args[2]);
+					}
+				} else
+				{
+					HexDump(data, address);
+				}
+				break;
+			case eWriteEEPROM:
+				printf("0x%X eeprom bytes written starting at address 0x%X (verified).\n", length, address);
+				break;
+			case eProgFlash:
+				printf("0x%X flash bytes programmed starting at address 0x%X in %.2fs (verified).\n",
+					length, address, Seconds() - startTime);
+				break;
+		}
+	} else
+	{
+		fprintf(stderr, "%s\n", session.GetError());
+	}
+	delete sessionPtr;
+	return(success ? 0 : 1);
+}
@@ -0,0 +1,444 @@
+/*
+*	STK500v2Session.cpp, Copyright Jonathan Mackey 2019
+*	STK500 version 2 protocol engine for programmers such as the STK500 (with
+*	version 2 firmware) and the AVRISP mkII clones.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "STK500v2Session.h"
+
+/*
+*	CMD_PROGRAM_FLASH_ISP and CMD_PROGRAM_EEPROM_ISP parameters that follow
+*	NumBytes: mode, delay, cmd1, cmd2, cmd3, poll1, poll2.
+*
+*	Flash is programmed in page mode with RDY/BSY polling, the page is written
+*	once it's loaded: Load Program Memory Page (the programmer sets bit 3 for
+*	the high byte), Write Program Memory Page, Read Program Memory.
+*/
+static const uint8_t kProgFlashParams[] =
+	{MODE_PAGE | MODE_PAGE_RDY_BSY_POLLING | MODE_WRITE_PAGE, 10, 0x40, 0x4C, 0x20, 0xFF, 0x00};
+/*
+*	Eeprom is programmed a byte at a time with RDY/BSY polling: Write EEPROM
+*	Memory, Read EEPROM Memory.
+*/
+static const uint8_t kProgEEPROMParams[] =
+	{MODE_WORD_RDY_BSY_POLLING, 10, 0xC0, 0x00, 0xA0, 0xFF, 0xFF};
+/*
+*	timeout, stabDelay, cmdexeDelay, synchLoops, byteDelay, pollValue,
+*	pollIndex, and the Programming Enable instruction.  These are the values
+*	avrdude uses for the ATmega family.
+*/
+static const uint8_t kEnterProgModeParams[] =
+	{200, 100, 25, 32, 0, 0x53, 3, 0xAC, 0x53, 0x00, 0x00};
+// preDelay, postDelay
+static const uint8_t kLeaveProgModeParams[] = {1, 1};
+// eraseDelay, pollMethod (RDY/BSY), and the Chip Erase instruction
+static const uint8_t kChipEraseParams[] = {10, 1, 0xAC, 0x80, 0x00, 0x00};
+// retAddr, and the Read Calibration Byte instruction
+static const uint8_t kReadOSCCALParams[] = {4, 0x38, 0x00, 0x00, 0x00};
+
+/****************************** STK500v2Session *******************************/
+STK500v2Session::STK500v2Session(
+	STK500Port&	inPort)
+	: STK500Session(inPort), mPageSize(128), mFlashSize(0), mSequence(0)
+{
+}
+
+/************************************ Sync ************************************/
+bool STK500v2Session::Sync(
+	uint32_t	inAttempts)
+{
+	bool		success = false;
+	uint32_t	timeout = mTimeout;
+	mTimeout = 100;
+	for (uint32_t attempt = 0; attempt < inAttempts && !success; attempt++)
+	{
+		mPort.Flush();
+		AppendCommand(CMD_SIGN_ON);
+		success = Run();
+	}
+	mTimeout = timeout;
+	if (!success)
+	{
+		SetError("Unable to sync with the ISP");
+	}
+	return(success);
+}
+
+/********************************* SetDevice **********************************/
+void STK500v2Session::SetDevice(
+	const SSDK500ParamBlk&	inDeviceParamBlk)
+{
+	// The multi byte values are big-endian.
+	const uint8_t*	pageSize = (const uint8_t*)&inDeviceParamBlk.pageSize;
+	const uint8_t*	flashSize = (const uint8_t*)&inDeviceParamBlk.flashSize;
+	mPageSize = (pageSize[0] << 8) | pageSize[1];
+	mFlashSize = ((uint32_t)flashSize[0] << 24) | ((uint32_t)flashSize[1] << 16) |
+					(flashSize[2] << 8) | flashSize[3];
+}
+
+/******************************* EnterProgMode ********************************/
+void STK500v2Session::EnterProgMode(void)
+{
+	AppendCommand(CMD_ENTER_PROGMODE_ISP).data.assign(kEnterProgModeParams,
+							&kEnterProgModeParams[sizeof(kEnterProgModeParams)]);
+}
+
+/******************************* LeaveProgMode ********************************/
+void STK500v2Session::LeaveProgMode(void)
+{
+	AppendCommand(CMD_LEAVE_PROGMODE_ISP).data.assign(kLeaveProgModeParams,
+							&kLeaveProgModeParams[sizeof(kLeaveProgModeParams)]);
+}
+
+/******************************* ReadSignature ********************************/
+/*
+*	One CMD_READ_SIGNATURE_ISP per signature byte.  The address is the index
+*	of the byte.
+*/
+void STK500v2Session::ReadSignature(void)
+{
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		// retAddr, and the Read Signature Byte instruction
+		const uint8_t	params[] = {4, 0x30, 0x00, i, 0x00};
+		SSTK500Command&	command = AppendCommand(CMD_READ_SIGNATURE_ISP);
+		command.address = i;
+		command.data.assign(params, &params[sizeof(params)]);
+	}
+}
+
+/****************************** ReadCalibration *******************************/
+void STK500v2Session::ReadCalibration(void)
+{
+	AppendCommand(CMD_READ_OSCCAL_ISP).data.assign(kReadOSCCALParams,
+							&kReadOSCCALParams[sizeof(kReadOSCCALParams)]);
+}
+
+/********************************* ChipErase **********************************/
+/*
+*	Unlike ArduinoISP, the programmer waits for the erase to complete.
+*/
+void STK500v2Session::ChipErase(void)
+{
+	AppendCommand(CMD_CHIP_ERASE_ISP).data.assign(kChipEraseParams,
+							&kChipEraseParams[sizeof(kChipEraseParams)]);
+}
+
+/***************************** AppendLoadAddress ******************************/
+void STK500v2Session::AppendLoadAddress(
+	uint32_t	inAddress,
+	uint8_t		inMemType)
+{
+	SSTK500Command&	command = AppendCommand(CMD_LOAD_ADDRESS);
+	command.address = inAddress;
+	command.memType = inMemType;
+}
+
+/******************************* AppendProgPage *******************************/
+/*
+*	Flash is sent a page per message, each page is written when it's loaded.
+*/
+void STK500v2Session::AppendProgPage(
+	const uint8_t*	inData,
+	uint32_t		inLength,
+	uint32_t		inAddress,
+	uint8_t			inMemType)
+{
+	uint32_t	blockSize = inMemType == 'F' ? mPageSize : kMaxBlockSize;
+	for (uint32_t dataIndex = 0; dataIndex < inLength; dataIndex += blockSize)
+	{
+		uint32_t	bytesToSend = inLength - dataIndex;
+		if (bytesToSend > blockSize)
+		{
+			bytesToSend = blockSize;
+		}
+		AppendLoadAddress(inAddress + dataIndex, inMemType);
+		SSTK500Command&	command = AppendCommand(inMemType == 'F' ?
+										CMD_PROGRAM_FLASH_ISP : CMD_PROGRAM_EEPROM_ISP);
+		command.address = inAddress + dataIndex;
+		command.memType = inMemType;
+		command.data.assign(&inData[dataIndex], &inData[dataIndex + bytesToSend]);
+	}
+}
+
+/******************************* AppendReadPage *******************************/
+void STK500v2Session::AppendReadPage(
+	std::vector<uint8_t>*	outData,
+	uint32_t				inAddress,
+	uint8_t					inMemType,
+	uint32_t				inLength,
+	const uint8_t*			inExpectedData)
+{
+	for (uint32_t dataIndex = 0; dataIndex < inLength; dataIndex += kMaxBlockSize)
+	{
+		uint32_t	bytesRequested = inLength - dataIndex;
+		if (bytesRequested > kMaxBlockSize)
+		{
+			bytesRequested = kMaxBlockSize;
+		}
+		AppendLoadAddress(inAddress + dataIndex, inMemType);
+		SSTK500Command&	command = AppendCommand(inMemType == 'F' ?
+										CMD_READ_FLASH_ISP : CMD_READ_EEPROM_ISP);
+		command.address = inAddress + dataIndex;
+		command.memType = inMemType;
+		command.length = bytesRequested;
+		if (inExpectedData)
+		{
+			command.expectedData = &inExpectedData[dataIndex];
+		} else
+		{
+			command.dataRead = outData;
+		}
+	}
+}
+
+/********************************* EncodeBody *********************************/
+/*
+*	Appends the message body of inCommand to ioBody.
+*/
+void STK500v2Session::EncodeBody(
+	const SSTK500Command&	inCommand,
+	std::vector<uint8_t>&	ioBody) const
+{
+	ioBody.push_back(inCommand.command);
+	switch (inCommand.command)
+	{
+		case CMD_LOAD_ADDRESS: // + address, big-endian
+		{
+			// The flash address is a word address, the eeprom a byte address.
+			uint32_t	address = inCommand.address;
+			if (inCommand.memType == 'F')
+			{
+				address /= 2;
+				if (mFlashSize > 0x20000)
+				{
+					// The programmer loads the extended address byte as needed.
+					address |= 0x80000000;
+				}
+			}
+			ioBody.push_back(address >> 24);
+			ioBody.push_back((address >> 16) & 0xFF);
+			ioBody.push_back((address >> 8) & 0xFF);
+			ioBody.push_back(address & 0xFF);
+			break;
+		}
+		case CMD_PROGRAM_FLASH_ISP: // + NumBytes, mode, delay, cmd1-3, poll1-2, data
+		case CMD_PROGRAM_EEPROM_ISP:
+		{
+			uint32_t		length = (uint32_t)inCommand.data.size();
+			const uint8_t*	params = inCommand.command == CMD_PROGRAM_FLASH_ISP ?
+										kProgFlashParams : kProgEEPROMParams;
+			ioBody.push_back(length >> 8);
+			ioBody.push_back(length & 0xFF);
+			ioBody.insert(ioBody.end(), params, &params[sizeof(kProgFlashParams)]);
+			break;
+		}
+		case CMD_READ_FLASH_ISP: // + NumBytes, cmd1
+		case CMD_READ_EEPROM_ISP:
+			ioBody.push_back(inCommand.length >> 8);
+			ioBody.push_back(inCommand.length & 0xFF);
+			ioBody.push_back(inCommand.command == CMD_READ_FLASH_ISP ? 0x20 : 0xA0);
+			break;
+	}
+	// Parameters, or the data to program
+	ioBody.insert(ioBody.end(), inCommand.data.begin(), inCommand.data.end());
+}
+
+/******************************** SendCommands ********************************/
+/*
+*	Sends the next command once the answer to the previous one has been
+*	received.  The message is MESSAGE_START, sequence number, body size
+*	(big-endian), TOKEN, body, and the XOR of all of the preceding bytes.
+*/
+bool STK500v2Session::SendCommands(void)
+{
+	if (mSendIndex > mCommandIndex ||
+		mSendIndex >= mCommands.size())
+	{
+		return(true);
+	}
+	std::vector<uint8_t>	message;
+	message.push_back(MESSAGE_START);
+	message.push_back(mSequence);
+	message.push_back(0);
+	message.push_back(0);
+	message.push_back(TOKEN);
+	EncodeBody(mCommands[mSendIndex], message);
+	uint32_t	bodySize = (uint32_t)message.size() - 5;
+	message[2] = bodySize >> 8;
+	message[3] = bodySize & 0xFF;
+	uint8_t	checksum = 0;
+	for (uint32_t i = 0; i < message.size(); i++)
+	{
+		checksum ^= message[i];
+	}
+	message.push_back(checksum);
+	mSequence++;
+	mSendIndex++;
+	return(mPort.Write(message.data(), (uint32_t)message.size()));
+}
+
+/****************************** ResponseTimeout *******************************/
+/*
+*	The programmer polls each eeprom byte for up to the delay parameter.
+*/
+uint32_t STK500v2Session::ResponseTimeout(
+	const SSTK500Command&	inCommand) const
+{
+	uint32_t	timeout = mTimeout;
+	if (inCommand.command == CMD_PROGRAM_EEPROM_ISP)
+	{
+		timeout += (uint32_t)inCommand.data.size() * kProgEEPROMParams[1];
+	}
+	return(timeout);
+}
+
+/******************************** BeginCommand ********************************/
+void STK500v2Session::BeginCommand(void)
+{
+	mAnswer.clear();
+	mBytesReceived = 0;
+}
+
+/****************************** ProcessResponse *******************************/
+/*
+*	inData may contain any part of the framed answer to the command sent.
+*	Returns false if the framing, sequence number or checksum is wrong, the
+*	command failed, or a verify fails.
+*/
+bool STK500v2Session::ProcessResponse(
+	const uint8_t*	inData,
+	uint32_t		inLength)
+{
+	while (inLength &&
+		mCommandIndex < mSendIndex)
+	{
+		mAnswer.push_back(*inData);
+		inData++;
+		inLength--;
+		uint32_t	answerLength = (uint32_t)mAnswer.size();
+		if (answerLength == 1)
+		{
+			if (mAnswer[0] != MESSAGE_START)
+			{
+				SetError("Sync error, ISP unexpected response 0x%02X (expected MESSAGE_START)", mAnswer[0]);
+				return(false);
+			}
+		} else if (answerLength == 5)
+		{
+			uint8_t		sequence = mSequence - 1;
+			uint32_t	bodySize = (mAnswer[2] << 8) | mAnswer[3];
+			if (mAnswer[1] != sequence)
+			{
+				SetError("ISP answer sequence number %u (expected %u)", mAnswer[1], sequence);
+				return(false);
+			}
+			if (mAnswer[4] != TOKEN ||
+				bodySize == 0 ||
+				bodySize > MESSAGE_MAX_BODY_SIZE)
+			{
+				SetError("ISP answer is malformed");
+				return(false);
+			}
+		} else if (answerLength > 5 &&
+			answerLength == (uint32_t)((mAnswer[2] << 8) | mAnswer[3]) + 6)
+		{
+			uint8_t	checksum = 0;
+			for (uint32_t i = 0; i < answerLength; i++)
+			{
+				checksum ^= mAnswer[i];
+			}
+			if (checksum != 0)
+			{
+				SetError("ISP answer checksum error");
+				return(false);
+			}
+			if (!ProcessAnswer(&mAnswer[5], answerLength - 6))
+			{
+				return(false);
+			}
+			mCommandIndex++;
+			if (mCommandIndex < mCommands.size())
+			{
+				BeginCommand();
+			}
+		}
+	}
+	if (inLength)
+	{
+		SetError("ISP sent %u unexpected bytes", inLength);
+		return(false);
+	}
+	return(true);
+}
+
+/******************************* ProcessAnswer ********************************/
+/*
+*	inBody is the body of the answer to the command at mCommandIndex: the
+*	command, its status, then any data.
+*/
+bool STK500v2Session::ProcessAnswer(
+	const uint8_t*	inBody,
+	uint32_t		inLength)
+{
+	SSTK500Command&	command = mCommands[mCommandIndex];
+	if (inLength < 2 ||
+		inBody[0] != command.command)
+	{
+		SetError("ISP answered command 0x%02X (expected 0x%02X)", inBody[0], command.command);
+		return(false);
+	}
+	if (inBody[1] != STATUS_CMD_OK)
+	{
+		SetError("ISP command 0x%02X failed, status 0x%02X", command.command, inBody[1]);
+		return(false);
+	}
+	switch (command.command)
+	{
+		case CMD_SIGN_ON: // + length, sign-on string
+			if (inLength > 2 &&
+				inBody[2] <= inLength - 3)
+			{
+				mSignOn.assign((const char*)&inBody[3], inBody[2]);
+			}
+			break;
+		case CMD_READ_FLASH_ISP: // + data, status
+		case CMD_READ_EEPROM_ISP:
+			if (inLength != command.length + 3)
+			{
+				SetError("ISP answered with %u bytes of data (expected %u)", inLength - 3, command.length);
+				return(false);
+			}
+			return(ReceivePageData(command, &inBody[2], command.length));
+		case CMD_READ_SIGNATURE_ISP: // + signature byte, status
+			if (inLength > 2)
+			{
+				mSignature = (command.address ? (mSignature << 8) : 0) + inBody[2];
+			}
+			break;
+		case CMD_READ_OSCCAL_ISP: // + OSCCAL, status
+			if (inLength > 2)
+			{
+				mCalibrationByte = inBody[2];
+			}
+			break;
+	}
+	return(true);
+}
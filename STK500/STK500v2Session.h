@@ -0,0 +1,108 @@
+/*
+*	STK500v2Session.h, Copyright Jonathan Mackey 2019
+*	STK500 version 2 protocol engine for programmers such as the STK500 (with
+*	version 2 firmware) and the AVRISP mkII clones.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef STK500v2Session_h
+#define STK500v2Session_h
+
+#include "STK500Session.h"
+#include "stk500v2.h"
+
+/*
+*	The commands are queued the same way as for version 1, but each is sent
+*	as a framed message with a sequence number and checksum, and the next
+*	isn't sent till its answer is received.  Version 2 programmers wait for
+*	each flash page and eeprom byte to be written before answering, so
+*	unlike version 1 there's nothing to gain by sending ahead, while a
+*	message can carry a page of up to 256 bytes (the body is limited to
+*	MESSAGE_MAX_BODY_SIZE.)
+*
+*	The ISP instructions and timing are those of the ATmega family.  Flash
+*	is programmed a page per message (the page size is the pageSize passed
+*	to SetDevice), eeprom a byte at a time within a message.
+*/
+class STK500v2Session : public STK500Session
+{
+public:
+							STK500v2Session(
+								STK500Port&				inPort);
+	/*
+	*	Sends CMD_SIGN_ON till the programmer answers, up to inAttempts
+	*	times.  This should be called before any commands are queued.
+	*/
+	virtual bool			Sync(
+								uint32_t				inAttempts = 20);
+	virtual uint8_t			GetProtocolVersion(void) const
+								{return(2);}
+	/*
+	*	The programmer's sign-on string, e.g. "STK500_2" or "AVRISP_2".
+	*/
+	const char*				GetSignOn(void) const
+								{return(mSignOn.c_str());}
+	/*
+	*	There's no equivalent of STK_SET_DEVICE, only the page and flash
+	*	sizes are used.
+	*/
+	virtual void			SetDevice(
+								const SSDK500ParamBlk&	inDeviceParamBlk);
+	virtual void			EnterProgMode(void);
+	virtual void			LeaveProgMode(void);
+	virtual void			ReadSignature(void);
+	virtual void			ReadCalibration(void);
+	virtual void			ChipErase(void);
+protected:
+	std::string				mSignOn;
+	std::vector<uint8_t>	mAnswer;	// the framed answer being received
+	uint32_t				mPageSize;
+	uint32_t				mFlashSize;
+	uint8_t					mSequence;	// of the next message sent
+
+	virtual void			AppendProgPage(
+								const uint8_t*			inData,
+								uint32_t				inLength,
+								uint32_t				inAddress,
+								uint8_t					inMemType);
+	virtual void			AppendReadPage(
+								std::vector<uint8_t>*	outData,
+								uint32_t				inAddress,
+								uint8_t					inMemType,
+								uint32_t				inLength,
+								const uint8_t*			inExpectedData);
+	void					AppendLoadAddress(
+								uint32_t				inAddress,
+								uint8_t					inMemType);
+	void					EncodeBody(
+								const SSTK500Command&	inCommand,
+								std::vector<uint8_t>&	ioBody) const;
+	virtual bool			SendCommands(void);
+	virtual void			BeginCommand(void);
+	virtual uint32_t		ResponseTimeout(
+								const SSTK500Command&	inCommand) const;
+	virtual bool			ProcessResponse(
+								const uint8_t*			inData,
+								uint32_t				inLength);
+	bool					ProcessAnswer(
+								const uint8_t*			inBody,
+								uint32_t				inLength);
+};
+
+#endif // STK500v2Session_h
@@ -0,0 +1,149 @@
+/*
+*	TermiosPort.cpp, Copyright Jonathan Mackey 2019
+*	STK500Port for a Linux (or any POSIX termios) serial port.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "TermiosPort.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+struct SBaudRate
+{
+	uint32_t	baudRate;
+	speed_t		speed;
+};
+
+static const SBaudRate kBaudRates[] =
+{
+	{9600, B9600},
+	{19200, B19200},
+	{38400, B38400},
+	{57600, B57600},
+	{115200, B115200},
+	{230400, B230400}
+};
+
+/******************************** TermiosPort *********************************/
+TermiosPort::TermiosPort(void)
+	: mFD(-1)
+{
+}
+
+/******************************** ~TermiosPort ********************************/
+TermiosPort::~TermiosPort(void)
+{
+	Close();
+}
+
+/************************************ Open ************************************/
+bool TermiosPort::Open(
+	const char*	inPath,
+	uint32_t	inBaudRate)
+{
+	const SBaudRate*	baudRate = kBaudRates;
+	const SBaudRate*	baudRateEnd = &kBaudRates[sizeof(kBaudRates)/sizeof(SBaudRate)];
+	for (; baudRate < baudRateEnd; baudRate++)
+	{
+		if (baudRate->baudRate == inBaudRate)
+		{
+			break;
+		}
+	}
+	Close();
+	if (baudRate < baudRateEnd)
+	{
+		mFD = open(inPath, O_RDWR | O_NOCTTY);
+		if (mFD >= 0)
+		{
+			struct termios	settings;
+			if (tcgetattr(mFD, &settings) == 0)
+			{
+				cfmakeraw(&settings);
+				settings.c_cflag |= (CLOCAL | CREAD);
+				settings.c_cc[VMIN] = 0;
+				settings.c_cc[VTIME] = 0;
+				cfsetispeed(&settings, baudRate->speed);
+				cfsetospeed(&settings, baudRate->speed);
+				if (tcsetattr(mFD, TCSANOW, &settings) == 0)
+				{
+					return(true);
+				}
+			}
+			Close();
+		}
+	}
+	return(false);
+}
+
+/*********************************** Close ************************************/
+void TermiosPort::Close(void)
+{
+	if (mFD >= 0)
+	{
+		close(mFD);
+		mFD = -1;
+	}
+}
+
+/*********************************** Write ************************************/
+bool TermiosPort::Write(
+	const uint8_t*	inData,
+	uint32_t		inLength)
+{
+	while (inLength)
+	{
+		ssize_t	bytesWritten = write(mFD, inData, inLength);
+		if (bytesWritten > 0)
+		{
+			inData += bytesWritten;
+			inLength -= bytesWritten;
+		} else if (bytesWritten < 0 && errno != EINTR && errno != EAGAIN)
+		{
+			return(false);
+		}
+	}
+	return(true);
+}
+
+/************************************ Read ************************************/
+int32_t TermiosPort::Read(
+	uint8_t*	outData,
+	uint32_t	inLength,
+	uint32_t	inTimeout)
+{
+	struct pollfd	pollFD = {mFD, POLLIN, 0};
+	int	ready = poll(&pollFD, 1, inTimeout);
+	if (ready > 0)
+	{
+		ssize_t	bytesRead = read(mFD, outData, inLength);
+		// A pseudo-terminal returns EIO while its other side is closed.
+		return(bytesRead >= 0 ? (int32_t)bytesRead : -1);
+	}
+	return(ready == 0 || errno == EINTR ? 0 : -1);
+}
+
+/*********************************** Flush ************************************/
+void TermiosPort::Flush(void)
+{
+	tcflush(mFD, TCIFLUSH);
+}
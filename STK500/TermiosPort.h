@@ -0,0 +1,54 @@
+/*
+*	TermiosPort.h, Copyright Jonathan Mackey 2019
+*	STK500Port for a Linux (or any POSIX termios) serial port.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef TermiosPort_h
+#define TermiosPort_h
+
+#include "STK500Port.h"
+
+class TermiosPort : public STK500Port
+{
+public:
+							TermiosPort(void);
+	virtual					~TermiosPort(void);
+	/*
+	*	Opens inPath raw at inBaudRate.  Returns false if the port can't be
+	*	opened or the baud rate isn't supported.
+	*/
+	bool					Open(
+								const char*				inPath,
+								uint32_t				inBaudRate);
+	void					Close(void);
+	// STK500Port
+	virtual bool			Write(
+								const uint8_t*			inData,
+								uint32_t				inLength);
+	virtual int32_t			Read(
+								uint8_t*				outData,
+								uint32_t				inLength,
+								uint32_t				inTimeout);
+	virtual void			Flush(void);
+protected:
+	int			mFD;
+};
+
+#endif // TermiosPort_h
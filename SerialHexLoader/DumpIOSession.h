@@ -0,0 +1,56 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+//
+//  DumpIOSession.h
+//  SerialHexLoader
+//
+//  Created by Jon Mackey on 10/19/26.
+//  Copyright © 2026 Jon Mackey. All rights reserved.
+//
+
+#import "SerialPortIOSession.h"
+
+/*
+*	Receives a range of a device dumped by HexLoader (D command.)  HexLoader
+*	sends the range as CRC protected binary frames without waiting for acks.
+*	Any part of the range not received in a valid frame is requested again
+*	once HexLoader ends the dump.
+*/
+@interface DumpIOSession : SerialPortIOSession
+
+@property (nonatomic) uint32_t startAddress;	// Range to dump
+@property (nonatomic) uint32_t endAddress;
+@property (nonatomic) uint32_t currentAddress;	// Next address expected
+@property (nonatomic) uint32_t requestEnd;		// End of the range requested
+@property (nonatomic) NSUInteger requests;		// Number of ranges requested again
+@property (nonatomic) BOOL inSync;				// At a frame boundary
+@property (nonatomic, strong) NSMutableData* dumpData;
+@property (nonatomic, strong) NSMutableData* rxBuffer;
+@property (nonatomic, strong) NSMutableArray<NSValue*>* missingRanges;
+
+- (instancetype)initWithRange:(uint32_t)inStartAddress end:(uint32_t)inEndAddress port:(ORSSerialPort *)inPort;
+- (void)begin;
+- (NSData*)didReceiveData:(NSData *)inData;
+- (void)stop;
+- (void)timeoutCheck;
+
+@end
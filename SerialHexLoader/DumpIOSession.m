@@ -0,0 +1,254 @@
+/*******************************************************************************
+	License
+	****************************************************************************
+	This program is free software; you can redistribute it
+	and/or modify it under the terms of the GNU General
+	Public License as published by the Free Software
+	Foundation; either version 3 of the License, or
+	(at your option) any later version.
+ 
+	This program is distributed in the hope that it will
+	be useful, but WITHOUT ANY WARRANTY; without even the
+	implied warranty of MERCHANTABILITY or FITNESS FOR A
+	PARTICULAR PURPOSE. See the GNU General Public
+	License for more details.
+ 
+	Licence can be viewed at
+	http://www.gnu.org/licenses/gpl-3.0.txt
+//
+	Please maintain this license information along with authorship
+	and copyright notices in any redistribution of this code
+*******************************************************************************/
+//
+//  DumpIOSession.m
+//  SerialHexLoader
+//
+//  Created by Jon Mackey on 10/19/26.
+//  Copyright © 2026 Jon Mackey. All rights reserved.
+//
+
+#import "DumpIOSession.h"
+
+@implementation DumpIOSession
+
+/*
+*	A frame is '#', length (2 bytes), address (4 bytes), data, CRC (2 bytes.)
+*	Multibyte values are big endian.  HexLoader never sends more than a block
+*	per frame.
+*/
+static const NSUInteger	kFrameOverhead = 9;
+static const NSUInteger	kFrameHeaderLength = 7;
+static const uint16_t		kMaxFrameLength = 512;
+static const NSUInteger	kMaxRequests = 8;
+
+/*********************************** Crc16 ************************************/
+/*
+*	CRC-16/CCITT-FALSE, the same as HexLoader's Crc16.
+*/
+static uint16_t Crc16(
+	uint16_t		inCrc,
+	const uint8_t*	inData,
+	NSUInteger		inLength)
+{
+	while (inLength--)
+	{
+		inCrc ^= (uint16_t)*(inData++) << 8;
+		for (uint8_t i = 0; i < 8; i++)
+		{
+			inCrc = (inCrc & 0x8000) ? (inCrc << 1) ^ 0x1021 : inCrc << 1;
+		}
+	}
+	return(inCrc);
+}
+
+/****************************** initWithRange *********************************/
+- (instancetype)initWithRange:(uint32_t)inStartAddress end:(uint32_t)inEndAddress port:(ORSSerialPort *)inPort
+{
+	self = [super initWithData:nil port:inPort];
+	if (self)
+	{
+		_startAddress = inStartAddress;
+		_endAddress = inEndAddress;
+		_currentAddress = inStartAddress;
+		// Anything not received stays 0xFF, the same as an erased NOR Flash.
+		_dumpData = [NSMutableData dataWithLength:inEndAddress - inStartAddress];
+		memset(_dumpData.mutableBytes, 0xFF, _dumpData.length);
+		_rxBuffer = [NSMutableData dataWithCapacity:1024];
+		_missingRanges = [NSMutableArray array];
+	}
+	return(self);
+}
+
+/********************************** begin *************************************/
+- (void)begin
+{
+	[super begin];
+	self.requests = 0;
+	self.rxBuffer.length = 0;
+	[self.missingRanges removeAllObjects];
+	[self requestFrom:self.startAddress to:self.endAddress];
+}
+
+/******************************* requestFrom **********************************/
+- (void)requestFrom:(uint32_t)inStartAddress to:(uint32_t)inEndAddress
+{
+	self.currentAddress = inStartAddress;
+	self.requestEnd = inEndAddress;
+	self.inSync = YES;
+	[self.serialPort sendData:[[NSString stringWithFormat:@"D%x,%x\n", inStartAddress, inEndAddress] dataUsingEncoding:NSASCIIStringEncoding]];
+}
+
+/***************************** didReceiveData *********************************/
+/*
+*	The frames aren't logged, only error messages from HexLoader are returned.
+*/
+- (NSData*)didReceiveData:(NSData *)inData
+{
+	NSData*	logData = [NSData data];
+	if (!self.isDone)
+	{
+		[self.rxBuffer appendData:inData];
+		const uint8_t*	bytes = (const uint8_t*)self.rxBuffer.bytes;
+		NSUInteger		length = self.rxBuffer.length;
+		NSUInteger		i = 0;
+		while (!self.isDone && i < length)
+		{
+			if (bytes[i] == '#')
+			{
+				if (length - i < kFrameHeaderLength)
+				{
+					break;	// Wait for the rest of the header
+				}
+				uint16_t	frameLength = ((uint16_t)bytes[i+1] << 8) + bytes[i+2];
+				if (frameLength <= kMaxFrameLength)
+				{
+					if (length - i < frameLength + kFrameOverhead)
+					{
+						break;	// Wait for the rest of the frame
+					}
+					const uint8_t*	crcPtr = &bytes[i + kFrameHeaderLength + frameLength];
+					if (Crc16(0xFFFF, &bytes[i+1], frameLength + kFrameHeaderLength - 1) ==
+						(((uint16_t)crcPtr[0] << 8) + crcPtr[1]))
+					{
+						uint32_t	address = ((uint32_t)bytes[i+3] << 24) + ((uint32_t)bytes[i+4] << 16) +
+											((uint32_t)bytes[i+5] << 8) + bytes[i+6];
+						[self processFrame:&bytes[i + kFrameHeaderLength] length:frameLength address:address];
+						i += frameLength + kFrameOverhead;
+						self.inSync = YES;
+						continue;
+					}
+				}
+				/*
+				*	Not a valid frame.  Whatever the frame contained is
+				*	requested again once the dump ends.  Skip to the next '#'.
+				*/
+				self.inSync = NO;
+			} else if (bytes[i] == '?' &&
+				self.inSync)
+			{
+				// An error message from HexLoader
+				const uint8_t*	newline = memchr(&bytes[i], '\n', length - i);
+				if (!newline)
+				{
+					break;	// Wait for the rest of the message
+				}
+				logData = [NSData dataWithBytes:&bytes[i] length:newline - &bytes[i] + 1];
+				i += logData.length;
+				self.stoppedDueToError = YES;
+				self.done = YES;
+				break;
+			}
+			i++;
+		}
+		[self.rxBuffer replaceBytesInRange:NSMakeRange(0, i) withBytes:NULL length:0];
+	}
+	return(logData);
+}
+
+/******************************* processFrame *********************************/
+- (void)processFrame:(const uint8_t*)inData length:(uint16_t)inLength address:(uint32_t)inAddress
+{
+	if (inLength == 0)
+	{
+		if (inAddress == self.requestEnd)
+		{
+			[self requestEnded];
+		}
+	/*
+	*	Frames arrive in address order so anything skipped between the
+	*	previous valid frame and this one was lost.
+	*/
+	} else if (inAddress >= self.currentAddress &&
+		(inAddress + inLength) <= self.requestEnd)
+	{
+		if (inAddress > self.currentAddress)
+		{
+			[self.missingRanges addObject:[NSValue valueWithRange:
+				NSMakeRange(self.currentAddress, inAddress - self.currentAddress)]];
+		}
+		memcpy((uint8_t*)self.dumpData.mutableBytes + (inAddress - self.startAddress), inData, inLength);
+		self.currentAddress = inAddress + inLength;
+	}
+}
+
+/******************************* requestEnded *********************************/
+/*
+*	Requests the next range that wasn't received.  The session is done when
+*	there are none left.
+*/
+- (void)requestEnded
+{
+	if (self.currentAddress < self.requestEnd)
+	{
+		[self.missingRanges addObject:[NSValue valueWithRange:
+			NSMakeRange(self.currentAddress, self.requestEnd - self.currentAddress)]];
+	}
+	if (self.missingRanges.count == 0)
+	{
+		self.currentAddress = self.endAddress;
+		self.done = YES;
+	} else if (self.requests < kMaxRequests)
+	{
+		NSRange	missingRange = self.missingRanges.firstObject.rangeValue;
+		[self.missingRanges removeObjectAtIndex:0];
+		self.requests++;
+		[self requestFrom:(uint32_t)missingRange.location to:(uint32_t)NSMaxRange(missingRange)];
+	} else
+	{
+		NSRange	missingRange = self.missingRanges.firstObject.rangeValue;
+		[self.delegate logErrorString:[NSString stringWithFormat:@"Dump failed, unable to read 0x%lX bytes starting at 0x%lX", missingRange.length, missingRange.location]];
+		self.stoppedDueToError = YES;
+		self.done = YES;
+	}
+}
+
+/********************************** stop **************************************/
+- (void)stop
+{
+	uint8_t	stopCommand = 'S';
+	[self.serialPort sendData:[NSData dataWithBytes:&stopCommand length:1]];
+	[super stop];
+}
+
+/******************************** timeoutCheck ********************************/
+/*
+*	When nothing has been received for timeout seconds, the rest of the range
+*	requested is assumed lost (e.g. the end frame was corrupted.)
+*/
+- (void)timeoutCheck
+{
+	self.idleTime++;
+	if (self.idleTime > self.timeout)
+	{
+		self.idleTime = 0;
+		self.rxBuffer.length = 0;
+		[self requestEnded];
+		if (self.stoppedDueToError)
+		{
+			self.stoppedDueToError = NO;
+			self.stoppedDueToTimeout = YES;
+		}
+	}
+}
+
+@end
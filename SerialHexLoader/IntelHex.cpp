@@ -284,3 +284,183 @@ bool IntelHex::SaveToFile(
 	}
 	return(success);
 }
+
+/******************************** HexStrToInt8 ********************************/
+/*
+*	Returns false if inStr doesn't start with 2 hex characters.
+*/
+static bool HexStrToInt8(
+	const char*	inStr,
+	uint8_t&	outNum)
+{
+	outNum = 0;
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		char	thisChar = inStr[i];
+		outNum <<= 4;
+		if (thisChar >= '0' && thisChar <= '9')
+		{
+			outNum += (thisChar - '0');
+		} else if (thisChar >= 'A' && thisChar <= 'F')
+		{
+			outNum += (thisChar - 'A' + 10);
+		} else if (thisChar >= 'a' && thisChar <= 'f')
+		{
+			outNum += (thisChar - 'a' + 10);
+		} else
+		{
+			return(false);
+		}
+	}
+	return(true);
+}
+
+/****************************** FromIntelHexLine ******************************/
+/*
+*	Decodes a single record.  outData must be at least 255 bytes.  Returns
+*	false if the line isn't a record or its checksum is wrong.
+*/
+static bool FromIntelHexLine(
+	const char*	inLine,
+	uint8_t&	outDataLen,
+	uint16_t&	outAddress,
+	uint8_t&	outRecordType,
+	uint8_t*	outData)
+{
+	if (inLine[0] != ':')
+	{
+		return(false);
+	}
+	uint8_t		header[4];	// byte count, address high, address low, record type
+	uint8_t		checksum = 0;
+	const char*	hexPtr = &inLine[1];
+	for (uint8_t i = 0; i < 4; i++, hexPtr += 2)
+	{
+		if (!HexStrToInt8(hexPtr, header[i]))
+		{
+			return(false);
+		}
+		checksum += header[i];
+	}
+	outDataLen = header[0];
+	outAddress = ((uint16_t)header[1] << 8) + header[2];
+	outRecordType = header[3];
+	// The data is followed by the checksum byte
+	for (uint16_t i = 0; i <= outDataLen; i++, hexPtr += 2)
+	{
+		uint8_t	thisByte;
+		if (!HexStrToInt8(hexPtr, thisByte))
+		{
+			return(false);
+		}
+		if (i < outDataLen)
+		{
+			outData[i] = thisByte;
+		}
+		checksum += thisByte;
+	}
+	return(checksum == 0);
+}
+
+/******************************** LoadFromFile ********************************/
+/*
+*	Two passes are made through the file.  The first validates the records and
+*	finds the address range, the second copies the data into the image.  This
+*	allows the records to be in any order.
+*/
+bool IntelHex::LoadFromFile(
+	const char*				inHexFilePath,
+	uint8_t					inFillByte,
+	uint32_t&				outStartingAddress,
+	std::vector<uint8_t>&	outData)
+{
+	bool success = false;
+	outStartingAddress = 0;
+	outData.clear();
+	FILE*	hexFile = fopen(inHexFilePath, "r");
+	if (hexFile)
+	{
+		char		hexLine[(255 * 2) + 14];
+		uint8_t		data[255];
+		uint8_t		dataLen;
+		uint16_t	address;
+		uint8_t		recordType;
+		uint32_t	lowAddress = 0xFFFFFFFF;
+		uint32_t	highAddress = 0;
+		for (uint8_t pass = 0; pass < 2; pass++)
+		{
+			uint32_t	baseAddress = 0;
+			bool		hitEOF = false;
+			success = true;
+			fseek(hexFile, 0, SEEK_SET);
+			while (success &&
+				!hitEOF &&
+				fgets(hexLine, sizeof(hexLine), hexFile))
+			{
+				// Skip blank lines
+				if (hexLine[0] == '\n' || hexLine[0] == '\r' || hexLine[0] == 0)
+				{
+					continue;
+				}
+				success = FromIntelHexLine(hexLine, dataLen, address, recordType, data);
+				if (!success)
+				{
+					break;
+				}
+				switch (recordType)
+				{
+					case eRecordTypeData:
+					{
+						uint32_t	recordAddress = baseAddress + address;
+						if (pass == 0)
+						{
+							if (dataLen)
+							{
+								if (recordAddress < lowAddress)
+								{
+									lowAddress = recordAddress;
+								}
+								if (recordAddress + dataLen > highAddress)
+								{
+									highAddress = recordAddress + dataLen;
+								}
+							}
+						} else
+						{
+							for (uint8_t i = 0; i < dataLen; i++)
+							{
+								outData[recordAddress + i - lowAddress] = data[i];
+							}
+						}
+						break;
+					}
+					case eRecordTypeEOF:
+						hitEOF = true;
+						break;
+					case eRecordTypeExSegAddr:
+						success = dataLen == 2;
+						baseAddress = (((uint32_t)data[0] << 8) + data[1]) << 4;
+						break;
+					case eRecordTypeExLinAddr:
+						success = dataLen == 2;
+						baseAddress = (((uint32_t)data[0] << 8) + data[1]) << 16;
+						break;
+					// The start address records don't affect the image
+				}
+			}
+			if (!success ||
+				lowAddress > highAddress)
+			{
+				success = false;
+				break;
+			}
+			if (pass == 0)
+			{
+				outStartingAddress = lowAddress;
+				outData.assign(highAddress - lowAddress, inFillByte);
+			}
+		}
+		fclose(hexFile);
+	}
+	return(success);
+}
@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <vector>
 
 class IntelHex
 {
@@ -43,6 +44,17 @@ public:
 								bool					inOmitNullsWhenPossible,
 								uint32_t				inPageSize,
 								const char*				inPath);
+	/*
+	*	Decodes the Intel hex file at inPath into a contiguous image.
+	*	outStartingAddress is the lowest address in the file.  Any gaps
+	*	between records are set to inFillByte (0xFF for flash.)  Returns
+	*	false if the file can't be read or a record is malformed.
+	*/
+	static bool				LoadFromFile(
+								const char*				inPath,
+								uint8_t					inFillByte,
+								uint32_t&				outStartingAddress,
+								std::vector<uint8_t>&	outData);
 };
 
 #endif /* IntelHex_h */
@@ -50,6 +50,7 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic) uint32_t endAddress;
 @property (nonatomic) uint32_t memLength;
 @property (nonatomic) BOOL isRead;
+@property (nonatomic) BOOL isDump;	// Byte addresses, no value or view as fields
 
 - (void)showValueField;
 - (void)showViewDataAsField;
@@ -45,7 +45,10 @@
 	_memLength = (uint32_t)lengthTextField.integerValue;
 	[self updateAddressRange];
 	
-	if (_isRead)
+	if (_isDump)
+	{
+		// Neither field applies to a dump
+	} else if (_isRead)
 	{
 		[self showViewDataAsField];
 	} else
@@ -101,8 +104,10 @@
 /****************************** updateAddressRange ******************************/
 -(void)updateAddressRange
 {
+	// The SDK500 commands use word addresses, a dump uses byte addresses.
+	uint32_t	startingAddress = _isDump ? _startingAddress : _startingAddress*2;
 	addressRangeTextField.stringValue = [NSString stringWithFormat:@"%04X:%04X",
-						_startingAddress*2, (_startingAddress*2) + _memLength];
+						startingAddress, startingAddress + _memLength];
 }
 
 /******************************* showValueField *******************************/
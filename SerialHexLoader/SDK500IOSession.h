@@ -33,22 +33,41 @@
 #import "SerialPortIOSession.h"
 #include "stk500.h"
 
+@class SDK500Command;
+typedef void (^SDK500CompletionHandler)(SDK500Command* inCommand);
+
+/*
+*	An entry in the session's command queue.  Each entry carries everything
+*	needed to send the command and process its response, so any number of
+*	eeprom and flash regions can be written and read within one enter/leave
+*	prog mode cycle.
+*/
+@interface SDK500Command : NSObject
+@property (nonatomic) uint8_t		command;
+@property (nonatomic) uint8_t		memType;		// for read and prog page, 'E' or 'F'
+@property (nonatomic) uint16_t		address;		// word address for load, read and prog page
+@property (nonatomic) NSUInteger	length;			// data bytes in the response
+@property (nonatomic) BOOL			endOfRegion;	// last command of a prog or read region
+@property (nonatomic, strong) NSData* data;		// sent following the command
+@property (nonatomic, strong) NSMutableData* dataRead;	// read page appends to this
+@property (nonatomic, strong) NSData* expectedData;	// when set, read page compares with this instead
+@property (nonatomic) NSUInteger	expectedIndex;	// index within expectedData of the first byte read
+@property (nonatomic, copy) SDK500CompletionHandler completionHandler;	// called when the response is complete
+
++ (instancetype)command:(uint8_t)inCommand;
+@end
+
 @interface SDK500IOSession : SerialPortIOSession
 
-@property (nonatomic) NSUInteger	dataIndex;		// used by any command expecting data in the response
-@property (nonatomic) NSUInteger	bytesRequested;	// for read page
 @property (nonatomic) NSUInteger	bytesReceived;	// used by any command expecting data in the response
-@property (nonatomic) uint16_t		loadAddress;	// for load address
-@property (nonatomic) BOOL			compareToProg;	// compare read with written, fail if not same
-@property (nonatomic) uint8_t		memType;		// for read and prog page
-@property (nonatomic) uint8_t		command;
+@property (nonatomic) uint16_t		loadAddress;	// word address used by sdkProgPage and sdkReadPage
+@property (nonatomic) NSUInteger	blockSize;		// max bytes per prog page command
 @property (nonatomic) uint8_t		expectedResponse;
 @property (nonatomic) uint8_t		calibrationByte;
 @property (nonatomic) uint32_t		signature;
-@property (nonatomic, strong) NSMutableData*	commands;
+@property (nonatomic, strong) NSMutableArray<SDK500Command*>* commands;
 @property (nonatomic) NSUInteger	commandIndex;
-@property (nonatomic, strong) NSMutableData* dataRead;
-@property (nonatomic, strong) NSData* deviceData;	// SSDK500ParamBlk
+@property (nonatomic, strong) NSMutableData* dataRead;	// data read by the last sdkReadPage
 
 - (instancetype)init:(ORSSerialPort *)inPort;
 - (void)begin;
@@ -59,6 +78,15 @@
 - (void)sdkEnterProgMode;
 - (void)sdkProgPage:(NSData *)inData memType:(uint8_t)inMemType verify:(BOOL)inVerify;	// memType one of 'E' or 'F' for eeprom or Flash
 - (void)sdkReadPage:(NSMutableData *)inData memType:(uint8_t)inMemType length:(NSUInteger)inLength;
+/*
+*	The address of these is the word address of the region (as with
+*	sdkLoadAddress.)  inCompletionHandler is called once the region has been
+*	written (and verified) or read.
+*/
+- (void)sdkProgPage:(NSData *)inData address:(uint16_t)inAddress memType:(uint8_t)inMemType verify:(BOOL)inVerify completionHandler:(SDK500CompletionHandler)inCompletionHandler;
+- (void)sdkReadPage:(NSMutableData *)inData address:(uint16_t)inAddress memType:(uint8_t)inMemType length:(NSUInteger)inLength completionHandler:(SDK500CompletionHandler)inCompletionHandler;
+- (void)sdkChipErase;
+- (void)sdkProgFlash:(NSData *)inImage pageSize:(NSUInteger)inPageSize verify:(BOOL)inVerify;
 - (void)sdkLeaveProgMode;
 - (void)sdkReadSignature;
 - (void)sdkReadCalibration;
@@ -30,8 +30,6 @@
 #import <Cocoa/Cocoa.h>
 #import "SDK500IOSession.h"
 
-@implementation SDK500IOSession
-
 /*
 SerialHexViewController is a subclass of SerialViewController.
 SerialViewController has a member serialPortSession.
@@ -44,13 +42,17 @@ in the application's log window (formatted as data received).
 To keep a session going, sendData is called within didRecieveData, else
 didRecieveData will end the session by setting done to YES.
 
-All SDK500 commands are ASCII characters.  The command string is the list of
-commands to be executed in that order.  The command string is set by calling
-one or more sdkXXX functions.
+All SDK500 commands are ASCII characters.  The command queue is the list of
+commands to be executed in that order.  The queue is set by calling one or more
+sdkXXX functions.  Each entry in the queue is an SDK500Command that holds its
+own address, memory type, data and completion handler, so several eeprom and
+flash regions can be written and read between sdkEnterProgMode and
+sdkLeaveProgMode.
 
-If needed the command string could be changed to a command stack to accomodate
-stringing multiple writes or reads together.  This would probably only be needed
-if you don't want to (or can't) write or read the entire eeprom in one shot.
+Commands are pipelined: the commands that follow the one whose response is
+expected are sent without waiting for it, as many as fit in the ISP's receive
+buffer.  A STK_LOAD_ADDRESS and the STK_PROG_PAGE that follows it go out
+together, so programming a page costs one round trip rather than two.
 
 */
 
@@ -61,6 +63,42 @@ if you don't want to (or can't) write or read the entire eeprom in one shot.
 */
 #define SDK_MAX_BLOCK_SIZE 256
 
+/*
+*	The ArduinoISP doesn't implement STK_CHIP_ERASE.  Like avrdude, the chip
+*	erase is sent as the raw ISP Chip Erase instruction via STK_UNIVERSAL.
+*/
+static const uint8_t kChipEraseInstruction[] = {0xAC, 0x80, 0x00, 0x00};
+
+/*
+*	The ArduinoISP's serial receive buffer is 64 bytes.  Commands are sent
+*	ahead of their responses (see continueSession) as long as the bytes
+*	waiting in this buffer never exceed SDK_ISP_RX_BUFFER_SIZE.
+*/
+#define SDK_ISP_RX_BUFFER_SIZE		63
+#define SDK_MAX_COMMANDS_IN_FLIGHT	8
+
+@implementation SDK500Command
+
+/********************************** command ***********************************/
++ (instancetype)command:(uint8_t)inCommand
+{
+	SDK500Command*	command = [[SDK500Command alloc] init];
+	command.command = inCommand;
+	return(command);
+}
+
+@end
+
+@interface SDK500IOSession ()
+{
+	SDK500Command*	_current;	// the command whose response is expected
+	NSUInteger	_sendIndex;		// index of the next command to be sent
+	NSUInteger	_sentLength[SDK_MAX_COMMANDS_IN_FLIGHT];	// bytes sent per command in flight
+}
+@end
+
+@implementation SDK500IOSession
+
 /************************************ init ************************************/
 - (instancetype)init:(ORSSerialPort *)inPort
 {
@@ -69,8 +107,8 @@ if you don't want to (or can't) write or read the entire eeprom in one shot.
 	{
 		_loadAddress = 0;
 		_commandIndex = 0;
-		_commands = [NSMutableData dataWithCapacity:256];
-		_compareToProg = 0;
+		_commands = [NSMutableArray arrayWithCapacity:16];
+		_blockSize = SDK_MAX_BLOCK_SIZE;
 	}
 	return(self);
 }
@@ -79,92 +117,166 @@ if you don't want to (or can't) write or read the entire eeprom in one shot.
 - (void)begin
 {
 	[super begin];
-	self.dataIndex = 0;
 	self.commandIndex = 0;
-	[self continueSession];
+	_sendIndex = 0;
+	if (_commands.count)
+	{
+		[self beginCommand];
+		[self continueSession];
+	} else
+	{
+		self.done = YES;
+	}
+}
+
+/******************************** beginCommand ********************************/
+/*
+*	Called when the command at _commandIndex becomes the command whose
+*	response is expected next.
+*/
+- (void)beginCommand
+{
+	_current = _commands[_commandIndex];
+	_expectedResponse = STK_INSYNC;
+	_bytesReceived = 0;
+	switch(_current.command)
+	{
+		case STK_READ_SIGN:
+			_signature = 0;
+			break;
+		case STK_READ_OSCCAL:
+			_calibrationByte = 0;
+			break;
+	}
+}
+
+/******************************* commandLength ********************************/
+/*
+*	Returns the number of bytes sent for inCommand.
+*/
+- (NSUInteger)commandLength:(SDK500Command*)inCommand
+{
+	NSUInteger	length = 2 + inCommand.data.length;	// command, data, Sync_CRC_EOP
+	switch(inCommand.command)
+	{
+		case STK_LOAD_ADDRESS:
+			length += 2;
+			break;
+		case STK_PROG_PAGE:
+		case STK_READ_PAGE:
+			length += 3;
+			break;
+	}
+	return(length);
 }
 
 /****************************** continueSession *******************************/
+/*
+*	Sends as many of the commands that follow the last command sent as will
+*	fit in the ISP's receive buffer.  Commands are sent without waiting for
+*	the response to the previous command.  The responses are returned in
+*	the same order and are matched to the commands by _commandIndex.
+*
+*	Other than STK_LOAD_ADDRESS, the ISP may stop reading the serial port
+*	while it executes a command, e.g. while a page is being written or read.
+*	The bytes of every command sent after the first of these that hasn't
+*	been acknowledged wait in the ISP's receive buffer, so they must fit.
+*/
 - (void)continueSession
 {
 	if (!self.isDone)
 	{
-		NSMutableData*	dataToSend = [NSMutableData dataWithCapacity:256];
-		_command = ((uint8_t*)_commands.mutableBytes)[_commandIndex];
-		[dataToSend appendBytes:&_command length:1];
-		_expectedResponse = STK_INSYNC;
-		switch(_command)
+		NSMutableData*	dataToSend = [NSMutableData dataWithCapacity:512];
+		while (_sendIndex < _commands.count &&
+			(_sendIndex - _commandIndex) < SDK_MAX_COMMANDS_IN_FLIGHT)
 		{
-			case STK_SET_DEVICE:	// + device data, Sync_CRC_EOP
-				[dataToSend appendData:_deviceData];
-				break;
-			case STK_LOAD_ADDRESS: // + addr_low, addr_high, Sync_CRC_EOP
+			SDK500Command*	command = _commands[_sendIndex];
+			NSUInteger	bytesWaiting = 0;
+			BOOL		isWaiting = NO;
+			for (NSUInteger i = _commandIndex; i < _sendIndex; i++)
 			{
-				// loadAddress is a word address that is multiplied by 2 by
-				// the ISP.  This defines the address that STK_PROG_PAGE and
-				// STK_READ_PAGE write/read to/from.
-				uint16_t loadAddress = _loadAddress + (_dataIndex/2);
-				[dataToSend appendBytes:&loadAddress length:2];
-				break;
-			}
-			case STK_ENTER_PROGMODE:	// + Sync_CRC_EOP
-			case STK_LEAVE_PROGMODE:	// + Sync_CRC_EOP
-				break;
-			case STK_PROG_PAGE: // + bytes_high, bytes_low, memtype, data, Sync_CRC_EOP
-			{
-				NSUInteger	bytesToSend = self.data.length - _dataIndex;
-				if (bytesToSend > SDK_MAX_BLOCK_SIZE)
+				if (isWaiting)
 				{
-					bytesToSend = SDK_MAX_BLOCK_SIZE;
-				}
-				uint8_t	preamble[3];
-				preamble[0] = (bytesToSend >> 8);		// bytes_high
-				preamble[1] = (bytesToSend & 0xFF);		// bytes_low
-				preamble[2] = _memType;					// memtype
-				[dataToSend appendBytes:&preamble length:3];
-				[dataToSend appendBytes:&((const uint8_t*)self.data.bytes)[_dataIndex] length:bytesToSend];
-				_dataIndex += bytesToSend;
-				if (_dataIndex == self.data.length)
+					bytesWaiting += _sentLength[i % SDK_MAX_COMMANDS_IN_FLIGHT];
+				} else
 				{
-					_dataIndex = 0;
+					isWaiting = _commands[i].command != STK_LOAD_ADDRESS;
 				}
-				//fprintf(stderr, "bytesToSend = %ld\n", bytesToSend);
-				break;
 			}
-			case STK_READ_PAGE: // + bytes_high, bytes_low, memtype, Sync_CRC_EOP
-				{
-					if (_dataIndex == 0)
-					{
-						_dataRead = [NSMutableData dataWithCapacity:256];
-					}
-					NSUInteger	bytesRequested = _bytesRequested - _dataIndex;
-					if (bytesRequested > SDK_MAX_BLOCK_SIZE)
-					{
-						bytesRequested = SDK_MAX_BLOCK_SIZE;
-					}
-					uint8_t	preamble[3];
-					preamble[0] = (bytesRequested >> 8);		// bytes_high
-					preamble[1] = (bytesRequested & 0xFF);		// bytes_low
-					preamble[2] = _memType;					// memtype
-					[dataToSend appendBytes:&preamble length:3];
-					_bytesReceived = 0;
-					break;
-				}
-			case STK_READ_SIGN:	// + Sync_CRC_EOP
-				_signature = 0;
-				_bytesReceived = 0;
-				break;
-			case STK_READ_OSCCAL:
-				_calibrationByte = 0;
-				_bytesReceived = 0;
-				break;
-			default:
+			NSUInteger	commandLength = [self commandLength:command];
+			if (isWaiting &&
+				(bytesWaiting + commandLength) > SDK_ISP_RX_BUFFER_SIZE)
+			{
 				break;
+			}
+			_sentLength[_sendIndex % SDK_MAX_COMMANDS_IN_FLIGHT] = commandLength;
+			[self encodeCommand:command toData:dataToSend];
+			_sendIndex++;
+		}
+		if (dataToSend.length)
+		{
+			//fprintf(stderr, "len = %d\n", (int)dataToSend.length);
+			[self.serialPort sendData:dataToSend];
+		}
+	}
+}
+
+/******************************* encodeCommand ********************************/
+/*
+*	Appends inCommand and its parameters to ioData.
+*/
+- (void)encodeCommand:(SDK500Command*)inCommand toData:(NSMutableData*)ioData
+{
+	uint8_t	command = inCommand.command;
+	[ioData appendBytes:&command length:1];
+	switch(command)
+	{
+		case STK_LOAD_ADDRESS: // + addr_low, addr_high, Sync_CRC_EOP
+		{
+			// The address is a word address that is multiplied by 2 by
+			// the ISP.  This defines the address that STK_PROG_PAGE and
+			// STK_READ_PAGE write/read to/from.
+			uint16_t loadAddress = inCommand.address;
+			[ioData appendBytes:&loadAddress length:2];
+			break;
+		}
+		case STK_PROG_PAGE: // + bytes_high, bytes_low, memtype, data, Sync_CRC_EOP
+		case STK_READ_PAGE: // + bytes_high, bytes_low, memtype, Sync_CRC_EOP
+		{
+			NSUInteger	length = command == STK_PROG_PAGE ? inCommand.data.length : inCommand.length;
+			uint8_t	preamble[3];
+			preamble[0] = (length >> 8);			// bytes_high
+			preamble[1] = (length & 0xFF);			// bytes_low
+			preamble[2] = inCommand.memType;		// memtype
+			[ioData appendBytes:&preamble length:3];
+			break;
 		}
-		uint8_t	syncCRCEOP = CRC_EOP;
-		[dataToSend appendBytes:&syncCRCEOP length:1];
-		//fprintf(stderr, "len = %d\n", (int)dataToSend.length);
-		[self.serialPort sendData:dataToSend];
+	}
+	// STK_SET_DEVICE device data, STK_PROG_PAGE data, STK_UNIVERSAL bytes
+	if (inCommand.data)
+	{
+		[ioData appendData:inCommand.data];
+	}
+	uint8_t	syncCRCEOP = CRC_EOP;
+	[ioData appendBytes:&syncCRCEOP length:1];
+}
+
+/******************************* endCommand ***********************************/
+/*
+*	Called when the STK_OK of the current command has been received.
+*/
+- (void)endCommand
+{
+	// Each verify block is compared as it's received, see didReceiveData.
+	if (_current.expectedData &&
+		_current.endOfRegion)
+	{
+		[self.delegate logInfoString:@"Data verification successful"];
+	}
+	if (_current.completionHandler &&
+		!self.stoppedDueToError)
+	{
+		_current.completionHandler(_current);
 	}
 }
 
@@ -176,7 +288,11 @@ if you don't want to (or can't) write or read the entire eeprom in one shot.
 		//fprintf(stderr, "%.*s\n", (int)inData.length, inData.bytes);
 		const uint8_t*	receivedData = (const uint8_t*)inData.bytes;
 		NSUInteger	bytesToProcess = inData.length;
-		while (bytesToProcess)
+		/*
+		*	inData may contain any part of the responses to one or more of
+		*	the commands in flight.
+		*/
+		while (bytesToProcess && !self.isDone)
 		{
 			/*
 			*	If waiting for the in-sync response THEN
@@ -200,111 +316,105 @@ if you don't want to (or can't) write or read the entire eeprom in one shot.
 			}
 			if (_expectedResponse == STK_OK)
 			{
-				// Commands that return data are in this switch
-				// extract the data
-				switch (_command)
+				/*
+				*	Commands that return data are in this switch.  The data
+				*	may not be received in a single call to didReceiveData.
+				*	_bytesReceived tracks the total received for this command.
+				*/
+				if (_bytesReceived < _current.length)
 				{
-					case STK_READ_PAGE:
-						if (_dataIndex < _bytesRequested)
-						{
-							NSUInteger	bytesRead = _bytesRequested - _dataIndex;
+					NSUInteger	bytesRead = _current.length - _bytesReceived;
+					if (bytesRead > bytesToProcess)
+					{
+						bytesRead = bytesToProcess;
+					}
+					switch (_current.command)
+					{
+						case STK_READ_PAGE:
 							/*
-							*	The number of bytes requested in a read page command
-							*	can be no more than 256 bytes.  The results of the
-							*	command may not be received in a single call to
-							*	didReceiveData.  _bytesReceived tracks the total
-							*	recieved for this single command.  _dataIndex tracks
-							*	the total received for the _bytesRequested, which
-							*	may be divided amoung consecutive commands in chunks
-							*	no larger than 256 bytes.
+							*	A region read is divided among consecutive
+							*	commands in chunks no larger than 256 bytes,
+							*	each appending to the region's dataRead.  When
+							*	verifying, each chunk is instead compared with
+							*	its slice of the data written.  The session
+							*	stops at the first byte that doesn't match.
 							*/
-							if (bytesRead > (SDK_MAX_BLOCK_SIZE - _bytesReceived))
+							if (_current.expectedData)
 							{
-								bytesRead = SDK_MAX_BLOCK_SIZE - _bytesReceived;
-							}
-							
-							if (bytesRead > bytesToProcess)
-							{
-								bytesRead = bytesToProcess;
-							}
-							if (bytesRead)
-							{
-								[_dataRead appendBytes:receivedData length:bytesRead];
-								_dataIndex += bytesRead;
-								receivedData += bytesRead;
-								bytesToProcess -= bytesRead;
-								_bytesReceived += bytesRead;
-							}
-							if (_dataIndex == _bytesRequested)
-							{
-								if (_compareToProg)
+								const uint8_t*	expectedData = &((const uint8_t*)_current.expectedData.bytes)[_current.expectedIndex + _bytesReceived];
+								for (NSUInteger i = 0; i < bytesRead; i++)
 								{
-									if ([_dataRead isEqualToData:self.data])
+									if (receivedData[i] == expectedData[i])
 									{
-										[self.delegate logInfoString:@"Data verification successful"];
-									} else
-									{
-										[self.delegate logErrorString:@"Data verification failed"];
-										self.stoppedDueToError = YES;
+										continue;
 									}
+									[self.delegate logErrorString:[NSString stringWithFormat:
+										@"Data verification failed at address 0x%lX (read 0x%02hhX, expected 0x%02hhX)",
+											(unsigned long)_current.address*2 + _bytesReceived + i,
+												receivedData[i], expectedData[i]]];
+									self.stoppedDueToError = YES;
+									self.done = YES;
+									break;
 								}
+							} else
+							{
+								[_current.dataRead appendBytes:receivedData length:bytesRead];
 							}
-						}
-						break;
-					case STK_READ_SIGN: // Resp_STK_INSYNC, sign_high, sign_middle, sign_low, Resp_STK_OK
-					{
-						NSUInteger	bytesRead = 3 - _bytesReceived;
-						if (bytesRead > bytesToProcess)
-						{
-							bytesRead = bytesToProcess;
-						}
-						_bytesReceived += bytesRead;
-						bytesToProcess -= bytesRead;
-						for (; bytesRead; --bytesRead)
+							break;
+						case STK_READ_SIGN: // Resp_STK_INSYNC, sign_high, sign_middle, sign_low, Resp_STK_OK
 						{
-							_signature = (_signature << 8) + *(receivedData++);
+							for (NSUInteger i = 0; i < bytesRead; i++)
+							{
+								_signature = (_signature << 8) + receivedData[i];
+							}
+							if (_bytesReceived + bytesRead == 3)
+							{
+								[self.delegate logInfoString:[NSString stringWithFormat:@"Device signature = 0x%X", _signature]];
+							}
+							break;
 						}
-						if (_bytesReceived == 3)
+						case STK_READ_OSCCAL: // Resp_STK_INSYNC, OSCCAL, Resp_STK_OK
 						{
-							[self.delegate logInfoString:[NSString stringWithFormat:@"Device signature = 0x%X", _signature]];
+							_calibrationByte = *receivedData;
+							[self.delegate logInfoString:[NSString stringWithFormat:@"Calibration byte (OSCCAL) = 0x%hhX", _calibrationByte]];
+							break;
 						}
-						break;
+						// STK_UNIVERSAL: Resp_STK_INSYNC, result, Resp_STK_OK
+						// The result of the chip erase instruction isn't used.
 					}
-					case STK_READ_OSCCAL: // Resp_STK_INSYNC, OSCCAL, Resp_STK_OK
+					_bytesReceived += bytesRead;
+					receivedData += bytesRead;
+					bytesToProcess -= bytesRead;
+					if (self.isDone)
 					{
-						_calibrationByte = *(receivedData++);
-						_bytesReceived++;
-						bytesToProcess--;
-						[self.delegate logInfoString:[NSString stringWithFormat:@"Calibration byte (OSCCAL) = 0x%hhX", _calibrationByte]];
-						break;
+						bytesToProcess = 0;	// Verify failed, ignore the rest
 					}
+					continue;
 				}
 				/*
-				*	If there's still bytesToProcess THEN
-				*	the byte received must be STK_OK
+				*	The byte following the data must be STK_OK
 				*/
-				if (bytesToProcess == 1)
+				if (*receivedData == STK_OK)
 				{
-					if (*receivedData == STK_OK)
+					bytesToProcess--;
+					receivedData++;
+					[self endCommand];
+					_commandIndex++;
+					if (_commandIndex < _commands.count)
 					{
-						bytesToProcess = 0;
-						_expectedResponse = 0;	// command is done
-						receivedData++;
-						_commandIndex++;
-						if (_commandIndex < _commands.length)
-						{
-							[self continueSession];
-						} else
-						{
-							self.done = YES;
-						}
-					/*
-					*	Else, fail, the ISP is out of sync
-					*/
+						[self beginCommand];
+						[self continueSession];
 					} else
 					{
-						break; // Fail
+						_expectedResponse = 0;	// session is done
+						self.done = YES;
 					}
+				/*
+				*	Else, fail, the ISP is out of sync
+				*/
+				} else
+				{
+					break; // Fail
 				}
 			} else
 			{
@@ -334,16 +444,33 @@ if you don't want to (or can't) write or read the entire eeprom in one shot.
 }
 
 /******************************* appendCommand ********************************/
-- (void)appendCommand:(uint8_t)inCommand
+- (SDK500Command*)appendCommand:(uint8_t)inCommand
 {
-	[_commands appendBytes:&inCommand length:1];
+	SDK500Command*	command = [SDK500Command command:inCommand];
+	[_commands addObject:command];
+	return(command);
+}
+
+/***************************** appendProgPage *********************************/
+/*
+*	Appends a STK_LOAD_ADDRESS and STK_PROG_PAGE for the inLength bytes of
+*	inData starting at inIndex.
+*/
+- (SDK500Command*)appendProgPage:(NSData *)inData index:(NSUInteger)inIndex length:(NSUInteger)inLength address:(uint16_t)inAddress memType:(uint8_t)inMemType
+{
+	uint16_t	address = inAddress + (inIndex/2);
+	[self appendCommand:STK_LOAD_ADDRESS].address = address;
+	SDK500Command*	command = [self appendCommand:STK_PROG_PAGE];
+	command.address = address;
+	command.memType = inMemType;
+	command.data = [inData subdataWithRange:NSMakeRange(inIndex, inLength)];
+	return(command);
 }
 
 /******************************** sdkSetDevice ********************************/
 - (void)sdkSetDevice:(SSDK500ParamBlk *)inDeviceParamBlk
 {
-	[self appendCommand:STK_SET_DEVICE];
-	_deviceData = [NSData dataWithBytes:inDeviceParamBlk length:sizeof(SSDK500ParamBlk)];
+	[self appendCommand:STK_SET_DEVICE].data = [NSData dataWithBytes:inDeviceParamBlk length:sizeof(SSDK500ParamBlk)];
 }
 
 /******************************* sdkLoadAddress *******************************/
@@ -362,37 +489,159 @@ if you don't want to (or can't) write or read the entire eeprom in one shot.
 /******************************** sdkProgPage *********************************/
 - (void)sdkProgPage:(NSData *)inData memType:(uint8_t)inMemType verify:(BOOL)inVerify
 {
-	[self appendCommand:STK_LOAD_ADDRESS];
-	[self appendCommand:STK_PROG_PAGE];
-	self.data = inData;
-	_memType = inMemType;
+	[self sdkProgPage:inData address:_loadAddress memType:inMemType verify:inVerify completionHandler:nil];
+}
+
+/******************************** sdkProgPage *********************************/
+- (void)sdkProgPage:(NSData *)inData address:(uint16_t)inAddress memType:(uint8_t)inMemType verify:(BOOL)inVerify completionHandler:(SDK500CompletionHandler)inCompletionHandler
+{
+	SDK500Command*	command = nil;
 	NSUInteger	dataLength = inData.length;
-	NSUInteger	dataIndex = SDK_MAX_BLOCK_SIZE;
-	for (; dataIndex < dataLength; dataIndex += SDK_MAX_BLOCK_SIZE)
+	NSUInteger	dataIndex = 0;
+	for (; dataIndex < dataLength; dataIndex += _blockSize)
 	{
-		[self appendCommand:STK_LOAD_ADDRESS];
-		[self appendCommand:STK_PROG_PAGE];
+		NSUInteger	bytesToSend = dataLength - dataIndex;
+		if (bytesToSend > _blockSize)
+		{
+			bytesToSend = _blockSize;
+		}
+		command = [self appendProgPage:inData index:dataIndex length:bytesToSend address:inAddress memType:inMemType];
 	}
 	if (inVerify)
 	{
-		_compareToProg = YES;
-		[self sdkReadPage:nil memType:inMemType length:dataLength];
+		command = [self appendReadPage:nil address:inAddress memType:inMemType length:dataLength expectedData:inData];
 	}
+	command.endOfRegion = YES;
+	command.completionHandler = inCompletionHandler;
 }
 
 /******************************** sdkReadPage *********************************/
 - (void)sdkReadPage:(NSMutableData *)inData memType:(uint8_t)inMemType length:(NSUInteger)inLength
 {
-	[self appendCommand:STK_LOAD_ADDRESS];
-	[self appendCommand:STK_READ_PAGE];
-	_dataRead = inData;
-	_memType = inMemType;
-	_bytesRequested = inLength;
-	NSUInteger	dataIndex = SDK_MAX_BLOCK_SIZE;
+	[self sdkReadPage:inData address:_loadAddress memType:inMemType length:inLength completionHandler:nil];
+}
+
+/******************************** sdkReadPage *********************************/
+- (void)sdkReadPage:(NSMutableData *)inData address:(uint16_t)inAddress memType:(uint8_t)inMemType length:(NSUInteger)inLength completionHandler:(SDK500CompletionHandler)inCompletionHandler
+{
+	SDK500Command*	command = [self appendReadPage:inData address:inAddress memType:inMemType length:inLength expectedData:nil];
+	command.endOfRegion = YES;
+	command.completionHandler = inCompletionHandler;
+	_dataRead = command.dataRead;
+}
+
+/******************************* appendReadPage *******************************/
+/*
+*	Appends a STK_LOAD_ADDRESS and STK_READ_PAGE for each block of the region.
+*	All of the blocks append to the same dataRead.  If ioData is nil a new
+*	dataRead is allocated.  When inExpectedData is set the region is being
+*	verified, each block is compared with its part of inExpectedData and
+*	nothing is kept.  Returns the last STK_READ_PAGE.
+*/
+- (SDK500Command*)appendReadPage:(NSMutableData *)ioData address:(uint16_t)inAddress memType:(uint8_t)inMemType length:(NSUInteger)inLength expectedData:(NSData *)inExpectedData
+{
+	SDK500Command*	command = nil;
+	NSMutableData*	dataRead = nil;
+	if (!inExpectedData)
+	{
+		dataRead = ioData ? ioData : [NSMutableData dataWithCapacity:inLength];
+	}
+	NSUInteger	dataIndex = 0;
 	for (; dataIndex < inLength; dataIndex += SDK_MAX_BLOCK_SIZE)
 	{
-		[self appendCommand:STK_LOAD_ADDRESS];
-		[self appendCommand:STK_READ_PAGE];
+		NSUInteger	bytesRequested = inLength - dataIndex;
+		if (bytesRequested > SDK_MAX_BLOCK_SIZE)
+		{
+			bytesRequested = SDK_MAX_BLOCK_SIZE;
+		}
+		uint16_t	address = inAddress + (dataIndex/2);
+		[self appendCommand:STK_LOAD_ADDRESS].address = address;
+		command = [self appendCommand:STK_READ_PAGE];
+		command.address = address;
+		command.memType = inMemType;
+		command.length = bytesRequested;
+		if (inExpectedData)
+		{
+			command.expectedData = inExpectedData;
+			command.expectedIndex = dataIndex;
+		} else
+		{
+			command.dataRead = dataRead;
+		}
+	}
+	return(command);
+}
+
+/******************************** sdkChipErase ********************************/
+/*
+*	Erases the flash (and the eeprom unless the EESAVE fuse is programmed.)
+*	The ISP doesn't wait for the erase to complete, so prog mode is left and
+*	entered again as avrdude does.  Entering prog mode takes longer than the
+*	erase.
+*/
+- (void)sdkChipErase
+{
+	SDK500Command*	command = [self appendCommand:STK_UNIVERSAL];
+	command.data = [NSData dataWithBytes:kChipEraseInstruction length:sizeof(kChipEraseInstruction)];
+	command.length = 1;
+	[self appendCommand:STK_LEAVE_PROGMODE];
+	[self appendCommand:STK_ENTER_PROGMODE];
+}
+
+/***************************** NextPageToProgram ******************************/
+/*
+*	Returns the index of the first page at or after inIndex that isn't all
+*	0xFF, or the data length if there isn't one.  After a chip erase the blank
+*	pages don't need to be programmed.
+*/
+static NSUInteger NextPageToProgram(
+	NSData*		inData,
+	NSUInteger	inIndex,
+	NSUInteger	inPageSize)
+{
+	const uint8_t*	data = (const uint8_t*)inData.bytes;
+	NSUInteger	dataLength = inData.length;
+	for (; inIndex < dataLength; inIndex += inPageSize)
+	{
+		NSUInteger	endOfPage = inIndex + inPageSize;
+		if (endOfPage > dataLength)
+		{
+			endOfPage = dataLength;
+		}
+		for (NSUInteger i = inIndex; i < endOfPage; i++)
+		{
+			if (data[i] != 0xFF)
+			{
+				return(inIndex);
+			}
+		}
+	}
+	return(dataLength);
+}
+
+/******************************** sdkProgFlash ********************************/
+/*
+*	inImage starts at the page aligned address set by sdkLoadAddress.  Each
+*	STK_PROG_PAGE is one flash page, pages that are all 0xFF are skipped.
+*	inPageSize is the device's flash page size and must be the same as the
+*	pageSize passed to sdkSetDevice.  This should follow sdkChipErase.
+*/
+- (void)sdkProgFlash:(NSData *)inImage pageSize:(NSUInteger)inPageSize verify:(BOOL)inVerify
+{
+	NSUInteger	dataLength = inImage.length;
+	NSUInteger	dataIndex = NextPageToProgram(inImage, 0, inPageSize);
+	for (; dataIndex < dataLength; dataIndex = NextPageToProgram(inImage, dataIndex + inPageSize, inPageSize))
+	{
+		NSUInteger	bytesToSend = dataLength - dataIndex;
+		if (bytesToSend > inPageSize)
+		{
+			bytesToSend = inPageSize;
+		}
+		[self appendProgPage:inImage index:dataIndex length:bytesToSend address:_loadAddress memType:'F'];
+	}
+	if (inVerify)
+	{
+		[self appendReadPage:nil address:_loadAddress memType:'F' length:dataLength expectedData:inImage].endOfRegion = YES;
 	}
 }
 
@@ -405,13 +654,13 @@ if you don't want to (or can't) write or read the entire eeprom in one shot.
 /****************************** sdkReadSignature ******************************/
 - (void)sdkReadSignature
 {
-	[self appendCommand:STK_READ_SIGN];
+	[self appendCommand:STK_READ_SIGN].length = 3;
 }
 
 /***************************** sdkReadCalibration *****************************/
 - (void)sdkReadCalibration
 {
-	[self appendCommand:STK_READ_OSCCAL];
+	[self appendCommand:STK_READ_OSCCAL].length = 1;
 }
 
 /*************************** setStoppedDueToTimeout ***************************/
@@ -33,7 +33,12 @@
 
 @property (nonatomic) NSUInteger offset;
 @property (nonatomic) BOOL eraseBeforeWrite;
+@property (nonatomic) uint32_t startAddress;	// Range of the data being sent,
+@property (nonatomic) uint32_t endAddress;		// used to plan erasing and
+												// SD multiple block writes.
 @property (nonatomic) uint32_t currentAddress;
+@property (nonatomic) uint32_t rewindAddress;	// Address HexLoader asked to resend from
+@property (nonatomic) BOOL receivingRewind;		// Receiving the rewind address
 
 - (instancetype)initWithData:(NSData *)inData port:(ORSSerialPort *)inPort;
 - (void)begin;
@@ -48,8 +48,22 @@
 {
 	[super begin];
 	self.currentAddress = 0;
+	self.receivingRewind = NO;
+	NSMutableData*	commandData = [NSMutableData dataWithCapacity:24];
+	/*
+	*	Send the range of the data first so that HexLoader can erase only
+	*	what the data occupies, and so that an SD card can write the data as
+	*	a multiple block write.  The hex values are lowercase so that older
+	*	versions of HexLoader that don't support the range command will ignore
+	*	it ('E' is the chip erase command.)
+	*/
+	if (self.endAddress > self.startAddress)
+	{
+		[commandData appendData:[[NSString stringWithFormat:@"R%x,%x\n", self.startAddress, self.endAddress] dataUsingEncoding:NSASCIIStringEncoding]];
+	}
 	uint8_t command = self.eraseBeforeWrite ? 'H':'h';
-	[self.serialPort sendData:[NSData dataWithBytes:&command length:1]];
+	[commandData appendBytes:&command length:1];
+	[self.serialPort sendData:commandData];
 }
 
 /***************************** didReceiveData *********************************/
@@ -66,11 +80,39 @@
 			
 			for (NSUInteger i = 0; i < length && status >= 0; i++)
 			{
+				/*
+				*	HexLoader replies <address\n rather than * when it needs
+				*	the data resent starting at address (it had to erase a
+				*	sector containing blocks already written.)  The reply may
+				*	arrive split across more than one call.
+				*/
+				if (self.receivingRewind)
+				{
+					uint8_t	thisChar = recievedData[i];
+					if (thisChar == '\n')
+					{
+						self.receivingRewind = NO;
+						status = 2;
+					} else if (isxdigit(thisChar))
+					{
+						self.rewindAddress = (self.rewindAddress << 4) +
+							(thisChar <= '9' ? (thisChar - '0') : ((thisChar & 0xDF) - ('A' - 10)));
+					} else
+					{
+						status = -1;
+						self.done = YES;
+					}
+					continue;
+				}
 				switch (recievedData[i])
 				{
 					case '*':	// Process next line request
 						status = 1;
 						continue;
+					case '<':	// Rewind request
+						self.receivingRewind = YES;
+						self.rewindAddress = 0;
+						continue;
 					case '=':	// Ignore erase block successful char
 					case '+':	// Ignore debug char
 					case '-':	// Ignore debug char
@@ -82,6 +124,12 @@
 				}
 			}
 		}
+		if (status == 2)
+		{
+			inData = [NSData data];	// Don't need to see the rewind request
+			[self rewind];
+			status = 1;
+		}
 		if (status == 1)
 		{
 			if (inData.length == 1)
@@ -119,6 +167,46 @@
 	return(inData);
 }
 
+/********************************* rewind *************************************/
+/*
+*	Sets the offset to the first data line at or after rewindAddress.  Lines
+*	never span blocks so this is the first line of the block HexLoader needs
+*	resent.  The extended linear address records are tracked while searching.
+*	HexLoader derives the base address from the rewind address so the
+*	extended linear address record preceding the line doesn't need to be
+*	resent.
+*/
+- (void)rewind
+{
+	const uint8_t* bytesStart = (const uint8_t*)self.data.bytes;
+	const uint8_t* bytes = bytesStart;
+	const uint8_t* bytesEnd =  (const uint8_t*)self.data.bytes + self.data.length;
+	self.currentAddress = 0;
+	while (bytes < bytesEnd)
+	{
+		const uint8_t* lineStart = bytes;
+		for (; bytes < bytesEnd; bytes++)
+		{
+			if (*bytes != '\n')
+			{
+				continue;
+			}
+			bytes++;
+			break;
+		}
+		// processHexLine updates currentAddress for data and address records.
+		[self processHexLine:[NSData dataWithBytesNoCopy:(void*)lineStart length:bytes - lineStart freeWhenDone:NO]];
+		if (lineStart + 8 < bytesEnd &&
+			lineStart[7] == '0' && lineStart[8] == '0' &&	// Data record
+			self.currentAddress >= self.rewindAddress)
+		{
+			_offset = lineStart - bytesStart;
+			return;
+		}
+	}
+	_offset = self.data.length;
+}
+
 /***************************** processHexLine *********************************/
 /*
 *	Used to update a progress bar by extracting the current address of the line
@@ -54,6 +54,7 @@ NS_ASSUME_NONNULL_BEGIN
 -(BOOL)assignBinaryURL:(NSURL*)inBinaryURL;
 - (BOOL)doExport:(NSURL*)inDocURL;
 - (void)sendHexFile:(NSURL*)inDocURL;
+- (void)dumpDeviceFrom:(uint32_t)inStartAddress length:(uint32_t)inLength to:(NSURL*)inDocURL;
 - (void)beginSerialPortIOSession:(SerialPortIOSession*)inSerialPortIOSession clearLog:(BOOL)inClearLog;
 @end
 
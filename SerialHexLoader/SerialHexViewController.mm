@@ -30,6 +30,7 @@
 
 #import "SerialHexViewController.h"
 #import "SendHexIOSession.h"
+#import "DumpIOSession.h"
 
 #include "IntelHex.h"
 
@@ -160,10 +161,58 @@ NSString *const kPageSizeKey = @"pageSize";
 
 		SendHexIOSession* sendHexIOSession = [[SendHexIOSession alloc] initWithData:dataToSend port:self.serialPort];
 		sendHexIOSession.eraseBeforeWrite = self.eraseBeforeWrite;
+		sendHexIOSession.startAddress = _startingAddress;
+		sendHexIOSession.endAddress = _startingAddress + (uint32_t)_binaryFileLength;
 		[super beginSerialPortIOSession:sendHexIOSession clearLog:YES];
 	}
 }
 
+/****************************** dumpDeviceFrom ********************************/
+/*
+*	Dumps a range of the device to inDocURL.  When inDocURL is a hex file the
+*	dump is saved to a temporary binary file then exported as Intel Hex.
+*/
+- (void)dumpDeviceFrom:(uint32_t)inStartAddress length:(uint32_t)inLength to:(NSURL*)inDocURL
+{
+	if ([self portIsOpen:YES])
+	{
+		self.progressMin = inStartAddress;
+		self.progressMax = inStartAddress + inLength;
+		self.progressValue = inStartAddress;
+
+		DumpIOSession* dumpIOSession = [[DumpIOSession alloc] initWithRange:inStartAddress end:inStartAddress + inLength port:self.serialPort];
+		dumpIOSession.timeout = 2;	// Timeout after n seconds if no data received
+		dumpIOSession.beginMsg = [NSString stringWithFormat:@"Dumping 0x%X bytes starting at 0x%X", inLength, inStartAddress];
+		dumpIOSession.completionBlock = ^(SerialPortIOSession* ioSession)
+		{
+			DumpIOSession*	dumpSession = (DumpIOSession*)ioSession;
+			BOOL	toHex = [inDocURL.pathExtension caseInsensitiveCompare:@"hex"] == NSOrderedSame;
+			NSURL*	binaryURL = toHex ? [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"SerialHexLoaderDump.bin"] isDirectory:NO] : inDocURL;
+			BOOL	success = [dumpSession.dumpData writeToURL:binaryURL atomically:YES];
+			if (success &&
+				toHex)
+			{
+				NSNumber* omitNullsWhenPossible = [[NSUserDefaults standardUserDefaults] objectForKey:kOmitNullsWhenPossibleKey];
+				NSNumber* pageSize = [[NSUserDefaults standardUserDefaults] objectForKey:kPageSizeKey];
+				success = IntelHex::SaveToFile(binaryURL.path.UTF8String,
+									dumpSession.startAddress,
+									omitNullsWhenPossible.boolValue,
+									pageSize.unsignedIntValue,
+									inDocURL.path.UTF8String);
+				[[NSFileManager defaultManager] removeItemAtURL:binaryURL error:NULL];
+			}
+			if (success)
+			{
+				[self postInfoString:[NSString stringWithFormat:@"Dumped 0x%X bytes to %@ (%lu ranges read again)",
+					(uint32_t)dumpSession.dumpData.length, inDocURL.path, (unsigned long)dumpSession.requests]];
+			} else
+			{
+				[self postErrorString:[NSString stringWithFormat:@"Write failed: %@", inDocURL.path]];
+			}
+		};
+		[super beginSerialPortIOSession:dumpIOSession clearLog:YES];
+	}
+}
 
 /************************** beginSerialPortIOSession **************************/
 - (void)beginSerialPortIOSession:(SerialPortIOSession*)inSerialPortIOSession clearLog:(BOOL)inClearLog
@@ -37,6 +37,7 @@ NS_ASSUME_NONNULL_BEGIN
 	IBOutlet NSView *serialView;
 }
 - (IBAction)exportBinary:(id)sender;
+- (IBAction)dumpDevice:(id)sender;
 - (IBAction)setTimeCommand:(id)sender;
 - (IBAction)setNodeIDCommand:(id)sender;
 - (IBAction)getWatchdogResetCountCommand:(id)sender;
@@ -44,6 +45,7 @@ NS_ASSUME_NONNULL_BEGIN
 - (IBAction)readCalibrationCommand:(id)sender;
 - (IBAction)readEEPROMRangeCommand:(id)sender;
 - (IBAction)writeEEPROMRangeCommand:(id)sender;
+- (IBAction)programFlashCommand:(id)sender;
 - (IBAction)sendStaticStringByTag:(id)sender;
 - (IBAction)setATTimeCommand:(id)sender;
 - (IBAction)sendSelection:(id)sender;
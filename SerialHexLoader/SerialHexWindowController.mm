@@ -33,6 +33,7 @@
 #import "MemoryHelperWindowController.h"
 #import "SDK500IOSession.h"
 #include "Base64Str.h"
+#include "IntelHex.h"
 
 
 @interface SerialHexWindowController ()
@@ -52,6 +53,7 @@ NSString *const kStartingMemAddressKey = @"startingMemAddress";
 NSString *const kMemLengthKey = @"memLength";
 NSString *const kMemValueKey = @"memValue";
 NSString *const kViewDataAs = @"viewDataAs";
+NSString *const kFlashPageSizeKey = @"flashPageSize";
 
 struct SMenuItemDesc
 {
@@ -67,6 +69,7 @@ SMenuItemDesc	menuItems[] =
 {
 	{1,10, @selector(open:)},
 	{1,15, @selector(exportBinary:)},
+	{1,16, @selector(dumpDevice:)},
 	{3,1, @selector(setTimeCommand:)},
 	{3,2, nil},	// SDK500 commands submenu
 		{0,1, @selector(setNodeIDCommand:)},
@@ -75,6 +78,7 @@ SMenuItemDesc	menuItems[] =
 		{0,4, @selector(readCalibrationCommand:)},
 		{0,5, @selector(readEEPROMRangeCommand:)},
 		{0,6, @selector(writeEEPROMRangeCommand:)},
+		{0,7, @selector(programFlashCommand:)},
 	/*
 	*	I thought about dynamically building the AT commands menu but I
 	*	couldn't come up with a property list format that's easy to use.
@@ -340,6 +344,47 @@ SMenuItemDesc	menuItems[] =
 	}
 }
 
+/********************************* dumpDevice *********************************/
+/*
+*	Dumps a range of the device connected to HexLoader to a binary or hex file
+*	(depending on the extension chosen.)
+*/
+- (IBAction)dumpDevice:(id)sender
+{
+	if ([self.serialHexViewController portIsOpen:YES])
+	{
+		MemoryHelperWindowController* memoryHelpersWindowController = [[MemoryHelperWindowController alloc] initWithWindowNibName:@"MemoryHelperWindowController"];
+		memoryHelpersWindowController.isDump = YES;
+		NSModalResponse	response = [[NSApplication sharedApplication] runModalForWindow:memoryHelpersWindowController.window];
+		[memoryHelpersWindowController.window close];
+		if (response == NSModalResponseOK)
+		{
+			uint32_t	startingMemAddress = (uint32_t)[[NSUserDefaults standardUserDefaults] integerForKey:kStartingMemAddressKey];
+			uint32_t	memLength = (uint32_t)[[NSUserDefaults standardUserDefaults] integerForKey:kMemLengthKey];
+			if (memLength == 0)
+			{
+				[self.serialHexViewController postErrorString:@"Memory length must not be zero."];
+				return;
+			}
+			_savePanel = [NSSavePanel savePanel];
+			if (_savePanel)
+			{
+				_savePanel.allowedFileTypes = @[@"bin", @"hex"];
+				_savePanel.nameFieldStringValue = @"Dump";
+				[_savePanel beginSheetModalForWindow:self.window completionHandler:^(NSInteger result)
+				{
+					if (result == NSModalResponseOK &&
+						self.savePanel.URL)
+					{
+						[self.savePanel orderOut:nil];
+						[self->_serialHexViewController dumpDeviceFrom:startingMemAddress length:memLength to:self.savePanel.URL];
+					}
+				}];
+			}
+		}
+	}
+}
+
 /********************************** sendHex ***********************************/
 - (IBAction)sendHex:(id)sender
 {
@@ -727,6 +772,110 @@ SMenuItemDesc	menuItems[] =
 	}
 }
 
+/**************************** programFlashCommand *****************************/
+- (IBAction)programFlashCommand:(id)sender
+{
+	if ([self.serialHexViewController portIsOpen:YES])
+	{
+		NSOpenPanel*	openPanel = [NSOpenPanel openPanel];
+		if (openPanel)
+		{
+			[openPanel setCanChooseDirectories:NO];
+			[openPanel setCanChooseFiles:YES];
+			[openPanel setAllowsMultipleSelection:NO];
+			openPanel.allowedFileTypes = @[@"hex", @"bin"];
+			[openPanel beginSheetModalForWindow:self.window completionHandler:^(NSInteger result)
+			{
+				if (result == NSModalResponseOK &&
+					openPanel.URLs.count == 1)
+				{
+					[self programFlash:openPanel.URLs[0]];
+				}
+			}];
+		}
+	}
+}
+
+/******************************** programFlash ********************************/
+/*
+*	Erases the chip, then programs the application flash with the image in
+*	inImageURL, one flash page per STK_PROG_PAGE, skipping pages that are all
+*	0xFF, then verifies it.  A .hex file is programmed at the addresses in the
+*	file, anything else is treated as a binary image starting at address 0.
+*	The flash page size is the flashPageSize default (128 for the ATmega328P.)
+*/
+- (void)programFlash:(NSURL*)inImageURL
+{
+	NSUInteger	pageSize = [[NSUserDefaults standardUserDefaults] integerForKey:kFlashPageSizeKey];
+	if (pageSize < 2 ||
+		pageSize > 256 ||
+		(pageSize & (pageSize-1)) != 0)
+	{
+		[self.serialHexViewController postErrorString:@"The flash page size must be a power of 2 from 2 to 256 bytes."];
+		return;
+	}
+	uint32_t		startAddress = 0;
+	NSMutableData*	image = nil;
+	if ([inImageURL.pathExtension caseInsensitiveCompare:@"hex"] == NSOrderedSame)
+	{
+		std::vector<uint8_t>	hexData;
+		if (IntelHex::LoadFromFile(inImageURL.path.UTF8String, 0xFF, startAddress, hexData))
+		{
+			image = [NSMutableData dataWithBytes:hexData.data() length:hexData.size()];
+		}
+	} else
+	{
+		image = [NSMutableData dataWithContentsOfURL:inImageURL];
+	}
+	if (image.length == 0)
+	{
+		[self.serialHexViewController postErrorString:[NSString stringWithFormat:@"Unable to load %@.", inImageURL.lastPathComponent]];
+		return;
+	}
+	/*
+	*	The image is padded with 0xFF to whole pages so that every
+	*	STK_PROG_PAGE starts on a page boundary and is a whole page.
+	*/
+	uint32_t	bytesInPage = startAddress % pageSize;
+	if (bytesInPage)
+	{
+		NSMutableData*	paddedImage = [NSMutableData dataWithLength:bytesInPage];
+		memset(paddedImage.mutableBytes, 0xFF, bytesInPage);
+		[paddedImage appendData:image];
+		image = paddedImage;
+		startAddress -= bytesInPage;
+	}
+	NSUInteger	imageLength = image.length;
+	NSUInteger	partialPage = imageLength % pageSize;
+	if (partialPage)
+	{
+		image.length = imageLength + pageSize - partialPage;
+		memset(&((uint8_t*)image.mutableBytes)[imageLength], 0xFF, pageSize - partialPage);
+	}
+	// STK_LOAD_ADDRESS takes a 16 bit word address.
+	if (startAddress + image.length > 0x20000)
+	{
+		[self.serialHexViewController postErrorString:@"Flash beyond 128KB isn't supported."];
+		return;
+	}
+	SDK500IOSession* sdk500IOSession = [[SDK500IOSession alloc] init:self.serialHexViewController.serialPort];
+	sdk500IOSession.timeout = 2;	// Timeout after n seconds if no response from ISP
+	SSDK500ParamBlk	devParamBlk = {0};
+	devParamBlk.pageSize = Endian16_Swap(pageSize);	// The ISP commits the flash page buffer at page boundaries.
+	devParamBlk.eepromSize = Endian16_Swap(512);
+	devParamBlk.flashSize = Endian32_Swap((uint32_t)(startAddress + image.length));
+	[sdk500IOSession sdkSetDevice:&devParamBlk];
+	[sdk500IOSession sdkLoadAddress:startAddress/2];
+	[sdk500IOSession sdkEnterProgMode];
+	[sdk500IOSession sdkReadSignature];
+	[sdk500IOSession sdkChipErase];
+	[sdk500IOSession sdkProgFlash:image pageSize:pageSize verify:YES];
+	[sdk500IOSession sdkLeaveProgMode];
+	sdk500IOSession.beginMsg = [NSString stringWithFormat:@"Programming flash with %@", inImageURL.lastPathComponent];
+	sdk500IOSession.completedMsg = [NSString stringWithFormat:@"0x%lX flash bytes programmed starting at address 0x%X (verified).", image.length, startAddress];
+	[self.serialHexViewController beginSerialPortIOSession:sdk500IOSession clearLog:NO];
+}
+
 /************************ getWatchdogResetCountCommand ************************/
 - (IBAction)getWatchdogResetCountCommand:(id)sender
 {
@@ -0,0 +1,55 @@
+/* STK500 version 2 constants list, from Atmel App Note AVR068
+ *
+ * Only the commands and status codes used with ISP programming are listed.
+ */
+#ifndef sdk500v2_h
+#define sdk500v2_h
+
+// Message framing
+#define MESSAGE_START                       0x1B
+#define TOKEN                               0x0E
+#define MESSAGE_MAX_BODY_SIZE               275
+
+// General commands
+#define CMD_SIGN_ON                         0x01
+#define CMD_SET_PARAMETER                   0x02
+#define CMD_GET_PARAMETER                   0x03
+#define CMD_LOAD_ADDRESS                    0x06
+
+// ISP commands
+#define CMD_ENTER_PROGMODE_ISP              0x10
+#define CMD_LEAVE_PROGMODE_ISP              0x11
+#define CMD_CHIP_ERASE_ISP                  0x12
+#define CMD_PROGRAM_FLASH_ISP               0x13
+#define CMD_READ_FLASH_ISP                  0x14
+#define CMD_PROGRAM_EEPROM_ISP              0x15
+#define CMD_READ_EEPROM_ISP                 0x16
+#define CMD_PROGRAM_FUSE_ISP                0x17
+#define CMD_READ_FUSE_ISP                   0x18
+#define CMD_PROGRAM_LOCK_ISP                0x19
+#define CMD_READ_LOCK_ISP                   0x1A
+#define CMD_READ_SIGNATURE_ISP              0x1B
+#define CMD_READ_OSCCAL_ISP                 0x1C
+#define CMD_SPI_MULTI                       0x1D
+
+// Status codes
+#define STATUS_CMD_OK                       0x00
+#define STATUS_CMD_TOUT                     0x80
+#define STATUS_RDY_BSY_TOUT                 0x81
+#define STATUS_SET_PARAM_MISSING            0x82
+#define STATUS_CMD_FAILED                   0xC0
+#define STATUS_CKSUM_ERROR                  0xC1
+#define STATUS_CMD_UNKNOWN                  0xC9
+#define ANSWER_CKSUM_ERROR                  0xB0
+
+// CMD_PROGRAM_FLASH_ISP and CMD_PROGRAM_EEPROM_ISP mode byte
+#define MODE_PAGE                           0x01  // else word (byte) mode
+#define MODE_WORD_TIMED                     0x02
+#define MODE_WORD_VALUE_POLLING             0x04
+#define MODE_WORD_RDY_BSY_POLLING           0x08
+#define MODE_PAGE_TIMED                     0x10
+#define MODE_PAGE_VALUE_POLLING             0x20
+#define MODE_PAGE_RDY_BSY_POLLING           0x40
+#define MODE_WRITE_PAGE                     0x80
+
+#endif // sdk500v2_h
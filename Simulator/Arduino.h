@@ -0,0 +1,148 @@
+/*
+*	Arduino.h, Copyright Jonathan Mackey 2019
+*	Minimal stand-in for the Arduino core used to build the HexLoader sketch
+*	and its libraries as a Linux program (see HexLoaderSim.cpp.)
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(inAddr)	(*(const uint8_t*)(inAddr))
+
+#define LOW		0
+#define HIGH	1
+#define INPUT	0
+#define OUTPUT	1
+
+#define DEC		10
+#define HEX		16
+
+uint32_t	millis(void);
+uint32_t	micros(void);
+void		delay(
+				uint32_t				inMilliseconds);
+void		delayMicroseconds(
+				uint32_t				inMicroseconds);
+void		pinMode(
+				uint8_t					inPin,
+				uint8_t					inMode);
+void		digitalWrite(
+				uint8_t					inPin,
+				uint8_t					inValue);
+
+class SimHost;
+
+/*
+*	The serial port is the master side of a pseudo-terminal.  The host
+*	application opens the slave side as if it were the board's serial port.
+*	When benchmarking, the serial port is connected to the simulated host
+*	instead (see SimHost.)
+*/
+class SimSerial
+{
+public:
+							SimSerial(void);
+	void					begin(
+								uint32_t				inBaudRate);
+	int						available(void);
+	int						read(void);
+	int						peek(void);
+	size_t					write(
+								uint8_t					inByte);
+	size_t					write(
+								const uint8_t*			inData,
+								size_t					inLength);
+	size_t					print(
+								const char*				inString);
+	size_t					print(
+								char					inChar);
+	size_t					print(
+								int						inValue,
+								int						inBase = DEC)
+								{return(PrintNumber(inValue, inBase));}
+	size_t					print(
+								unsigned int			inValue,
+								int						inBase = DEC)
+								{return(PrintNumber(inValue, inBase));}
+	size_t					print(
+								long					inValue,
+								int						inBase = DEC)
+								{return(PrintNumber(inValue, inBase));}
+	size_t					print(
+								unsigned long			inValue,
+								int						inBase = DEC)
+								{return(PrintNumber(inValue, inBase));}
+	size_t					println(void)
+								{return(print("\r\n"));}
+	template <class T> size_t println(
+								T						inValue)
+								{return(print(inValue) + println());}
+	template <class T> size_t println(
+								T						inValue,
+								int						inBase)
+								{return(print(inValue, inBase) + println());}
+	void					flush(void);
+							operator bool(void)
+								{return(true);}
+	// Simulator only
+	void					SetFD(
+								int						inFD)
+								{mFD = inFD;}
+	void					SetHost(
+								SimHost*				inHost)
+								{mHost = inHost;}
+	uint32_t				GetBaudRate(void) const
+								{return(mBaudRate);}
+protected:
+	SimHost*	mHost;
+	int			mFD;
+	uint32_t	mBaudRate;
+	uint8_t		mRxBuffer[64];	// Same size as the AVR core's buffer
+	uint16_t	mRxHead;
+	uint16_t	mRxTail;
+
+	size_t					PrintNumber(
+								long long				inValue,
+								int						inBase);
+	bool					FillRxBuffer(
+								int						inTimeout);
+};
+
+extern SimSerial	Serial;
+
+// Simulator only
+extern volatile int	simQuit;	// Set when the simulator should exit
+void		SimExit(void);
+/*
+*	The simulator's clock in nanoseconds.  When simRealTime is set the clock
+*	is the real elapsed time, otherwise it's simulated: it only moves when
+*	SimAdvance is called by the bus and device models.
+*/
+extern bool	simRealTime;
+uint64_t	SimNow(void);
+void		SimAdvance(
+				uint64_t				inNanoseconds);
+
+#endif // Arduino_h
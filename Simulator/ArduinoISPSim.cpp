@@ -0,0 +1,1199 @@
+/*
+*	ArduinoISPSim.cpp, Copyright Jonathan Mackey 2019
+*	Emulates an Arduino running ArduinoISP, the STK500 version 1 programmer,
+*	or with -2 an STK500 version 2 programmer, and the AVR it programs.
+*	The target's flash, eeprom, signature and
+*	OSCCAL are in memory.  The programmer's serial port is a
+*	pseudo-terminal, so STK500Tool or avrdude talk to it exactly as they
+*	would to a board.
+*
+*	Build from the repository root:
+*
+*	g++ -std=c++11 -O2 -ISerialHexLoader Simulator/ArduinoISPSim.cpp \
+*		-o ArduinoISPSim
+*
+*	Usage: ArduinoISPSim [-p link] [-i image] [-o image] [-F KB] [-E bytes]
+*			[-s signature] [-c osccal] [-B baud] [-r bytes] [-w ms] [-e ms] [-u]
+*			[-2 [-K answer] [-S answer]]
+*	-p link		make a symbolic link to the pty, e.g. /tmp/ArduinoISP
+*	-i image	load the flash from the binary image file before starting
+*	-o image	save the flash to the image file on exit (SIGINT or SIGTERM)
+*	-F KB		flash size (default 32, the ATmega328P's)
+*	-E bytes	eeprom size (default 1024)
+*	-s sig		signature (default 0x1E950F, the ATmega328P's)
+*	-c osccal	OSCCAL calibration byte (default 0x9A)
+*	-B baud		serial baud rate (default 19200, ArduinoISP's.)  Each byte
+*				takes 10 bit times to arrive.  0 for no byte timing.
+*	-r bytes	serial receive buffer size (default 64, the Arduino core's)
+*	-w ms		time to load and write a flash page (default 5)
+*	-e ms		time to write an eeprom byte (default 45, ArduinoISP's delay,
+*				or 3.6 with -2, the ATmega328P's)
+*	-u			read eeprom data 32 bytes at a time as the shipping ArduinoISP
+*				does (see "ArduinoISP eeprom bug.md" under Arduino/)
+*	-2			speak STK500 version 2 rather than ArduinoISP's version 1
+*	-K answer	send the nth version 2 answer (counting from 1) with a bad
+*				checksum
+*	-S answer	send the nth version 2 answer with the wrong sequence number
+*
+*	As on the Arduino, bytes that arrive while the receive buffer is full are
+*	lost.  A host that sends ahead of the responses more than the buffer
+*	holds while the programmer is busy gets out of sync, and the number of
+*	bytes lost is reported.  When prog mode is left a summary of the session
+*	is printed: elapsed time, time busy writing, pages and bytes, and lost
+*	bytes.
+*
+*	Version 2 messages are framed and checked as by the STK500's firmware.
+*	Flash is written a page per CMD_PROGRAM_FLASH_ISP and eeprom a byte at a
+*	time, each write completing before the answer is sent.  Flash beyond
+*	128KB is only reached when the loaded address has bit 31 set (the
+*	programmer then loads the target's extended address byte), otherwise the
+*	address wraps as it would on the target.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <vector>
+#include "stk500.h"
+#include "stk500v2.h"
+
+#define STK_SIGN_ON_MESSAGE	"AVR ISP"
+#define V2_SIGN_ON_MESSAGE	"STK500_2"
+#define EECHUNK				32
+
+static volatile int	sQuit;	// Set when the simulator should exit
+static void			SimExit(void);
+
+/*
+*	The programmer's serial port.  Bytes written by the host arrive one
+*	every byte time, into a receive buffer the size of the Arduino core's.
+*	The arrival is updated whenever the programmer reads or is busy, so bytes
+*	that arrive while it's busy fill the buffer and overflow as they would
+*	on the Arduino.
+*/
+class SimISPSerial
+{
+public:
+							SimISPSerial(void)
+								: mFD(-1), mByteTime(0), mRxBufferSize(64),
+								  mLastArrival(0), mBytesLost(0){}
+	void					Begin(
+								int						inFD,
+								uint32_t				inBaudRate,
+								uint32_t				inRxBufferSize);
+	uint8_t					Read(void);
+	void					Write(
+								const uint8_t*			inData,
+								uint32_t				inLength);
+	void					Write(
+								uint8_t					inByte)
+								{Write(&inByte, 1);}
+	/*
+	*	The programmer is busy for inNanoseconds, it doesn't read the serial
+	*	port.
+	*/
+	void					Busy(
+								uint64_t				inNanoseconds);
+	uint32_t				GetBytesLost(void) const
+								{return(mBytesLost);}
+	void					ResetBytesLost(void)
+								{mBytesLost = 0;}
+	static uint64_t			Now(void);
+protected:
+	struct SArrival
+	{
+		uint64_t	time;
+		uint8_t		byte;
+	};
+	int						mFD;
+	uint64_t				mByteTime;	// nanoseconds
+	uint32_t				mRxBufferSize;
+	uint64_t				mLastArrival;
+	uint32_t				mBytesLost;
+	std::deque<SArrival>	mInTransit;	// written by the host, not yet arrived
+	std::deque<uint8_t>		mRxBuffer;
+
+	void					Pump(
+								int						inTimeout);
+	void					Arrive(
+								uint64_t				inNow);
+};
+
+/************************************ Now *************************************/
+uint64_t SimISPSerial::Now(void)
+{
+	struct timespec	now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return(((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec);
+}
+
+/*********************************** Begin ************************************/
+void SimISPSerial::Begin(
+	int			inFD,
+	uint32_t	inBaudRate,
+	uint32_t	inRxBufferSize)
+{
+	mFD = inFD;
+	mByteTime = inBaudRate ? (10 * 1000000000ULL) / inBaudRate : 0;
+	mRxBufferSize = inRxBufferSize;
+}
+
+/************************************ Pump ************************************/
+/*
+*	Reads whatever the host has written, waiting up to inTimeout milliseconds
+*	for it.  Each byte is timestamped with when it arrives at the UART.
+*/
+void SimISPSerial::Pump(
+	int	inTimeout)
+{
+	if (sQuit)
+	{
+		SimExit();
+	}
+	struct pollfd	pollFD = {mFD, POLLIN, 0};
+	if (poll(&pollFD, 1, inTimeout) > 0)
+	{
+		uint8_t	buffer[512];
+		ssize_t	bytesRead = read(mFD, buffer, sizeof(buffer));
+		if (bytesRead > 0)
+		{
+			uint64_t	now = Now();
+			if (mLastArrival < now)
+			{
+				mLastArrival = now;
+			}
+			for (ssize_t i = 0; i < bytesRead; i++)
+			{
+				mLastArrival += mByteTime;
+				SArrival	arrival = {mLastArrival, buffer[i]};
+				mInTransit.push_back(arrival);
+			}
+		}
+	}
+}
+
+/*********************************** Arrive ***********************************/
+/*
+*	Moves the bytes that have arrived by inNow to the receive buffer.  As with
+*	the Arduino core, the buffer holds one less than its size, and a byte that
+*	arrives when it's full is lost.
+*/
+void SimISPSerial::Arrive(
+	uint64_t	inNow)
+{
+	while (!mInTransit.empty() &&
+		mInTransit.front().time <= inNow)
+	{
+		if (mRxBuffer.size() < mRxBufferSize - 1)
+		{
+			mRxBuffer.push_back(mInTransit.front().byte);
+		} else
+		{
+			mBytesLost++;
+		}
+		mInTransit.pop_front();
+	}
+}
+
+/************************************ Read ************************************/
+/*
+*	Bytes only wait in the receive buffer when they arrive while the
+*	programmer is busy.  When it's reading, each byte is taken as it arrives.
+*/
+uint8_t SimISPSerial::Read(void)
+{
+	uint8_t	byte;
+	for (;;)
+	{
+		if (!mRxBuffer.empty())
+		{
+			byte = mRxBuffer.front();
+			mRxBuffer.pop_front();
+			break;
+		}
+		Pump(0);
+		if (!mInTransit.empty())
+		{
+			uint64_t	now = Now();
+			uint64_t	arrival = mInTransit.front().time;
+			if (arrival > now)
+			{
+				struct timespec	delay = {0, (long)(arrival - now)};
+				nanosleep(&delay, NULL);
+			}
+			byte = mInTransit.front().byte;
+			mInTransit.pop_front();
+			break;
+		}
+		Pump(-1);
+	}
+	return(byte);
+}
+
+/************************************ Busy ************************************/
+void SimISPSerial::Busy(
+	uint64_t	inNanoseconds)
+{
+	uint64_t	end = Now() + inNanoseconds;
+	for (;;)
+	{
+		uint64_t	now = Now();
+		Arrive(now);
+		if (now >= end)
+		{
+			break;
+		}
+		uint64_t	remaining = end - now;
+		Pump(remaining > 1000000 ? 1 : 0);
+		if (remaining < 1000000)
+		{
+			struct timespec	delay = {0, (long)remaining};
+			nanosleep(&delay, NULL);
+		}
+	}
+}
+
+/*********************************** Write ************************************/
+/*
+*	The programmer is busy till the data has been sent.  (ArduinoISP writes
+*	a byte at a time, it waits whenever the transmit buffer is full.)
+*/
+void SimISPSerial::Write(
+	const uint8_t*	inData,
+	uint32_t		inLength)
+{
+	Busy(mByteTime * inLength);
+	while (inLength)
+	{
+		ssize_t	bytesWritten = write(mFD, inData, inLength);
+		if (bytesWritten <= 0)
+		{
+			break;
+		}
+		inData += bytesWritten;
+		inLength -= bytesWritten;
+	}
+}
+
+/*
+*	The target and programmer state, named as in ArduinoISP.ino.
+*/
+struct SParameters
+{
+	uint16_t	pageSize;
+	uint16_t	eepromSize;
+	uint32_t	flashSize;
+};
+
+static SimISPSerial			sSerial;
+static std::vector<uint8_t>	sFlash;
+static std::vector<uint8_t>	sEEPROM;
+static uint32_t				sSignature = 0x1E950F;
+static uint8_t				sOSCCAL = 0x9A;
+static uint64_t				sPageWriteTime = 5000000;
+static uint64_t				sEEPROMWriteTime = 45000000;
+static bool					sEEPROMChunkBug;
+static SParameters			sParam;
+static uint8_t				sBuff[256];
+static uint16_t				sHere;	// word address
+static bool					sPMode;
+static const char*			sLinkPath;
+static const char*			sImageOutPath;
+static bool					sVersion2;
+static uint32_t				sV2Address;	// as loaded, flash word or eeprom byte
+static uint32_t				sV2Answers;	// answers sent
+static uint32_t				sBadChecksumAnswer;
+static uint32_t				sBadSequenceAnswer;
+
+/*
+*	Session statistics, printed when prog mode is left.
+*/
+static uint64_t		sSessionStart;
+static uint64_t		sBusyTime;
+static uint32_t		sPagesWritten;
+static uint32_t		sEEPROMBytesWritten;
+static uint32_t		sBytesRead;
+
+/********************************* BusyWriting ********************************/
+static void BusyWriting(
+	uint64_t	inNanoseconds)
+{
+	sBusyTime += inNanoseconds;
+	sSerial.Busy(inNanoseconds);
+}
+
+/************************************ Fill ************************************/
+static void Fill(
+	uint32_t	inLength,
+	uint32_t	inOffset = 0)
+{
+	for (uint32_t i = 0; i < inLength; i++)
+	{
+		sBuff[inOffset + i] = sSerial.Read();
+	}
+}
+
+/********************************* EmptyReply *********************************/
+static void EmptyReply(void)
+{
+	if (sSerial.Read() == CRC_EOP)
+	{
+		static const uint8_t	kReply[] = {STK_INSYNC, STK_OK};
+		sSerial.Write(kReply, sizeof(kReply));
+	} else
+	{
+		sSerial.Write(STK_NOSYNC);
+	}
+}
+
+/*********************************** BReply ***********************************/
+static void BReply(
+	uint8_t	inByte)
+{
+	if (sSerial.Read() == CRC_EOP)
+	{
+		uint8_t	reply[] = {STK_INSYNC, inByte, STK_OK};
+		sSerial.Write(reply, sizeof(reply));
+	} else
+	{
+		sSerial.Write(STK_NOSYNC);
+	}
+}
+
+/******************************** GetParameter ********************************/
+static void GetParameter(
+	uint8_t	inParameter)
+{
+	switch (inParameter)
+	{
+		case 0x80:	// hardware version
+			BReply(2);
+			break;
+		case 0x81:	// software major version
+			BReply(1);
+			break;
+		case 0x82:	// software minor version
+			BReply(18);
+			break;
+		case 0x93:	// programmer type, serial
+			BReply('S');
+			break;
+		default:
+			BReply(0);
+			break;
+	}
+}
+
+/******************************** SetParameters *******************************/
+static void SetParameters(void)
+{
+	// The multi byte values are big-endian
+	sParam.pageSize = (sBuff[12] << 8) | sBuff[13];
+	sParam.eepromSize = (sBuff[14] << 8) | sBuff[15];
+	sParam.flashSize = ((uint32_t)sBuff[16] << 24) | ((uint32_t)sBuff[17] << 16) |
+						(sBuff[18] << 8) | sBuff[19];
+}
+
+/********************************** Universal *********************************/
+/*
+*	Only the instructions used by the hosts are implemented: chip erase and
+*	reading the signature and OSCCAL.
+*/
+static void Universal(void)
+{
+	uint8_t	result = 0;
+	Fill(4);
+	switch (sBuff[0])
+	{
+		case 0xAC:	// Chip erase (0xAC 0x80)
+			if (sBuff[1] == 0x80)
+			{
+				memset(sFlash.data(), 0xFF, sFlash.size());
+				memset(sEEPROM.data(), 0xFF, sEEPROM.size());
+			}
+			break;
+		case 0x30:	// Read signature byte
+			result = sSignature >> ((2 - (sBuff[2] & 3)) * 8);
+			break;
+		case 0x38:	// Read calibration byte
+			result = sOSCCAL;
+			break;
+	}
+	BReply(result);
+}
+
+/******************************** WriteFlash **********************************/
+/*
+*	As with ArduinoISP, the page is committed (and written) whenever the
+*	address moves to the next page, and once all of the data is loaded.
+*/
+static uint8_t WriteFlashPages(
+	uint32_t	inLength)
+{
+	uint32_t	pageMask = sParam.pageSize ? ~((uint32_t)(sParam.pageSize/2) - 1) : ~0U;
+	uint32_t	page = sHere & pageMask;
+	for (uint32_t x = 0; x < inLength; x += 2)
+	{
+		if (page != (sHere & pageMask))
+		{
+			sPagesWritten++;
+			BusyWriting(sPageWriteTime);
+			page = sHere & pageMask;
+		}
+		uint32_t	addr = (uint32_t)sHere * 2;
+		if (addr + 1 < sFlash.size())
+		{
+			sFlash[addr] = sBuff[x];
+			sFlash[addr+1] = sBuff[x+1];
+		}
+		sHere++;
+	}
+	sPagesWritten++;
+	BusyWriting(sPageWriteTime);
+	return(STK_OK);
+}
+
+/******************************** WriteEEPROM *********************************/
+static uint8_t WriteEEPROMChunk(
+	uint32_t	inStart,
+	uint32_t	inLength,
+	uint32_t	inOffset)
+{
+	if (sEEPROMChunkBug)
+	{
+		Fill(inLength, inOffset);
+	}
+	for (uint32_t x = 0; x < inLength; x++)
+	{
+		uint32_t	addr = inStart + x;
+		if (addr < sEEPROM.size())
+		{
+			sEEPROM[addr] = sBuff[inOffset + x];
+		}
+		sEEPROMBytesWritten++;
+		BusyWriting(sEEPROMWriteTime);
+	}
+	return(STK_OK);
+}
+
+/******************************** WriteEEPROM *********************************/
+static uint8_t WriteEEPROM(
+	uint32_t	inLength)
+{
+	uint32_t	start = (uint32_t)sHere * 2;
+	uint32_t	offset = 0;
+	if (inLength > sParam.eepromSize)
+	{
+		return(STK_FAILED);
+	}
+	if (!sEEPROMChunkBug)
+	{
+		Fill(inLength);
+	}
+	while (inLength > EECHUNK)
+	{
+		WriteEEPROMChunk(start + offset, EECHUNK, offset);
+		offset += EECHUNK;
+		inLength -= EECHUNK;
+	}
+	return(WriteEEPROMChunk(start + offset, inLength, offset));
+}
+
+/******************************** ProgramPage *********************************/
+static void ProgramPage(void)
+{
+	uint32_t	length = sSerial.Read() << 8;
+	length |= sSerial.Read();
+	uint8_t		memType = sSerial.Read();
+	if (length > sizeof(sBuff))
+	{
+		sSerial.Write(STK_FAILED);
+		return;
+	}
+	if (memType == 'F')
+	{
+		Fill(length);
+		if (sSerial.Read() == CRC_EOP)
+		{
+			// ArduinoISP acknowledges the command before writing the pages.
+			sSerial.Write(STK_INSYNC);
+			sSerial.Write(WriteFlashPages(length));
+		} else
+		{
+			sSerial.Write(STK_NOSYNC);
+		}
+	} else if (memType == 'E')
+	{
+		uint8_t	result = WriteEEPROM(length);
+		if (sSerial.Read() == CRC_EOP)
+		{
+			uint8_t	reply[] = {STK_INSYNC, result};
+			sSerial.Write(reply, sizeof(reply));
+		} else
+		{
+			sSerial.Write(STK_NOSYNC);
+		}
+	} else
+	{
+		sSerial.Write(STK_FAILED);
+	}
+}
+
+/********************************** ReadPage **********************************/
+static void ReadPage(void)
+{
+	uint32_t	length = sSerial.Read() << 8;
+	length |= sSerial.Read();
+	uint8_t		memType = sSerial.Read();
+	if (sSerial.Read() != CRC_EOP)
+	{
+		sSerial.Write(STK_NOSYNC);
+		return;
+	}
+	std::vector<uint8_t>	reply;
+	reply.push_back(STK_INSYNC);
+	if (memType == 'F')
+	{
+		// As with ArduinoISP, flash is read a word at a time.
+		for (uint32_t x = 0; x < length; x += 2, sHere++)
+		{
+			uint32_t	addr = (uint32_t)sHere * 2;
+			reply.push_back(addr < sFlash.size() ? sFlash[addr] : 0xFF);
+			reply.push_back(addr + 1 < sFlash.size() ? sFlash[addr+1] : 0xFF);
+		}
+	} else if (memType == 'E')
+	{
+		uint32_t	start = (uint32_t)sHere * 2;
+		for (uint32_t x = 0; x < length; x++)
+		{
+			reply.push_back(start + x < sEEPROM.size() ? sEEPROM[start + x] : 0xFF);
+		}
+	} else
+	{
+		sSerial.Write(STK_FAILED);
+		return;
+	}
+	sBytesRead += (uint32_t)reply.size() - 1;
+	reply.push_back(STK_OK);
+	sSerial.Write(reply.data(), (uint32_t)reply.size());
+}
+
+/******************************** ReadSignature *******************************/
+static void ReadSignature(void)
+{
+	if (sSerial.Read() == CRC_EOP)
+	{
+		uint8_t	reply[] = {STK_INSYNC, (uint8_t)(sSignature >> 16),
+							(uint8_t)(sSignature >> 8), (uint8_t)sSignature, STK_OK};
+		sSerial.Write(reply, sizeof(reply));
+	} else
+	{
+		sSerial.Write(STK_NOSYNC);
+	}
+}
+
+/******************************** PrintSession ********************************/
+static void PrintSession(void)
+{
+	double	elapsed = (SimISPSerial::Now() - sSessionStart) / 1e9;
+	fprintf(stderr, "Prog mode %.3fs, busy writing %.3fs, %u flash pages, "
+					"%u eeprom bytes written, %u bytes read",
+				elapsed, sBusyTime / 1e9, sPagesWritten, sEEPROMBytesWritten, sBytesRead);
+	if (sSerial.GetBytesLost())
+	{
+		fprintf(stderr, ", %u bytes lost (receive buffer overflow)", sSerial.GetBytesLost());
+	}
+	fprintf(stderr, "\n");
+}
+
+/******************************** ResetSession ********************************/
+/*
+*	A new session starts with the next enter prog mode that follows a leave
+*	prog mode.
+*/
+static void ResetSession(void)
+{
+	sSessionStart = 0;
+	sBusyTime = 0;
+	sPagesWritten = 0;
+	sEEPROMBytesWritten = 0;
+	sBytesRead = 0;
+	sSerial.ResetBytesLost();
+}
+
+/*********************************** AVRISP ***********************************/
+/*
+*	Handles one command, as ArduinoISP's avrisp() does.
+*/
+static void AVRISP(void)
+{
+	uint8_t	ch = sSerial.Read();
+	switch (ch)
+	{
+		case STK_GET_SYNC:
+			EmptyReply();
+			break;
+		case STK_GET_SIGN_ON:
+			if (sSerial.Read() == CRC_EOP)
+			{
+				sSerial.Write(STK_INSYNC);
+				sSerial.Write((const uint8_t*)STK_SIGN_ON_MESSAGE, sizeof(STK_SIGN_ON_MESSAGE)-1);
+				sSerial.Write(STK_OK);
+			} else
+			{
+				sSerial.Write(STK_NOSYNC);
+			}
+			break;
+		case STK_GET_PARAMETER:
+			GetParameter(sSerial.Read());
+			break;
+		case STK_SET_DEVICE:
+			Fill(20);
+			SetParameters();
+			EmptyReply();
+			break;
+		case STK_SET_DEVICE_EXT:
+			Fill(5);
+			EmptyReply();
+			break;
+		case STK_ENTER_PROGMODE:
+			if (!sPMode)
+			{
+				sPMode = true;
+				// ArduinoISP pulses reset and waits 50ms for the target.
+				sSerial.Busy(50000000);
+				if (!sSessionStart)
+				{
+					sSessionStart = SimISPSerial::Now();
+				}
+			}
+			EmptyReply();
+			break;
+		case STK_LEAVE_PROGMODE:
+			sPMode = false;
+			EmptyReply();
+			if (sSessionStart)
+			{
+				PrintSession();
+			}
+			break;
+		case STK_LOAD_ADDRESS:
+			sHere = sSerial.Read();
+			sHere |= sSerial.Read() << 8;
+			EmptyReply();
+			break;
+		case STK_PROG_FLASH:
+			sSerial.Read();
+			sSerial.Read();
+			EmptyReply();
+			break;
+		case STK_PROG_DATA:
+			sSerial.Read();
+			EmptyReply();
+			break;
+		case STK_PROG_PAGE:
+			ProgramPage();
+			break;
+		case STK_READ_PAGE:
+			ReadPage();
+			break;
+		case STK_UNIVERSAL:
+			Universal();
+			break;
+		case STK_READ_SIGN:
+			ReadSignature();
+			break;
+		case STK_READ_OSCCAL:
+			BReply(sOSCCAL);
+			break;
+		case CRC_EOP:
+			// Expecting a command, not CRC_EOP.  This is how ArduinoISP
+			// gets back in sync.
+			sSerial.Write(STK_NOSYNC);
+			break;
+		default:
+			// Anything else, including STK_CHIP_ERASE, isn't implemented by
+			// ArduinoISP.
+			if (sSerial.Read() == CRC_EOP)
+			{
+				sSerial.Write(STK_UNKNOWN);
+			} else
+			{
+				sSerial.Write(STK_NOSYNC);
+			}
+			break;
+	}
+	if (ch == STK_LEAVE_PROGMODE)
+	{
+		ResetSession();
+	}
+}
+
+/********************************** V2Answer **********************************/
+/*
+*	Sends inBody framed: MESSAGE_START, the sequence number of the message
+*	being answered, body size (big-endian), TOKEN, body, and the XOR of all
+*	of the preceding bytes.
+*/
+static void V2Answer(
+	uint8_t						inSequence,
+	const std::vector<uint8_t>&	inBody)
+{
+	sV2Answers++;
+	std::vector<uint8_t>	message;
+	message.push_back(MESSAGE_START);
+	message.push_back(sV2Answers == sBadSequenceAnswer ? inSequence + 1 : inSequence);
+	message.push_back(inBody.size() >> 8);
+	message.push_back(inBody.size() & 0xFF);
+	message.push_back(TOKEN);
+	message.insert(message.end(), inBody.begin(), inBody.end());
+	uint8_t	checksum = 0;
+	for (uint32_t i = 0; i < message.size(); i++)
+	{
+		checksum ^= message[i];
+	}
+	message.push_back(sV2Answers == sBadChecksumAnswer ? ~checksum : checksum);
+	sSerial.Write(message.data(), (uint32_t)message.size());
+}
+
+/********************************* V2Receive **********************************/
+/*
+*	Receives the next message with a good checksum and returns its sequence
+*	number.  As with the STK500's firmware, bytes other than MESSAGE_START are
+*	ignored while waiting for a message (e.g. a version 1 host's
+*	STK_GET_SYNC), a bad header starts the wait again, and a bad checksum is
+*	answered with ANSWER_CKSUM_ERROR.
+*/
+static uint8_t V2Receive(
+	std::vector<uint8_t>&	outBody)
+{
+	for (;;)
+	{
+		if (sSerial.Read() != MESSAGE_START)
+		{
+			continue;
+		}
+		uint8_t		sequence = sSerial.Read();
+		uint32_t	bodySize = sSerial.Read() << 8;
+		bodySize |= sSerial.Read();
+		if (sSerial.Read() != TOKEN ||
+			bodySize == 0 ||
+			bodySize > MESSAGE_MAX_BODY_SIZE)
+		{
+			continue;
+		}
+		uint8_t	checksum = MESSAGE_START ^ sequence ^ (bodySize >> 8) ^ (bodySize & 0xFF) ^ TOKEN;
+		outBody.resize(bodySize);
+		for (uint32_t i = 0; i < bodySize; i++)
+		{
+			outBody[i] = sSerial.Read();
+			checksum ^= outBody[i];
+		}
+		if (sSerial.Read() == checksum)
+		{
+			return(sequence);
+		}
+		std::vector<uint8_t>	answer;
+		answer.push_back(ANSWER_CKSUM_ERROR);
+		answer.push_back(STATUS_CKSUM_ERROR);
+		V2Answer(sequence, answer);
+	}
+}
+
+/******************************* V2FlashAddress *******************************/
+/*
+*	Returns the byte address of the flash word at sV2Address.  The target's
+*	extended address byte is only loaded when bit 31 of the loaded address is
+*	set, otherwise it stays 0 and the address wraps at 128KB.
+*/
+static uint32_t V2FlashAddress(void)
+{
+	return((sV2Address & ((sV2Address & 0x80000000) ? 0xFFFFFF : 0xFFFF)) * 2);
+}
+
+/********************************** V2Program *********************************/
+/*
+*	CMD_PROGRAM_FLASH_ISP or CMD_PROGRAM_EEPROM_ISP: NumBytes, mode, delay,
+*	cmd1-3, poll1-2, data.  Returns the status.
+*/
+static uint8_t V2Program(
+	const std::vector<uint8_t>&	inBody)
+{
+	uint32_t	length = (inBody[1] << 8) | inBody[2];
+	if (inBody.size() != 10 + length)
+	{
+		return(STATUS_CMD_FAILED);
+	}
+	const uint8_t*	data = &inBody[10];
+	if (inBody[0] == CMD_PROGRAM_FLASH_ISP)
+	{
+		for (uint32_t x = 0; x < length; x += 2, sV2Address++)
+		{
+			uint32_t	addr = V2FlashAddress();
+			if (addr + 1 < sFlash.size())
+			{
+				sFlash[addr] = data[x];
+				sFlash[addr+1] = data[x+1];
+			}
+		}
+		if (inBody[3] & MODE_WRITE_PAGE)
+		{
+			sPagesWritten++;
+			BusyWriting(sPageWriteTime);
+		}
+	} else
+	{
+		for (uint32_t x = 0; x < length; x++, sV2Address++)
+		{
+			if (sV2Address < sEEPROM.size())
+			{
+				sEEPROM[sV2Address] = data[x];
+			}
+			sEEPROMBytesWritten++;
+			BusyWriting(sEEPROMWriteTime);
+		}
+	}
+	return(STATUS_CMD_OK);
+}
+
+/*********************************** V2Read ***********************************/
+/*
+*	CMD_READ_FLASH_ISP or CMD_READ_EEPROM_ISP: NumBytes, cmd1.  The answer is
+*	the status, data, and the status again.
+*/
+static void V2Read(
+	const std::vector<uint8_t>&	inBody,
+	std::vector<uint8_t>&		ioAnswer)
+{
+	uint32_t	length = inBody.size() >= 3 ? (inBody[1] << 8) | inBody[2] : 0;
+	if (length == 0 ||
+		length + 3 > MESSAGE_MAX_BODY_SIZE)
+	{
+		ioAnswer[1] = STATUS_CMD_FAILED;
+		return;
+	}
+	if (inBody[0] == CMD_READ_FLASH_ISP)
+	{
+		for (uint32_t x = 0; x < length; x += 2, sV2Address++)
+		{
+			uint32_t	addr = V2FlashAddress();
+			ioAnswer.push_back(addr < sFlash.size() ? sFlash[addr] : 0xFF);
+			ioAnswer.push_back(addr + 1 < sFlash.size() ? sFlash[addr+1] : 0xFF);
+		}
+	} else
+	{
+		for (uint32_t x = 0; x < length; x++, sV2Address++)
+		{
+			ioAnswer.push_back(sV2Address < sEEPROM.size() ? sEEPROM[sV2Address] : 0xFF);
+		}
+	}
+	sBytesRead += length;
+	ioAnswer.push_back(STATUS_CMD_OK);
+}
+
+/********************************** STK500v2 **********************************/
+/*
+*	Handles one message, in place of AVRISP when speaking version 2.  The
+*	answer is the command, its status, then any data.
+*/
+static void STK500v2(void)
+{
+	std::vector<uint8_t>	body;
+	uint8_t		sequence = V2Receive(body);
+	uint8_t		command = body[0];
+	std::vector<uint8_t>	answer;
+	answer.push_back(command);
+	answer.push_back(STATUS_CMD_OK);
+	switch (command)
+	{
+		case CMD_SIGN_ON:	// + length, sign-on string
+			answer.push_back(sizeof(V2_SIGN_ON_MESSAGE)-1);
+			answer.insert(answer.end(), V2_SIGN_ON_MESSAGE, &V2_SIGN_ON_MESSAGE[sizeof(V2_SIGN_ON_MESSAGE)-1]);
+			break;
+		case CMD_SET_PARAMETER:
+			break;
+		case CMD_GET_PARAMETER:	// + value
+			answer.push_back(0);
+			break;
+		case CMD_LOAD_ADDRESS:	// address, big-endian
+			if (body.size() == 5)
+			{
+				sV2Address = ((uint32_t)body[1] << 24) | ((uint32_t)body[2] << 16) |
+								(body[3] << 8) | body[4];
+			} else
+			{
+				answer[1] = STATUS_CMD_FAILED;
+			}
+			break;
+		case CMD_ENTER_PROGMODE_ISP:
+			if (!sPMode)
+			{
+				sPMode = true;
+				sSerial.Busy(50000000);
+				if (!sSessionStart)
+				{
+					sSessionStart = SimISPSerial::Now();
+				}
+			}
+			break;
+		case CMD_LEAVE_PROGMODE_ISP:
+			sPMode = false;
+			break;
+		case CMD_CHIP_ERASE_ISP:	// eraseDelay, pollMethod, Chip Erase instruction
+			memset(sFlash.data(), 0xFF, sFlash.size());
+			memset(sEEPROM.data(), 0xFF, sEEPROM.size());
+			BusyWriting(body.size() > 1 ? body[1] * 1000000ULL : 0);
+			break;
+		case CMD_PROGRAM_FLASH_ISP:
+		case CMD_PROGRAM_EEPROM_ISP:
+			answer[1] = body.size() >= 10 ? V2Program(body) : STATUS_CMD_FAILED;
+			break;
+		case CMD_READ_FLASH_ISP:
+		case CMD_READ_EEPROM_ISP:
+			V2Read(body, answer);
+			break;
+		case CMD_READ_SIGNATURE_ISP:	// retAddr, Read Signature Byte instruction
+			answer.push_back(body.size() > 4 ? sSignature >> ((2 - (body[4] & 3)) * 8) : 0);
+			answer.push_back(STATUS_CMD_OK);
+			break;
+		case CMD_READ_OSCCAL_ISP:
+			answer.push_back(sOSCCAL);
+			answer.push_back(STATUS_CMD_OK);
+			break;
+		default:
+			answer[1] = STATUS_CMD_UNKNOWN;
+			break;
+	}
+	V2Answer(sequence, answer);
+	if (command == CMD_LEAVE_PROGMODE_ISP)
+	{
+		if (sSessionStart)
+		{
+			PrintSession();
+		}
+		ResetSession();
+	}
+}
+
+/******************************** SignalHandler *******************************/
+/*
+*	The simulator exits the next time it polls the serial port.
+*/
+static void SignalHandler(
+	int	inSignal)
+{
+	sQuit = 1;
+}
+
+/********************************** SimExit ***********************************/
+static void SimExit(void)
+{
+	if (sImageOutPath)
+	{
+		FILE*	file = fopen(sImageOutPath, "wb");
+		if (file &&
+			fwrite(sFlash.data(), 1, sFlash.size(), file) == sFlash.size())
+		{
+			fprintf(stderr, "Saved %s\n", sImageOutPath);
+		} else
+		{
+			perror(sImageOutPath);
+		}
+		if (file)
+		{
+			fclose(file);
+		}
+	}
+	if (sLinkPath)
+	{
+		unlink(sLinkPath);
+	}
+	exit(0);
+}
+
+/********************************* OpenPty ************************************/
+/*
+*	Opens the master side of a new pseudo-terminal.  The slave side is kept
+*	open so that the master doesn't see a hangup between host sessions.
+*	Returns the master file descriptor or -1.
+*/
+static int OpenPty(
+	const char**	outSlaveName)
+{
+	int	masterFD = posix_openpt(O_RDWR | O_NOCTTY);
+	if (masterFD >= 0)
+	{
+		const char*	slaveName = NULL;
+		int	slaveFD = -1;
+		if (grantpt(masterFD) == 0 &&
+			unlockpt(masterFD) == 0 &&
+			(slaveName = ptsname(masterFD)) != NULL &&
+			(slaveFD = open(slaveName, O_RDWR | O_NOCTTY)) >= 0)
+		{
+			struct termios	settings;
+			tcgetattr(slaveFD, &settings);
+			cfmakeraw(&settings);
+			tcsetattr(slaveFD, TCSANOW, &settings);
+			*outSlaveName = slaveName;
+		} else
+		{
+			close(masterFD);
+			masterFD = -1;
+		}
+	}
+	return(masterFD);
+}
+
+/*********************************** main *************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	const char*	imageInPath = NULL;
+	uint32_t	flashSize = 32 * 1024;
+	uint32_t	eepromSize = 1024;
+	uint32_t	baudRate = 19200;
+	uint32_t	rxBufferSize = 64;
+	bool		eepromWriteTimeSet = false;
+	int			option;
+	while ((option = getopt(argc, argv, "p:i:o:F:E:s:c:B:r:w:e:u2K:S:")) != -1)
+	{
+		switch (option)
+		{
+			case 'p':
+				sLinkPath = optarg;
+				break;
+			case 'i':
+				imageInPath = optarg;
+				break;
+			case 'o':
+				sImageOutPath = optarg;
+				break;
+			case 'F':
+				flashSize = strtoul(optarg, NULL, 0) * 1024;
+				break;
+			case 'E':
+				eepromSize = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				sSignature = strtoul(optarg, NULL, 0);
+				break;
+			case 'c':
+				sOSCCAL = strtoul(optarg, NULL, 0);
+				break;
+			case 'B':
+				baudRate = strtoul(optarg, NULL, 0);
+				break;
+			case 'r':
+				rxBufferSize = strtoul(optarg, NULL, 0);
+				break;
+			case 'w':
+				sPageWriteTime = strtod(optarg, NULL) * 1000000;
+				break;
+			case 'e':
+				sEEPROMWriteTime = strtod(optarg, NULL) * 1000000;
+				eepromWriteTimeSet = true;
+				break;
+			case 'u':
+				sEEPROMChunkBug = true;
+				break;
+			case '2':
+				sVersion2 = true;
+				break;
+			case 'K':
+				sBadChecksumAnswer = strtoul(optarg, NULL, 0);
+				break;
+			case 'S':
+				sBadSequenceAnswer = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p link] [-i image] [-o image] [-F KB] [-E bytes]\n"
+								"\t[-s signature] [-c osccal] [-B baud] [-r bytes] [-w ms] [-e ms] [-u]\n"
+								"\t[-2 [-K answer] [-S answer]]\n", argv[0]);
+				return(1);
+		}
+	}
+	if (sVersion2 &&
+		!eepromWriteTimeSet)
+	{
+		// The programmer polls RDY/BSY rather than waiting a fixed time.
+		sEEPROMWriteTime = 3600000;
+	}
+	if (rxBufferSize < 2)
+	{
+		fprintf(stderr, "-r must be at least 2\n");
+		return(1);
+	}
+	sFlash.assign(flashSize, 0xFF);
+	sEEPROM.assign(eepromSize, 0xFF);
+	if (imageInPath)
+	{
+		FILE*	file = fopen(imageInPath, "rb");
+		if (!file)
+		{
+			perror(imageInPath);
+			return(1);
+		}
+		fread(sFlash.data(), 1, sFlash.size(), file);
+		fclose(file);
+	}
+	const char*	slaveName;
+	int	masterFD = OpenPty(&slaveName);
+	if (masterFD < 0)
+	{
+		perror("pty");
+		return(1);
+	}
+	if (sLinkPath)
+	{
+		unlink(sLinkPath);
+		if (symlink(slaveName, sLinkPath) != 0)
+		{
+			perror(sLinkPath);
+			sLinkPath = NULL;
+		}
+	}
+	fprintf(stderr, "%s simulator, %u KB flash, %u bytes eeprom, serial port %s\n",
+				sVersion2 ? "STK500 version 2" : "ArduinoISP",
+				flashSize/1024, eepromSize, sLinkPath ? sLinkPath : slaveName);
+	signal(SIGINT, SignalHandler);
+	signal(SIGTERM, SignalHandler);
+	sSerial.Begin(masterFD, baudRate, rxBufferSize);
+	for (;;)
+	{
+		if (sVersion2)
+		{
+			STK500v2();
+		} else
+		{
+			AVRISP();
+		}
+	}
+	return(0);
+}
@@ -0,0 +1,357 @@
+/*
+*	HexLoaderSim.cpp, Copyright Jonathan Mackey 2019
+*	Builds the HexLoader sketch as a Linux program.  The sketch talks to
+*	in-memory device models instead of chips, and its serial port is a
+*	pseudo-terminal, so the host side of the download is unchanged: point it
+*	at the pty (or the link made with -p) instead of the board's port.
+*
+*	Build from the repository root, selecting the target with -D:
+*
+*	g++ -std=c++11 -O2 -DTARGET_NORFLASH -ISimulator -IArduino/HexLoader \
+*		-IArduino/libraries/BlockDevice -IArduino/libraries/SPIMem \
+*		-IArduino/libraries/AT24C Simulator/HexLoaderSim.cpp \
+*		Simulator/SimCore.cpp Simulator/SimModels.cpp Simulator/SimHost.cpp \
+*		Arduino/libraries/SPIMem/SPIMem.cpp Arduino/libraries/AT24C/AT24C.cpp \
+*		Arduino/libraries/AT24C/AT24CBank.cpp -o HexLoaderSim
+*
+*	(TARGET_AT24C and TARGET_SD are the other targets.)  Add
+*	-DSPIMEM_BUSY_STATS to count the NOR Flash busy times reported by the
+*	sketch's 'b' command.
+*
+*	On AVR, AT24C writes bypass Wire so each write is a full page.  The
+*	simulated Wire has the AVR library's 32 byte buffer, add
+*	-DBUFFER_LENGTH=130 to simulate full page writes.
+*
+*	Usage: HexLoaderSim [-p link] [-i image] [-o image] [-s KB] [-M]
+*			[-x file.hex | -b file.bin [-a addr] [-l length]] [-n] [-k cmds]
+*			[-B baud] [-L ms]
+*	-p link		make a symbolic link to the pty, e.g. /tmp/HexLoader
+*	-i image	load the memory from the image file before starting
+*	-o image	save the memory to the image file on exit (SIGINT or SIGTERM)
+*	-s KB		memory capacity (NOR Flash and SD only, the AT24C chips are
+*				the sketch's kEEPROMs.)
+*	-M			use the maximum rather than typical device times
+*
+*	The device models are busy for as long as the real device would be.
+*	With -x or -b the download is benchmarked rather than waiting for a host
+*	on the pty: a simulated host (SimHost) sends the file, everything runs on
+*	a simulated clock, and a report of where the time went is printed.
+*	-x file.hex	download the Intel Hex file
+*	-b file.bin	download the binary file, converted to hex starting at -a addr
+*				(default 0) with -l length data bytes per line (default 16)
+*	-n			don't erase before write (h rather than H)
+*	-k cmds		commands sent before the download, e.g. -k c to turn off
+*				compare before write
+*	-B baud		UART baud rate (default: the sketch's BAUD_RATE)
+*	-L ms		USB-serial latency timer (default 16, FTDI's default)
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "Arduino.h"
+#include "SimModels.h"
+#include "SimHost.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*
+*	The Arduino IDE generates prototypes for the sketch's functions.  The
+*	sketch depends on this, so they're declared here.
+*/
+void		DumpJDECInfo(void);
+void		PrintBusyStats(
+				uint32_t				inCount,
+				uint32_t				inBusyTime,
+				uint32_t				inMaxBusyTime,
+				uint32_t				inWaitTime,
+				const char*				inPollName,
+				uint32_t				inPolls);
+void		DumpBusyStats(void);
+void		setup(void);
+void		loop(void);
+void		FullErase(void);
+void		SetCompareBeforeWrite(
+				bool					inCompareBeforeWrite);
+uint8_t*	ClearBuffer(void);
+bool		LoadRange(
+				uint32_t&				outStart,
+				uint32_t&				outEnd);
+uint16_t	Crc16(
+				uint16_t				inCrc,
+				const uint8_t*			inData,
+				uint16_t				inLength);
+void		SendFrame(
+				uint32_t				inAddr,
+				const uint8_t*			inData,
+				uint16_t				inLength);
+void		DumpRange(void);
+bool		IsBlank(
+				uint32_t				inAddr,
+				uint32_t				inLength);
+bool		EraseBlock(
+				uint32_t				inAddr,
+				uint32_t				inEndAddr,
+				bool					inBlankCheck);
+bool		WriteBlock(
+				uint8_t*				inData,
+				uint32_t				inBlockIndex);
+uint8_t		GetChar(void);
+bool		LoadHexLine(void);
+uint8_t		DecodeHexLine(void);
+void		HexDownload(void);
+
+#include "HexLoader.ino"
+
+static const char*	sLinkPath;
+static const char*	sImageOutPath;
+static MemoryModel*	sMemory;
+static SimHost*		sHost;
+static std::vector<uint8_t>	sOriginal;	// The memory before the download
+
+/******************************** SignalHandler *******************************/
+/*
+*	The sketch is stopped the next time it polls the serial port.
+*/
+static void SignalHandler(
+	int	inSignal)
+{
+	simQuit = 1;
+}
+
+/********************************** SimExit ***********************************/
+void SimExit(void)
+{
+	int	exitCode = 0;
+	if (sHost)
+	{
+		sHost->Report(stdout);
+		if (!sHost->Succeeded() ||
+			!sHost->Verify(*sMemory, stdout) ||
+			!sHost->VerifyUnchanged(*sMemory, sOriginal,
+								sEraseBeforeWrite ? device.GetEraseSize() : 0, stdout))
+		{
+			exitCode = 1;
+		}
+	}
+	if (sImageOutPath)
+	{
+		if (sMemory->SaveImage(sImageOutPath))
+		{
+			fprintf(stderr, "Saved %s\n", sImageOutPath);
+		} else
+		{
+			perror(sImageOutPath);
+		}
+	}
+	if (sLinkPath)
+	{
+		unlink(sLinkPath);
+	}
+	exit(exitCode);
+}
+
+/********************************* OpenPty ************************************/
+/*
+*	Opens the master side of a new pseudo-terminal.  The slave side is kept
+*	open so that the master doesn't see a hangup between host sessions.
+*	Returns the master file descriptor or -1.
+*/
+static int OpenPty(
+	const char**	outSlaveName)
+{
+	int	masterFD = posix_openpt(O_RDWR | O_NOCTTY);
+	if (masterFD >= 0)
+	{
+		const char*	slaveName = NULL;
+		int	slaveFD = -1;
+		if (grantpt(masterFD) == 0 &&
+			unlockpt(masterFD) == 0 &&
+			(slaveName = ptsname(masterFD)) != NULL &&
+			(slaveFD = open(slaveName, O_RDWR | O_NOCTTY)) >= 0)
+		{
+			struct termios	settings;
+			tcgetattr(slaveFD, &settings);
+			cfmakeraw(&settings);
+			tcsetattr(slaveFD, TCSANOW, &settings);
+			*outSlaveName = slaveName;
+		} else
+		{
+			close(masterFD);
+			masterFD = -1;
+		}
+	}
+	return(masterFD);
+}
+
+/*********************************** main *************************************/
+int main(
+	int		argc,
+	char*	argv[])
+{
+	const char*	imageInPath = NULL;
+	const char*	hexPath = NULL;
+	const char*	binaryPath = NULL;
+	const char*	commands = NULL;
+	uint32_t	capacity = 0;
+	uint32_t	startAddr = 0;
+	uint32_t	recordLength = 16;
+	uint32_t	baudRate = 0;
+	int32_t		latencyTimer = -1;
+	bool		eraseBeforeWrite = true;
+	int			option;
+	while ((option = getopt(argc, argv, "p:i:o:s:Mx:b:a:l:nk:B:L:")) != -1)
+	{
+		switch (option)
+		{
+			case 'M':
+				simTiming = kMaxTiming;
+				break;
+			case 'x':
+				hexPath = optarg;
+				break;
+			case 'b':
+				binaryPath = optarg;
+				break;
+			case 'a':
+				startAddr = strtoul(optarg, NULL, 0);
+				break;
+			case 'l':
+				recordLength = strtoul(optarg, NULL, 0);
+				break;
+			case 'n':
+				eraseBeforeWrite = false;
+				break;
+			case 'k':
+				commands = optarg;
+				break;
+			case 'B':
+				baudRate = strtoul(optarg, NULL, 0);
+				break;
+			case 'L':
+				latencyTimer = strtoul(optarg, NULL, 0) * 1000;
+				break;
+			case 'p':
+				sLinkPath = optarg;
+				break;
+			case 'i':
+				imageInPath = optarg;
+				break;
+			case 'o':
+				sImageOutPath = optarg;
+				break;
+			case 's':
+				capacity = strtoul(optarg, NULL, 0) * 1024;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p link] [-i image] [-o image] [-s KB] [-M]\n"
+								"\t[-x file.hex | -b file.bin [-a addr] [-l length]] [-n] [-k cmds]\n"
+								"\t[-B baud] [-L ms]\n", argv[0]);
+				return(1);
+		}
+	}
+	if (latencyTimer >= 0)
+	{
+		simTiming.usbLatencyTimer = latencyTimer;
+	}
+#ifdef TARGET_NORFLASH
+	const char*	targetName = "NOR Flash";
+	sMemory = &simFlash;
+	simFlash.SetCSPin(kNFChipSelect);
+	if (capacity)
+	{
+		simFlash.SetCapacity(capacity);
+	}
+#elif defined TARGET_AT24C
+	const char*	targetName = "AT24C";
+	sMemory = &simEEPROM;
+	for (uint8_t i = 0; i < eeproms.GetChipCount(); i++)
+	{
+		AT24C*	chip = eeproms.GetChip(i);
+		simEEPROM.AddChip(chip->GetDeviceAddress(), chip->GetCapacity()/1024);
+	}
+	if (capacity)
+	{
+		fprintf(stderr, "-s ignored, the capacity is that of the sketch's kEEPROMs\n");
+	}
+#elif defined TARGET_SD
+	const char*	targetName = "SD";
+	sMemory = &simCard;
+	if (capacity)
+	{
+		simCard.SetCapacity(capacity & ~0x1FFUL);
+	}
+#endif
+	if (imageInPath &&
+		!sMemory->LoadImage(imageInPath))
+	{
+		perror(imageInPath);
+		return(1);
+	}
+	if (hexPath ||
+		binaryPath)
+	{
+		static SimHost	host;
+		if (hexPath ? !host.LoadHex(hexPath) :
+			!host.LoadBinary(binaryPath, startAddr, recordLength, kBlockSize))
+		{
+			fprintf(stderr, "Unable to load %s\n", hexPath ? hexPath : binaryPath);
+			return(1);
+		}
+		sHost = &host;
+		sOriginal.assign(sMemory->GetMemory(), &sMemory->GetMemory()[sMemory->GetCapacity()]);
+		simRealTime = false;
+		Serial.SetHost(sHost);
+		setup();
+		sHost->Begin(commands, eraseBeforeWrite, baudRate ? baudRate : Serial.GetBaudRate());
+		for (;;)
+		{
+			loop();
+		}
+	}
+	const char*	slaveName;
+	int	masterFD = OpenPty(&slaveName);
+	if (masterFD < 0)
+	{
+		perror("pty");
+		return(1);
+	}
+	if (sLinkPath)
+	{
+		unlink(sLinkPath);
+		if (symlink(slaveName, sLinkPath) != 0)
+		{
+			perror(sLinkPath);
+			sLinkPath = NULL;
+		}
+	}
+	fprintf(stderr, "HexLoader %s simulator, %u KB, serial port %s\n",
+				targetName, sMemory->GetCapacity()/1024, sLinkPath ? sLinkPath : slaveName);
+	signal(SIGINT, SignalHandler);
+	signal(SIGTERM, SignalHandler);
+	Serial.SetFD(masterFD);
+	setup();
+	for (;;)
+	{
+		loop();
+	}
+	return(0);
+}
@@ -0,0 +1,59 @@
+/*
+*	SPI.h, Copyright Jonathan Mackey 2019
+*	SPI stand-in.  Transfers go to the NOR Flash model while its chip select
+*	is low.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef SPI_h
+#define SPI_h
+
+#include "Arduino.h"
+
+#define MSBFIRST	1
+#define LSBFIRST	0
+#define SPI_MODE0	0
+
+class SPISettings
+{
+public:
+							SPISettings(void){}
+							SPISettings(
+								uint32_t				inClock,
+								uint8_t					inBitOrder,
+								uint8_t					inDataMode){}
+};
+
+class SPIClass
+{
+public:
+	void					begin(void){}
+	void					beginTransaction(
+								SPISettings				inSettings){}
+	void					endTransaction(void){}
+	uint8_t					transfer(
+								uint8_t					inData);
+	void					transfer(
+								void*					ioBuffer,
+								size_t					inLength);
+};
+
+extern SPIClass	SPI;
+
+#endif // SPI_h
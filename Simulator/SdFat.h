@@ -0,0 +1,82 @@
+/*
+*	SdFat.h, Copyright Jonathan Mackey 2019
+*	Subset of the SdFat library used by HexLoader.  The card is the SD card
+*	model rather than a physical card.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef SdFat_h
+#define SdFat_h
+
+#include "Arduino.h"
+
+#define SPI_FULL_SPEED	0
+#define SPI_HALF_SPEED	1
+
+union cache_t
+{
+	uint8_t		data[512];
+	uint32_t	fat32[128];
+};
+
+class Sd2Card
+{
+public:
+	bool					init(
+								uint8_t					inSckRateID,
+								uint8_t					inChipSelectPin);
+	uint32_t				cardSize(void);
+	bool					readBlock(
+								uint32_t				inBlock,
+								uint8_t*				outData);
+	bool					writeBlock(
+								uint32_t				inBlock,
+								const uint8_t*			inData);
+	bool					erase(
+								uint32_t				inFirstBlock,
+								uint32_t				inLastBlock);
+	/*
+	*	Multiple block write (CMD25.)  inEraseCount is the number of blocks to
+	*	pre-erase (ACMD23), a hint that speeds up the write.  As on a card, the
+	*	pre-erased blocks that aren't written before writeStop are left erased.
+	*/
+	bool					writeStart(
+								uint32_t				inBlock,
+								uint32_t				inEraseCount);
+	bool					writeData(
+								const uint8_t*			inData);
+	bool					writeStop(void);
+protected:
+	uint32_t	mWriteBlock;	// Next block of a multiple block write
+	uint32_t	mPreEraseEnd;	// Block following the pre-erased blocks
+};
+
+class SdVolume
+{
+public:
+	bool					init(
+								Sd2Card*				inCard)
+								{return(inCard != NULL);}
+	cache_t*				cacheClear(void)
+								{return(&mCache);}
+protected:
+	cache_t		mCache;
+};
+
+#endif // SdFat_h
@@ -0,0 +1,465 @@
+/*
+*	SimCore.cpp, Copyright Jonathan Mackey 2019
+*	Implements the Arduino core, SPI, Wire and SdFat stand-ins on top of the
+*	device models and the pseudo-terminal.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "Arduino.h"
+#include "SPI.h"
+#include "Wire.h"
+#include "SdFat.h"
+#include "SimModels.h"
+#include "SimHost.h"
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+SimSerial	Serial;
+SPIClass	SPI;
+TwoWire		Wire;
+volatile int	simQuit;
+bool			simRealTime = true;
+static uint64_t	sSimNow;
+
+/*********************************** SimNow ***********************************/
+uint64_t SimNow(void)
+{
+	if (simRealTime)
+	{
+		static uint64_t	sStart;
+		struct timespec	now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t	nanoseconds = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+		if (sStart == 0)
+		{
+			sStart = nanoseconds;
+		}
+		return(nanoseconds - sStart);
+	}
+	return(sSimNow);
+}
+
+/********************************* SimAdvance *********************************/
+/*
+*	Real time passes on its own, so this only moves the simulated clock.
+*/
+void SimAdvance(
+	uint64_t	inNanoseconds)
+{
+	sSimNow += inNanoseconds;
+}
+
+/*********************************** millis ***********************************/
+uint32_t millis(void)
+{
+	return((uint32_t)(SimNow()/1000000));
+}
+
+/*********************************** micros ***********************************/
+uint32_t micros(void)
+{
+	return((uint32_t)(SimNow()/1000));
+}
+
+/*********************************** delay ************************************/
+void delay(
+	uint32_t	inMilliseconds)
+{
+	delayMicroseconds(inMilliseconds * 1000);
+}
+
+/***************************** delayMicroseconds ******************************/
+void delayMicroseconds(
+	uint32_t	inMicroseconds)
+{
+	if (simRealTime)
+	{
+		usleep(inMicroseconds);
+	} else
+	{
+		sSimNow += (uint64_t)inMicroseconds * 1000;
+	}
+}
+
+/********************************** pinMode ***********************************/
+void pinMode(
+	uint8_t	inPin,
+	uint8_t	inMode)
+{
+}
+
+/******************************** digitalWrite ********************************/
+void digitalWrite(
+	uint8_t	inPin,
+	uint8_t	inValue)
+{
+	if (inPin == simFlash.GetCSPin())
+	{
+		simFlash.Select(inValue == LOW);
+	}
+}
+
+/********************************* SimSerial **********************************/
+SimSerial::SimSerial(void)
+	: mHost(NULL), mFD(-1), mBaudRate(0), mRxHead(0), mRxTail(0)
+{
+}
+
+/*********************************** begin ************************************/
+void SimSerial::begin(
+	uint32_t	inBaudRate)
+{
+	mBaudRate = inBaudRate;
+}
+
+/******************************** FillRxBuffer ********************************/
+/*
+*	Called when the receive buffer is empty.  Waits up to inTimeout ms for
+*	data so that sketch loops polling available() don't spin.
+*/
+bool SimSerial::FillRxBuffer(
+	int	inTimeout)
+{
+	if (simQuit)
+	{
+		SimExit();
+	}
+	mRxHead = mRxTail = 0;
+	struct pollfd	pfd = {mFD, POLLIN, 0};
+	if (poll(&pfd, 1, inTimeout) > 0)
+	{
+		ssize_t	bytesRead = ::read(mFD, mRxBuffer, sizeof(mRxBuffer));
+		if (bytesRead > 0)
+		{
+			mRxTail = bytesRead;
+		}
+	}
+	return(mRxTail != 0);
+}
+
+/********************************* available **********************************/
+int SimSerial::available(void)
+{
+	if (mHost)
+	{
+		return(mHost->Available());
+	}
+	if (mRxHead == mRxTail)
+	{
+		FillRxBuffer(1);
+	}
+	return(mRxTail - mRxHead);
+}
+
+/************************************ read ************************************/
+int SimSerial::read(void)
+{
+	if (mHost)
+	{
+		return(mHost->Read());
+	}
+	return(available() ? mRxBuffer[mRxHead++] : -1);
+}
+
+/************************************ peek ************************************/
+int SimSerial::peek(void)
+{
+	if (mHost)
+	{
+		return(mHost->Peek());
+	}
+	return(available() ? mRxBuffer[mRxHead] : -1);
+}
+
+/*********************************** write ************************************/
+size_t SimSerial::write(
+	uint8_t	inByte)
+{
+	return(write(&inByte, 1));
+}
+
+/*********************************** write ************************************/
+size_t SimSerial::write(
+	const uint8_t*	inData,
+	size_t			inLength)
+{
+	if (mHost)
+	{
+		mHost->Write(inData, inLength);
+		return(inLength);
+	}
+	size_t	bytesLeft = inLength;
+	while (bytesLeft)
+	{
+		ssize_t	bytesWritten = ::write(mFD, inData, bytesLeft);
+		if (bytesWritten > 0)
+		{
+			inData += bytesWritten;
+			bytesLeft -= bytesWritten;
+		} else if (errno != EINTR &&
+			errno != EAGAIN)
+		{
+			break;
+		}
+	}
+	return(inLength - bytesLeft);
+}
+
+/*********************************** print ************************************/
+size_t SimSerial::print(
+	const char*	inString)
+{
+	return(write((const uint8_t*)inString, strlen(inString)));
+}
+
+/*********************************** print ************************************/
+size_t SimSerial::print(
+	char	inChar)
+{
+	return(write((uint8_t)inChar));
+}
+
+/******************************** PrintNumber *********************************/
+size_t SimSerial::PrintNumber(
+	long long	inValue,
+	int			inBase)
+{
+	char	buffer[24];
+	char*	bufferPtr = &buffer[sizeof(buffer)];
+	bool	negative = inValue < 0 && inBase == DEC;
+	unsigned long long	value = negative ? -inValue : inValue;
+	*(--bufferPtr) = 0;
+	do
+	{
+		uint8_t	digit = value % inBase;
+		*(--bufferPtr) = digit < 10 ? digit + '0' : digit + ('A' - 10);
+		value /= inBase;
+	} while (value);
+	if (negative)
+	{
+		*(--bufferPtr) = '-';
+	}
+	return(print(bufferPtr));
+}
+
+/*********************************** flush ************************************/
+void SimSerial::flush(void)
+{
+}
+
+/********************************** transfer **********************************/
+uint8_t SPIClass::transfer(
+	uint8_t	inData)
+{
+	SimAdvance(simTiming.spiByteNs);
+	return(simFlash.Transfer(inData));
+}
+
+/********************************** transfer **********************************/
+void SPIClass::transfer(
+	void*	ioBuffer,
+	size_t	inLength)
+{
+	uint8_t*	buffer = (uint8_t*)ioBuffer;
+	for (size_t i = 0; i < inLength; i++)
+	{
+		SimAdvance(simTiming.spiBulkByteNs);
+		buffer[i] = simFlash.Transfer(buffer[i]);
+	}
+}
+
+/********************************** TwoWire ***********************************/
+TwoWire::TwoWire(void)
+	: mClock(100000), mAddress(0), mTxLength(0), mRxIndex(0), mRxLength(0),
+	  mOverflow(false)
+{
+}
+
+/***************************** beginTransmission ******************************/
+void TwoWire::beginTransmission(
+	uint8_t	inAddress)
+{
+	mAddress = inAddress;
+	mTxLength = 0;
+	mOverflow = false;
+}
+
+/*********************************** write ************************************/
+size_t TwoWire::write(
+	uint8_t	inData)
+{
+	if (mTxLength < BUFFER_LENGTH)
+	{
+		mBuffer[mTxLength++] = inData;
+		return(1);
+	}
+	mOverflow = true;
+	return(0);
+}
+
+/*********************************** write ************************************/
+size_t TwoWire::write(
+	const uint8_t*	inData,
+	size_t			inLength)
+{
+	size_t	bytesWritten = 0;
+	for (; bytesWritten < inLength; bytesWritten++)
+	{
+		if (write(inData[bytesWritten]))continue;
+		break;
+	}
+	return(bytesWritten);
+}
+
+/******************************** BusTime *************************************/
+/*
+*	Time on the bus for a start, inBytes bytes (including the address byte,)
+*	each 8 bits plus an ack, and a stop.
+*/
+static uint64_t BusTime(
+	uint32_t	inBytes,
+	uint32_t	inClock)
+{
+	return(((uint64_t)inBytes * 9 + 2) * 1000000000 / inClock);
+}
+
+/****************************** endTransmission *******************************/
+uint8_t TwoWire::endTransmission(
+	bool	inSendStop)
+{
+	if (mOverflow)
+	{
+		return(1);
+	}
+	if (!simEEPROM.Write(mAddress, mBuffer, mTxLength))
+	{
+		SimAdvance(BusTime(1, mClock));	// Stopped after the address NACK
+		return(2);
+	}
+	SimAdvance(BusTime(mTxLength + 1, mClock));
+	return(0);
+}
+
+/******************************** requestFrom *********************************/
+uint8_t TwoWire::requestFrom(
+	uint8_t	inAddress,
+	uint8_t	inQuantity,
+	uint8_t	inSendStop)
+{
+	if (inQuantity > BUFFER_LENGTH)
+	{
+		inQuantity = BUFFER_LENGTH;
+	}
+	mRxIndex = 0;
+	mRxLength = simEEPROM.Read(inAddress, mBuffer, inQuantity) ? inQuantity : 0;
+	SimAdvance(BusTime(mRxLength + 1, mClock));
+	return(mRxLength);
+}
+
+/************************************ init ************************************/
+bool Sd2Card::init(
+	uint8_t	inSckRateID,
+	uint8_t	inChipSelectPin)
+{
+	mWriteBlock = 0;
+	mPreEraseEnd = 0;
+	return(true);
+}
+
+/********************************** cardSize **********************************/
+uint32_t Sd2Card::cardSize(void)
+{
+	return(simCard.GetCapacity()/512);
+}
+
+/********************************* readBlock **********************************/
+bool Sd2Card::readBlock(
+	uint32_t	inBlock,
+	uint8_t*	outData)
+{
+	SimAdvance((uint64_t)simTiming.sdReadBlock * 1000);
+	return(simCard.ReadBlock(inBlock, outData));
+}
+
+/********************************* writeBlock *********************************/
+bool Sd2Card::writeBlock(
+	uint32_t		inBlock,
+	const uint8_t*	inData)
+{
+	SimAdvance((uint64_t)simTiming.sdWriteBlock * 1000);
+	simStats.deviceBusy += (uint64_t)simTiming.sdWriteBlock * 1000;
+	return(simCard.WriteBlock(inBlock, inData));
+}
+
+/*********************************** erase ************************************/
+bool Sd2Card::erase(
+	uint32_t	inFirstBlock,
+	uint32_t	inLastBlock)
+{
+	bool	success = inFirstBlock <= inLastBlock &&
+						inLastBlock < cardSize();
+	if (success)
+	{
+		memset(&simCard.GetMemory()[inFirstBlock*512], 0, (inLastBlock - inFirstBlock + 1) * 512);
+	}
+	return(success);
+}
+
+/********************************* writeStart *********************************/
+bool Sd2Card::writeStart(
+	uint32_t	inBlock,
+	uint32_t	inEraseCount)
+{
+	mWriteBlock = inBlock;
+	mPreEraseEnd = inBlock + inEraseCount;
+	simStats.sdMultipleBlockWrites++;
+	SimAdvance((uint64_t)simTiming.sdWriteStartStop * 1000);
+	return(inBlock < cardSize());
+}
+
+/********************************* writeData **********************************/
+bool Sd2Card::writeData(
+	const uint8_t*	inData)
+{
+	SimAdvance((uint64_t)simTiming.sdWriteData * 1000);
+	simStats.deviceBusy += (uint64_t)simTiming.sdWriteData * 1000;
+	return(simCard.WriteBlock(mWriteBlock++, inData));
+}
+
+/********************************* writeStop **********************************/
+/*
+*	The contents of pre-erased blocks that weren't written are undefined, the
+*	model erases them as erase does.
+*/
+bool Sd2Card::writeStop(void)
+{
+	SimAdvance((uint64_t)simTiming.sdWriteStartStop * 1000);
+	if (mPreEraseEnd > cardSize())
+	{
+		mPreEraseEnd = cardSize();
+	}
+	if (mWriteBlock < mPreEraseEnd)
+	{
+		memset(&simCard.GetMemory()[mWriteBlock*512], 0, (mPreEraseEnd - mWriteBlock) * 512);
+	}
+	mPreEraseEnd = 0;
+	return(true);
+}
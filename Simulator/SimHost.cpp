@@ -0,0 +1,646 @@
+/*
+*	SimHost.cpp, Copyright Jonathan Mackey 2019
+*	Simulated host for benchmarking downloads.
+*
+*	Bytes sent to the sketch arrive one UART byte time (10 bits) apart.
+*	Bytes from the sketch are collected by the USB-serial chip and passed to
+*	the host when its packet is full or its latency timer expires, as an FTDI
+*	chip does.  The host then takes usbTurnaround to get the next line to the
+*	chip.  Events are processed in time order as the sketch polls the serial
+*	port, so they don't depend on when the sketch gets around to polling.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "Arduino.h"
+#include "SimHost.h"
+#include "SimModels.h"
+#include <stdlib.h>
+
+enum EIntelHexRecordType
+{
+	eRecordTypeData,		// 0
+	eRecordTypeEOF,			// 1
+	eRecordTypeExSegAddr,	// 2
+	eRecordTypeStSegAddr,	// 3
+	eRecordTypeExLinAddr,	// 4
+	eRecordTypeStLinAddr	// 5
+};
+
+const uint64_t	kNoTime = 0xFFFFFFFFFFFFFFFFULL;
+
+/********************************* DecodeLine *********************************/
+/*
+*	Converts a hex line to binary: byte count, address H/L, record type, data
+*	and checksum.  Returns false if the line isn't valid.
+*/
+static bool DecodeLine(
+	const std::string&		inLine,
+	std::vector<uint8_t>&	outRecord)
+{
+	outRecord.clear();
+	bool	success = inLine.size() >= 11 && inLine[0] == ':' && (inLine.size() & 1);
+	for (size_t i = 1; success && i < inLine.size(); i += 2)
+	{
+		char*	endPtr;
+		std::string	byteStr = inLine.substr(i, 2);
+		outRecord.push_back((uint8_t)strtoul(byteStr.c_str(), &endPtr, 16));
+		success = *endPtr == 0;
+	}
+	if (success)
+	{
+		uint8_t	checksum = 0;
+		for (size_t i = 0; i < outRecord.size(); i++)
+		{
+			checksum += outRecord[i];
+		}
+		success = checksum == 0 && outRecord.size() == (size_t)outRecord[0] + 5;
+	}
+	return(success);
+}
+
+/********************************** SimHost ***********************************/
+SimHost::SimHost(void)
+	: mChipFlushAt(0), mChipLastByte(0), mToDeviceFree(0), mFromDeviceFree(0),
+	  mByteTime(0), mLatencyWait(0), mFinishTime(0), mIdleSince(kNoTime),
+	  mStartAddr(0), mEndAddr(0), mDataBytes(0), mBytesToDevice(0),
+	  mBytesFromDevice(0), mNextLine(0), mRewindAddr(0), mRewinds(0),
+	  mBaudRate(0), mStarted(false), mDone(false), mSucceeded(false),
+	  mReceivingRewind(false), mReceivingError(false)
+{
+}
+
+/***************************** ForEachDataRecord ******************************/
+template <class F> void SimHost::ForEachDataRecord(
+	F	inFunc) const
+{
+	std::vector<uint8_t>	record;
+	uint32_t	baseAddress = 0;
+	for (size_t i = 0; i < mLines.size(); i++)
+	{
+		if (DecodeLine(mLines[i], record))
+		{
+			switch (record[3])
+			{
+				case eRecordTypeData:
+					inFunc(baseAddress + ((uint32_t)record[1] << 8) + record[2], &record[4], record[0], i);
+					break;
+				case eRecordTypeExLinAddr:
+					baseAddress = ((uint32_t)record[4] << 24) + ((uint32_t)record[5] << 16);
+					break;
+			}
+		}
+	}
+}
+
+/********************************** LoadHex ***********************************/
+bool SimHost::LoadHex(
+	const char*	inPath)
+{
+	FILE*	file = fopen(inPath, "r");
+	bool	success = file != NULL;
+	if (success)
+	{
+		char	line[600];
+		std::vector<uint8_t>	record;
+		while (success &&
+			fgets(line, sizeof(line), file))
+		{
+			std::string	lineStr(line);
+			while (!lineStr.empty() &&
+				(lineStr.back() == '\n' || lineStr.back() == '\r'))
+			{
+				lineStr.pop_back();
+			}
+			if (!lineStr.empty())
+			{
+				success = DecodeLine(lineStr, record);
+				mLines.push_back(lineStr);
+			}
+		}
+		fclose(file);
+	}
+	if (success)
+	{
+		mStartAddr = 0xFFFFFFFF;
+		ForEachDataRecord([this](uint32_t inAddr, const uint8_t*, uint8_t inLength, size_t)
+			{
+				if (inAddr < mStartAddr)
+				{
+					mStartAddr = inAddr;
+				}
+				if (inAddr + inLength > mEndAddr)
+				{
+					mEndAddr = inAddr + inLength;
+				}
+				mDataBytes += inLength;
+			});
+		success = mDataBytes != 0;
+	}
+	return(success);
+}
+
+/********************************** AddLine ***********************************/
+void SimHost::AddLine(
+	uint8_t			inRecordType,
+	uint16_t		inAddress,
+	const uint8_t*	inData,
+	uint8_t			inLength)
+{
+	char	line[600];
+	uint8_t	checksum = inLength + (inAddress >> 8) + inAddress + inRecordType;
+	int	lineLength = snprintf(line, sizeof(line), ":%02X%04X%02X", inLength, inAddress, inRecordType);
+	for (uint8_t i = 0; i < inLength; i++)
+	{
+		lineLength += snprintf(&line[lineLength], sizeof(line) - lineLength, "%02X", inData[i]);
+		checksum += inData[i];
+	}
+	snprintf(&line[lineLength], sizeof(line) - lineLength, "%02X", (uint8_t)-checksum);
+	mLines.push_back(line);
+}
+
+/********************************* LoadBinary *********************************/
+bool SimHost::LoadBinary(
+	const char*	inPath,
+	uint32_t	inStartAddr,
+	uint8_t		inRecordLength,
+	uint32_t	inBlockSize)
+{
+	FILE*	file = fopen(inPath, "rb");
+	bool	success = file != NULL && inRecordLength != 0;
+	if (success)
+	{
+		std::vector<uint8_t>	data;
+		uint8_t	buffer[4096];
+		size_t	bytesRead;
+		while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		{
+			data.insert(data.end(), buffer, &buffer[bytesRead]);
+		}
+		fclose(file);
+		uint32_t	baseAddress = 0;
+		for (uint32_t offset = 0; offset < data.size();)
+		{
+			uint32_t	address = inStartAddr + offset;
+			if ((address & 0xFFFF0000) != baseAddress ||
+				offset == 0)
+			{
+				baseAddress = address & 0xFFFF0000;
+				uint8_t	exLinAddr[] = {(uint8_t)(address >> 24), (uint8_t)(address >> 16)};
+				AddLine(eRecordTypeExLinAddr, 0, exLinAddr, 2);
+			}
+			uint32_t	length = inRecordLength;
+			if (length > data.size() - offset)
+			{
+				length = data.size() - offset;
+			}
+			if (length > inBlockSize - (address % inBlockSize))
+			{
+				length = inBlockSize - (address % inBlockSize);
+			}
+			AddLine(eRecordTypeData, address & 0xFFFF, &data[offset], length);
+			offset += length;
+		}
+		AddLine(eRecordTypeEOF, 0, NULL, 0);
+		mStartAddr = inStartAddr;
+		mEndAddr = inStartAddr + data.size();
+		mDataBytes = data.size();
+		success = mDataBytes != 0;
+	}
+	return(success);
+}
+
+/*********************************** Begin ************************************/
+void SimHost::Begin(
+	const char*	inCommands,
+	bool		inEraseBeforeWrite,
+	uint32_t	inBaudRate)
+{
+	char	range[32];
+	mBaudRate = inBaudRate;
+	mByteTime = 10000000000ULL / inBaudRate;
+	std::string	commands(inCommands ? inCommands : "");
+	snprintf(range, sizeof(range), "R%x,%x\n", mStartAddr, mEndAddr);
+	commands += range;
+	commands += inEraseBeforeWrite ? 'H' : 'h';
+	Send(SimNow() + (uint64_t)simTiming.usbTurnaround * 1000, commands);
+}
+
+/************************************ Send ************************************/
+void SimHost::Send(
+	uint64_t			inTime,
+	const std::string&	inData)
+{
+	for (size_t i = 0; i < inData.size(); i++)
+	{
+		if (mToDeviceFree < inTime)
+		{
+			mToDeviceFree = inTime;
+		}
+		mToDeviceFree += mByteTime;
+		SRxByte	rxByte = {mToDeviceFree, (uint8_t)inData[i]};
+		mToDevice.push_back(rxByte);
+	}
+	mBytesToDevice += inData.size();
+}
+
+/*********************************** Write ************************************/
+void SimHost::Write(
+	const uint8_t*	inData,
+	size_t			inLength)
+{
+	uint64_t	now = SimNow();
+	for (size_t i = 0; i < inLength; i++)
+	{
+		if (mFromDeviceFree < now)
+		{
+			mFromDeviceFree = now;
+		}
+		mFromDeviceFree += mByteTime;
+		/*
+		*	If the latency timer expired before this byte arrived THEN
+		*	the chip has already passed what it had to the host.
+		*/
+		if (!mChipBuffer.empty() &&
+			mChipFlushAt < mFromDeviceFree)
+		{
+			FlushChip(mChipFlushAt);
+		}
+		if (mChipBuffer.empty())
+		{
+			mChipFlushAt = mFromDeviceFree + (uint64_t)simTiming.usbLatencyTimer * 1000;
+		}
+		mChipBuffer += (char)inData[i];
+		mChipLastByte = mFromDeviceFree;
+		if (mChipBuffer.size() >= simTiming.usbPacketSize)
+		{
+			FlushChip(mFromDeviceFree);
+		}
+	}
+	mBytesFromDevice += inLength;
+}
+
+/********************************* FlushChip **********************************/
+void SimHost::FlushChip(
+	uint64_t	inTime)
+{
+	mLatencyWait += inTime - mChipLastByte;
+	SDelivery	delivery = {inTime, mChipBuffer};
+	mDeliveries.push_back(delivery);
+	mChipBuffer.clear();
+}
+
+/************************************ Pump ************************************/
+/*
+*	Processes, in time order, everything that has happened up till now.
+*/
+void SimHost::Pump(void)
+{
+	uint64_t	now = SimNow();
+	while (true)
+	{
+		bool	deliveryDue = !mDeliveries.empty() && mDeliveries.front().time <= now;
+		if (!mChipBuffer.empty() &&
+			mChipFlushAt <= now &&
+			(!deliveryDue || mChipFlushAt < mDeliveries.front().time))
+		{
+			FlushChip(mChipFlushAt);
+			continue;
+		}
+		if (deliveryDue)
+		{
+			SDelivery	delivery = mDeliveries.front();
+			mDeliveries.pop_front();
+			Receive(delivery.time, delivery.data);
+			continue;
+		}
+		break;
+	}
+}
+
+/******************************** Available ***********************************/
+/*
+*	When nothing has arrived, the clock is moved to the next event, but no
+*	more than 1ms at a time so that the sketch's timeouts behave as they would
+*	on the board.
+*/
+int SimHost::Available(void)
+{
+	Pump();
+	uint64_t	now = SimNow();
+	int			arrived = 0;
+	for (size_t i = 0; i < mToDevice.size() && arrived < 64; i++, arrived++)
+	{
+		if (mToDevice[i].time <= now)continue;
+		break;
+	}
+	if (arrived == 0)
+	{
+		uint64_t	nextEvent = kNoTime;
+		if (!mToDevice.empty())
+		{
+			nextEvent = mToDevice.front().time;
+		}
+		if (!mChipBuffer.empty() &&
+			mChipFlushAt < nextEvent)
+		{
+			nextEvent = mChipFlushAt;
+		}
+		if (!mDeliveries.empty() &&
+			mDeliveries.front().time < nextEvent)
+		{
+			nextEvent = mDeliveries.front().time;
+		}
+		if (nextEvent == kNoTime)
+		{
+			if (mDone)
+			{
+				SimExit();
+			}
+			/*
+			*	If neither side has anything to say for 10 seconds THEN
+			*	the download has stalled.
+			*/
+			if (mIdleSince == kNoTime)
+			{
+				mIdleSince = now;
+			} else if (now - mIdleSince > 10000000000ULL)
+			{
+				mResponse = "?Stalled";
+				Finish(mIdleSince, false);
+				SimExit();
+			}
+			nextEvent = now + 1000000;
+		} else
+		{
+			mIdleSince = kNoTime;
+		}
+		SimAdvance(nextEvent - now < 1000000 ? nextEvent - now : 1000000);
+	}
+	return(arrived);
+}
+
+/************************************ Read ************************************/
+int SimHost::Read(void)
+{
+	int	value = -1;
+	if (Available())
+	{
+		value = mToDevice.front().value;
+		mToDevice.pop_front();
+	}
+	return(value);
+}
+
+/************************************ Peek ************************************/
+int SimHost::Peek(void)
+{
+	return(Available() ? mToDevice.front().value : -1);
+}
+
+/********************************** Receive ***********************************/
+/*
+*	Handles the sketch's replies the same way SendHexIOSession does.
+*/
+void SimHost::Receive(
+	uint64_t			inTime,
+	const std::string&	inData)
+{
+	uint64_t	sendTime = inTime + (uint64_t)simTiming.usbTurnaround * 1000;
+	size_t		i = 0;
+	for (; i < inData.size() && !mDone; i++)
+	{
+		char	thisChar = inData[i];
+		if (mReceivingRewind)
+		{
+			if (thisChar == '\n')
+			{
+				mReceivingRewind = false;
+				Rewind();
+				Send(sendTime, mLines[mNextLine++] + '\n');
+			} else
+			{
+				mRewindAddr = (mRewindAddr << 4) + (thisChar <= '9' ? thisChar - '0' : (thisChar & 0xDF) - ('A' - 10));
+			}
+			continue;
+		}
+		if (mReceivingError)
+		{
+			if (thisChar == '\n')
+			{
+				Finish(inTime, false);
+			} else
+			{
+				mResponse += thisChar;
+			}
+			continue;
+		}
+		if (!mStarted)
+		{
+			// Ignore anything before the reply to the download command
+			if (thisChar == '*')
+			{
+				mStarted = true;
+				Send(sendTime, mLines[mNextLine++] + '\n');
+			}
+			continue;
+		}
+		switch (thisChar)
+		{
+			case '*':	// Process next line request
+				if (mNextLine < mLines.size())
+				{
+					Send(sendTime, mLines[mNextLine++] + '\n');
+				}
+				break;
+			case '=':	// Ignore erase block successful char
+			case '+':	// Ignore debug char
+			case '-':	// Ignore debug char
+				break;
+			case '<':	// Rewind request
+				mReceivingRewind = true;
+				mRewindAddr = 0;
+				mRewinds++;
+				break;
+			case '?':
+				mReceivingError = true;
+				mResponse = thisChar;
+				break;
+			default:
+				/*
+				*	After the last line the sketch replies "* success!\n"
+				*/
+				if (mNextLine < mLines.size())
+				{
+					mResponse = "?Unexpected reply";
+					Finish(inTime, false);
+				} else if (thisChar == '\n')
+				{
+					Finish(inTime, mResponse.find("success!") != std::string::npos);
+				} else
+				{
+					mResponse += thisChar;
+				}
+				break;
+		}
+	}
+	// Text following the final reply, e.g. a warning
+	if (mDone)
+	{
+		mTrailer.append(inData, i, std::string::npos);
+	}
+}
+
+/*********************************** Rewind ***********************************/
+/*
+*	Same as SendHexIOSession's rewind: continue from the first data line at or
+*	after the rewind address.
+*/
+void SimHost::Rewind(void)
+{
+	uint32_t	rewindLine = (uint32_t)mLines.size() - 1;	// EOF
+	ForEachDataRecord([this, &rewindLine](uint32_t inAddr, const uint8_t*, uint8_t, size_t inLine)
+		{
+			if (inAddr >= mRewindAddr &&
+				inLine < rewindLine)
+			{
+				rewindLine = (uint32_t)inLine;
+			}
+		});
+	mNextLine = rewindLine;
+}
+
+/*********************************** Finish ***********************************/
+void SimHost::Finish(
+	uint64_t	inTime,
+	bool		inSucceeded)
+{
+	mDone = true;
+	mSucceeded = inSucceeded;
+	mFinishTime = inTime;
+}
+
+/*********************************** Report ***********************************/
+void SimHost::Report(
+	FILE*	inFile) const
+{
+	double	seconds = mFinishTime / 1e9;
+	fprintf(inFile, "%s\n", mSucceeded ? "success!" : (mDone ? mResponse.c_str() : "?Not finished"));
+	fprintf(inFile, "%s", mTrailer.c_str());
+	fprintf(inFile, "%u data bytes, %u lines, %u rewinds, %u baud, %u ms latency timer\n",
+				mDataBytes, (uint32_t)mLines.size(), mRewinds, mBaudRate,
+				simTiming.usbLatencyTimer/1000);
+	fprintf(inFile, "Total time       %10.3f s  %.2f KB/s  %.2f minutes per board\n",
+				seconds, seconds > 0 ? mDataBytes/seconds/1024 : 0, seconds/60);
+	fprintf(inFile, "To HexLoader     %10.3f s  %u bytes\n",
+				mBytesToDevice * (mByteTime / 1e9), mBytesToDevice);
+	fprintf(inFile, "From HexLoader   %10.3f s  %u bytes\n",
+				mBytesFromDevice * (mByteTime / 1e9), mBytesFromDevice);
+	fprintf(inFile, "Latency timer    %10.3f s\n", mLatencyWait / 1e9);
+	fprintf(inFile, "Device busy      %10.3f s\n", simStats.deviceBusy / 1e9);
+	if (simStats.pagePrograms ||
+		simStats.statusReads)
+	{
+		fprintf(inFile, "NOR Flash: %u page programs, %u sector, %u 32KB, %u 64KB, %u chip erases, %u status reads\n",
+					simStats.pagePrograms, simStats.sectorErases, simStats.block32KErases,
+					simStats.block64KErases, simStats.chipErases, simStats.statusReads);
+	}
+	if (simStats.eepromWrites)
+	{
+		fprintf(inFile, "AT24C: %u page writes, %u ack poll NACKs\n",
+					simStats.eepromWrites, simStats.ackPollNacks);
+	}
+	if (simStats.sdBlockWrites ||
+		simStats.sdBlockReads)
+	{
+		fprintf(inFile, "SD: %u block writes in %u multiple block writes, %u block reads\n",
+					simStats.sdBlockWrites, simStats.sdMultipleBlockWrites, simStats.sdBlockReads);
+	}
+}
+
+/*********************************** Verify ***********************************/
+bool SimHost::Verify(
+	MemoryModel&	inMemory,
+	FILE*			inFile) const
+{
+	bool	success = true;
+	ForEachDataRecord([&](uint32_t inAddr, const uint8_t* inData, uint8_t inLength, size_t)
+		{
+			for (uint8_t i = 0; success && i < inLength; i++)
+			{
+				success = inAddr + i < inMemory.GetCapacity() &&
+							inMemory.GetMemory()[inAddr + i] == inData[i];
+				if (!success)
+				{
+					fprintf(inFile, "Verify failed at 0x%X\n", inAddr + i);
+				}
+			}
+		});
+	if (success)
+	{
+		fprintf(inFile, "Verified\n");
+	}
+	return(success);
+}
+
+/****************************** VerifyUnchanged *******************************/
+bool SimHost::VerifyUnchanged(
+	MemoryModel&				inMemory,
+	const std::vector<uint8_t>&	inOriginal,
+	uint32_t					inEraseSize,
+	FILE*						inFile) const
+{
+	uint32_t			capacity = inMemory.GetCapacity();
+	std::vector<bool>	isData(capacity, false);
+	ForEachDataRecord([&](uint32_t inAddr, const uint8_t* inData, uint8_t inLength, size_t)
+		{
+			for (uint8_t i = 0; i < inLength && inAddr + i < capacity; i++)
+			{
+				isData[inAddr + i] = true;
+			}
+		});
+	uint32_t	erasedStart = capacity;
+	uint32_t	erasedEnd = 0;
+	if (inEraseSize)
+	{
+		erasedStart = mStartAddr & ~(inEraseSize - 1);
+		erasedEnd = (mEndAddr + inEraseSize - 1) & ~(inEraseSize - 1);
+	}
+	const uint8_t*	memory = inMemory.GetMemory();
+	uint32_t	changed = 0;
+	uint32_t	firstChanged = 0;
+	for (uint32_t addr = 0; addr < capacity && addr < inOriginal.size(); addr++)
+	{
+		if (isData[addr] ||
+			(addr >= erasedStart && addr < erasedEnd) ||
+			memory[addr] == inOriginal[addr])
+		{
+			continue;
+		}
+		if (changed == 0)
+		{
+			firstChanged = addr;
+		}
+		changed++;
+	}
+	if (changed)
+	{
+		fprintf(inFile, "%u bytes outside of the data changed, the first at 0x%X\n", changed, firstChanged);
+	}
+	return(changed == 0);
+}
@@ -0,0 +1,156 @@
+/*
+*	SimHost.h, Copyright Jonathan Mackey 2019
+*	A simulated host that downloads Intel Hex to the sketch the same way
+*	SendHexIOSession does, over simulated USB-serial and UART links, so that
+*	a download can be timed without a board or the host application.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef SimHost_h
+#define SimHost_h
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+class MemoryModel;
+
+class SimHost
+{
+public:
+							SimHost(void);
+	/*
+	*	Loads the lines to send from an Intel Hex file.
+	*/
+	bool					LoadHex(
+								const char*				inPath);
+	/*
+	*	Converts a binary file to lines of inRecordLength data bytes starting
+	*	at inStartAddr.  Lines don't cross inBlockSize boundaries.
+	*/
+	bool					LoadBinary(
+								const char*				inPath,
+								uint32_t				inStartAddr,
+								uint8_t					inRecordLength,
+								uint32_t				inBlockSize);
+	/*
+	*	Sends inCommands (e.g. "c" to turn off compare before write,) the
+	*	range of the data and the download command.
+	*/
+	void					Begin(
+								const char*				inCommands,
+								bool					inEraseBeforeWrite,
+								uint32_t				inBaudRate);
+	// The sketch's side of the serial port
+	int						Available(void);
+	int						Read(void);
+	int						Peek(void);
+	void					Write(
+								const uint8_t*			inData,
+								size_t					inLength);
+
+	bool					Succeeded(void) const
+								{return(mSucceeded);}
+	void					Report(
+								FILE*					inFile) const;
+	/*
+	*	Compares the data records with inMemory.
+	*/
+	bool					Verify(
+								MemoryModel&			inMemory,
+								FILE*					inFile) const;
+	/*
+	*	Compares the memory outside of the data records with inOriginal, the
+	*	memory before the download.  Within the range sent, rounded out to
+	*	inEraseSize, the memory may have been erased (inEraseSize is 0 when
+	*	nothing is erased.)
+	*/
+	bool					VerifyUnchanged(
+								MemoryModel&				inMemory,
+								const std::vector<uint8_t>&	inOriginal,
+								uint32_t					inEraseSize,
+								FILE*						inFile) const;
+protected:
+	struct SRxByte
+	{
+		uint64_t	time;		// Arrival time in ns
+		uint8_t		value;
+	};
+	struct SDelivery
+	{
+		uint64_t	time;		// Time the host receives the data in ns
+		std::string	data;
+	};
+	std::vector<std::string>	mLines;
+	std::deque<SRxByte>			mToDevice;
+	std::deque<SDelivery>		mDeliveries;
+	std::string		mChipBuffer;	// USB-serial chip's receive buffer
+	std::string		mResponse;		// Text following the last line
+	std::string		mTrailer;		// Text following the final reply
+	uint64_t		mChipFlushAt;
+	uint64_t		mChipLastByte;
+	uint64_t		mToDeviceFree;	// Time the UART to the sketch is free
+	uint64_t		mFromDeviceFree;// Time the UART from the sketch is free
+	uint64_t		mByteTime;		// 10 bits at the baud rate in ns
+	uint64_t		mLatencyWait;	// Total time waiting for the latency timer
+	uint64_t		mFinishTime;
+	uint64_t		mIdleSince;
+	uint32_t		mStartAddr;
+	uint32_t		mEndAddr;
+	uint32_t		mDataBytes;
+	uint32_t		mBytesToDevice;
+	uint32_t		mBytesFromDevice;
+	uint32_t		mNextLine;
+	uint32_t		mRewindAddr;
+	uint32_t		mRewinds;
+	uint32_t		mBaudRate;
+	bool			mStarted;
+	bool			mDone;
+	bool			mSucceeded;
+	bool			mReceivingRewind;
+	bool			mReceivingError;
+
+	void					AddLine(
+								uint8_t					inRecordType,
+								uint16_t				inAddress,
+								const uint8_t*			inData,
+								uint8_t					inLength);
+	void					Pump(void);
+	void					FlushChip(
+								uint64_t				inTime);
+	void					Send(
+								uint64_t				inTime,
+								const std::string&		inData);
+	void					Receive(
+								uint64_t				inTime,
+								const std::string&		inData);
+	void					Rewind(void);
+	void					Finish(
+								uint64_t				inTime,
+								bool					inSucceeded);
+	/*
+	*	Calls inFunc(address, data, length) for each data record.
+	*/
+	template <class F> void	ForEachDataRecord(
+								F						inFunc) const;
+};
+
+#endif // SimHost_h
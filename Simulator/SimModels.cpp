@@ -0,0 +1,588 @@
+/*
+*	SimModels.cpp, Copyright Jonathan Mackey 2019
+*	In-memory device models used by the HexLoader simulator.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#include "Arduino.h"
+#include "SimModels.h"
+#include <stdio.h>
+#include <string.h>
+
+NorFlashModel	simFlash;
+AT24CModel		simEEPROM;
+SdCardModel		simCard;
+SimStats		simStats;
+
+const SimTiming	kTypicalTiming =
+{
+	1500,		// spiByteNs, 8MHz SPI clock on a 16MHz AVR
+	1125,		// spiBulkByteNs
+	700,		// pageProgram
+	45000,		// sectorErase
+	120000,		// block32KErase
+	150000,		// block64KErase
+	20000,		// chipErase (ms)
+	5000,		// at24cWriteCycle
+	1200,		// sdReadBlock
+	1800,		// sdWriteBlock
+	1100,		// sdWriteData
+	500,		// sdWriteStartStop
+	16000,		// usbLatencyTimer
+	1000,		// usbTurnaround
+	62			// usbPacketSize
+};
+
+const SimTiming	kMaxTiming =
+{
+	1500,		// spiByteNs
+	1125,		// spiBulkByteNs
+	3000,		// pageProgram
+	400000,		// sectorErase
+	1600000,	// block32KErase
+	2000000,	// block64KErase
+	100000,		// chipErase (ms)
+	5000,		// at24cWriteCycle
+	100000,		// sdReadBlock, SD spec read timeout
+	250000,		// sdWriteBlock, SD spec write timeout
+	250000,		// sdWriteData
+	250000,		// sdWriteStartStop
+	16000,		// usbLatencyTimer
+	1000,		// usbTurnaround
+	62			// usbPacketSize
+};
+
+SimTiming	simTiming = kTypicalTiming;
+
+enum
+{
+	ePageProgCmd	= 2,
+	eReadDataCmd,
+	eWriteDisableCmd,
+	eReadStat1Cmd,
+	eWriteEnableCmd,
+	eFastReadCmd	= 0x0B,
+	eEraseSectorCmd	= 0x20,
+	eErase32KBlkCmd	= 0x52,
+	eChipEraseCmd	= 0x60,
+	eChipErase2Cmd	= 0xC7,
+	eErase64KBlkCmd	= 0xD8,
+	eReadJEDECIDCmd	= 0x9F,
+	eReadSFDPCmd	= 0x5A,
+	eEnter4ByteCmd	= 0xB7,
+	eExit4ByteCmd	= 0xE9,
+	
+	eChipBusyBit	=	1,
+	eWriteEnabledBit
+};
+
+/******************************** MemoryModel *********************************/
+MemoryModel::MemoryModel(
+	uint32_t	inCapacity,
+	uint8_t		inErasedValue)
+	: mMemory(inCapacity, inErasedValue), mErasedValue(inErasedValue)
+{
+}
+
+/******************************** SetCapacity *********************************/
+void MemoryModel::SetCapacity(
+	uint32_t	inCapacity)
+{
+	mMemory.assign(inCapacity, mErasedValue);
+}
+
+/********************************* LoadImage **********************************/
+/*
+*	Loads the memory from the image file.  A file shorter than the capacity
+*	leaves the remainder erased, anything beyond the capacity is ignored.
+*/
+bool MemoryModel::LoadImage(
+	const char*	inPath)
+{
+	FILE*	file = fopen(inPath, "rb");
+	bool	success = file != NULL;
+	if (success)
+	{
+		size_t	bytesRead = fread(mMemory.data(), 1, mMemory.size(), file);
+		memset(&mMemory[bytesRead], mErasedValue, mMemory.size() - bytesRead);
+		success = ferror(file) == 0;
+		fclose(file);
+	}
+	return(success);
+}
+
+/********************************* SaveImage **********************************/
+bool MemoryModel::SaveImage(
+	const char*	inPath) const
+{
+	FILE*	file = fopen(inPath, "wb");
+	bool	success = file != NULL;
+	if (success)
+	{
+		success = fwrite(mMemory.data(), 1, mMemory.size(), file) == mMemory.size();
+		success = fclose(file) == 0 && success;
+	}
+	return(success);
+}
+
+/******************************* NorFlashModel ********************************/
+NorFlashModel::NorFlashModel(void)
+	: MemoryModel(0x800000, 0xFF), mBusyUntil(0), mPendingBusy(0),
+	  mAddress(0), mCSPin(0xFF),
+	  mCommand(0), mPhase(eIgnorePhase), mAddressBytes(0), mIndex(0),
+	  mStatus1(0), mSelected(false), m4ByteMode(false)
+{
+}
+
+/*********************************** Select ***********************************/
+/*
+*	As on the chip, commands start when CS goes low.  Program and erase
+*	commands start when CS goes high, the chip is then busy for the time the
+*	operation takes and the write enable latch is cleared.
+*/
+void NorFlashModel::Select(
+	bool	inSelected)
+{
+	if (inSelected != mSelected)
+	{
+		mSelected = inSelected;
+		if (inSelected)
+		{
+			mPhase = eCommandPhase;
+		} else
+		{
+			switch (mCommand)
+			{
+				case ePageProgCmd:
+				case eEraseSectorCmd:
+				case eErase32KBlkCmd:
+				case eErase64KBlkCmd:
+				case eChipEraseCmd:
+				case eChipErase2Cmd:
+					mStatus1 &= ~eWriteEnabledBit;
+					break;
+			}
+			if (mPendingBusy)
+			{
+				mBusyUntil = SimNow() + mPendingBusy;
+				simStats.deviceBusy += mPendingBusy;
+				mPendingBusy = 0;
+			}
+			mCommand = 0;
+			mPhase = eIgnorePhase;
+		}
+	}
+}
+
+/********************************** Transfer **********************************/
+uint8_t NorFlashModel::Transfer(
+	uint8_t	inData)
+{
+	uint8_t	response = 0xFF;
+	switch (mPhase)
+	{
+		case eCommandPhase:
+			/*
+			*	While busy the chip ignores everything other than reading
+			*	the status.
+			*/
+			if (inData != eReadStat1Cmd &&
+				SimNow() < mBusyUntil)
+			{
+				mPhase = eIgnorePhase;
+				break;
+			}
+			mCommand = inData;
+			mIndex = 0;
+			mAddress = 0;
+			mPhase = eDataPhase;
+			switch (inData)
+			{
+				case ePageProgCmd:
+				case eReadDataCmd:
+				case eFastReadCmd:
+				case eEraseSectorCmd:
+				case eErase32KBlkCmd:
+				case eErase64KBlkCmd:
+					mPhase = eAddressPhase;
+					mAddressBytes = m4ByteMode ? 4 : 3;
+					break;
+				case eReadSFDPCmd:	// Always a 3 byte address
+					mPhase = eAddressPhase;
+					mAddressBytes = 3;
+					break;
+				case eEnter4ByteCmd:	// Ignored unless write enabled, see ReadSFDP
+					if (mStatus1 & eWriteEnabledBit)
+					{
+						m4ByteMode = true;
+					}
+					break;
+				case eExit4ByteCmd:
+					m4ByteMode = false;
+					break;
+				case eWriteEnableCmd:
+					mStatus1 |= eWriteEnabledBit;
+					break;
+				case eWriteDisableCmd:
+					mStatus1 &= ~eWriteEnabledBit;
+					break;
+				case eChipEraseCmd:
+				case eChipErase2Cmd:
+					if (mStatus1 & eWriteEnabledBit)
+					{
+						memset(mMemory.data(), 0xFF, mMemory.size());
+						mPendingBusy = (uint64_t)simTiming.chipErase * 1000000;
+						simStats.chipErases++;
+					}
+					break;
+			}
+			break;
+		case eAddressPhase:
+			mAddress = (mAddress << 8) | inData;
+			mAddressBytes--;
+			if (mAddressBytes == 0)
+			{
+				if (mCommand != eReadSFDPCmd)
+				{
+					mAddress %= GetCapacity();
+				}
+				mPhase = eDataPhase;
+				ExecuteOnAddress();
+			}
+			break;
+		case eDataPhase:
+			switch (mCommand)
+			{
+				case eFastReadCmd:
+					if (mIndex == 0)
+					{
+						mIndex++;	// Dummy byte
+						break;
+					}
+					// Fall through
+				case eReadDataCmd:
+					response = mMemory[mAddress];
+					mAddress = (mAddress + 1) % GetCapacity();
+					break;
+				case eReadSFDPCmd:
+					if (mIndex == 0)
+					{
+						mIndex++;	// Dummy byte
+						break;
+					}
+					response = ReadSFDP(mAddress++);
+					break;
+				case eReadStat1Cmd:
+					response = mStatus1;
+					if (SimNow() < mBusyUntil)
+					{
+						response |= eChipBusyBit;
+					}
+					simStats.statusReads++;
+					break;
+				case eReadJEDECIDCmd:
+				{
+					uint8_t	capacityLog2 = 0;
+					while ((1UL << capacityLog2) < GetCapacity())
+					{
+						capacityLog2++;
+					}
+					const uint8_t	jedecID[] = {0xEF, 0x40, capacityLog2};
+					response = mIndex < sizeof(jedecID) ? jedecID[mIndex++] : 0xFF;
+					break;
+				}
+				case ePageProgCmd:
+					/*
+					*	Programming only clears bits.  Bytes past the end of
+					*	the page wrap to the start of the page.
+					*/
+					if (mStatus1 & eWriteEnabledBit)
+					{
+						mMemory[(mAddress & ~0xFFUL) | ((mAddress + mIndex) & 0xFF)] &= inData;
+						if (mIndex == 0)
+						{
+							mPendingBusy = (uint64_t)simTiming.pageProgram * 1000;
+							simStats.pagePrograms++;
+						}
+						mIndex++;
+					}
+					break;
+			}
+			break;
+	}
+	return(response);
+}
+
+/********************************** ReadSFDP **********************************/
+/*
+*	The SFDP header, one parameter header, and a JESD216B Basic Flash Parameter
+*	Table of 16 DWORDs at 0x80.  DWORDs 1 to 9 are the W25Q64's with the
+*	density of the model's capacity.  The timing DWORDs encode the typical
+*	times (rounded up) with multipliers that put the maximums at or above the
+*	datasheet's.  DWORD 16 says 4 byte address mode is entered by B7h after
+*	write enable, as on Micron's chips, and the model ignores B7h otherwise.
+*/
+uint8_t NorFlashModel::ReadSFDP(
+	uint32_t	inAddr)
+{
+	static const uint8_t	kHeader[] =
+	{
+		'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xFF,
+		0x00, 0x06, 0x01, 16, 0x80, 0x00, 0x00, 0xFF
+	};
+	static const uint32_t	kTable[] =
+	{
+		0xFFF920E5,
+		0,			// Density, see below
+		0x6B08EB44,
+		0xBB423B08,
+		0xFFFFFFFE,
+		0x0000FFFF,
+		0xEB40FFFF,
+		0x520F200C,	// 4KB 20h, 32KB 52h
+		0x0000D810,	// 64KB D8h
+		// Max x14, 4KB 3 x 16ms, 32KB 8 x 16ms, 64KB 10 x 16ms
+		6 | (2 << 4) | (1 << 9) | (7 << 11) | (1 << 16) | (9 << 18) | (1 << 23),
+		// Max x6, 256 byte page, page program 11 x 64us, chip erase 5 x 4s
+		2 | (8 << 4) | (10 << 8) | (1 << 13) | (4 << 24) | (2UL << 29),
+		// Suspend/resume, deep power down and quad enable not supported
+		0xFFFFFFFF,
+		0xFFFFFFFF,
+		0xFFFFFFFF,
+		0x00000000,
+		// Enter 4 byte: WREN + B7h, exit 4 byte: WREN + E9h, soft reset 66h 99h
+		(0x02UL << 24) | (0x002 << 14) | (0x10 << 8)
+	};
+	uint8_t	response = 0xFF;
+	if (inAddr < sizeof(kHeader))
+	{
+		response = kHeader[inAddr];
+	} else if (inAddr >= 0x80 &&
+		inAddr < 0x80 + sizeof(kTable))
+	{
+		uint32_t	index = (inAddr - 0x80) / 4;
+		uint32_t	dword = kTable[index];
+		if (index == 1)
+		{
+			uint64_t	bits = (uint64_t)GetCapacity() * 8;
+			if (bits <= 0x80000000)
+			{
+				dword = (uint32_t)(bits - 1);
+			} else
+			{
+				uint32_t	bitsLog2 = 0;
+				while (((uint64_t)1 << bitsLog2) < bits)
+				{
+					bitsLog2++;
+				}
+				dword = 0x80000000 | bitsLog2;
+			}
+		}
+		response = dword >> ((inAddr & 3) * 8);
+	}
+	return(response);
+}
+
+/****************************** ExecuteOnAddress ******************************/
+void NorFlashModel::ExecuteOnAddress(void)
+{
+	uint32_t	eraseSize = 0;
+	uint32_t	eraseTime = 0;
+	switch (mCommand)
+	{
+		case eEraseSectorCmd:
+			eraseSize = 0x1000;
+			eraseTime = simTiming.sectorErase;
+			simStats.sectorErases++;
+			break;
+		case eErase32KBlkCmd:
+			eraseSize = 0x8000;
+			eraseTime = simTiming.block32KErase;
+			simStats.block32KErases++;
+			break;
+		case eErase64KBlkCmd:
+			eraseSize = 0x10000;
+			eraseTime = simTiming.block64KErase;
+			simStats.block64KErases++;
+			break;
+	}
+	if (eraseSize &&
+		(mStatus1 & eWriteEnabledBit))
+	{
+		memset(&mMemory[mAddress & ~(eraseSize - 1)], 0xFF, eraseSize);
+		mPendingBusy = (uint64_t)eraseTime * 1000;
+	}
+}
+
+/********************************* AT24CModel *********************************/
+AT24CModel::AT24CModel(void)
+	: MemoryModel(0, 0xFF)
+{
+}
+
+/********************************** AddChip ***********************************/
+/*
+*	Same capacity to page size mapping as the AT24C class.
+*/
+void AT24CModel::AddChip(
+	uint8_t		inDeviceAddress,
+	uint16_t	inCapacity)
+{
+	SChip	chip;
+	chip.offset = GetCapacity();
+	chip.capacity = (uint32_t)inCapacity * 1024;
+	chip.address = 0;
+	chip.busyUntil = 0;
+	chip.deviceAddress = inDeviceAddress;
+	chip.addressMask = inCapacity > 64 ? (uint8_t)(chip.capacity >> 16) - 1 : 0;
+	switch(inCapacity)
+	{
+		case 16:
+		case 32:
+			chip.pageSize = 64;
+			break;
+		case 64:
+			chip.pageSize = 128;
+			break;
+		case 128:
+		case 256:
+			chip.pageSize = 256;
+			break;
+		default:
+			chip.pageSize = 32;
+			break;
+	}
+	mChips.push_back(chip);
+	mMemory.resize(chip.offset + chip.capacity, mErasedValue);
+}
+
+/********************************** FindChip **********************************/
+AT24CModel::SChip* AT24CModel::FindChip(
+	uint8_t	inDeviceAddress)
+{
+	for (size_t i = 0; i < mChips.size(); i++)
+	{
+		if ((inDeviceAddress & ~mChips[i].addressMask) != mChips[i].deviceAddress)continue;
+		return(&mChips[i]);
+	}
+	return(NULL);
+}
+
+/*********************************** Write ************************************/
+/*
+*	The first two bytes are the data address.  The remaining bytes, if any,
+*	are written to the page containing the data address, starting the write
+*	cycle.  The chip doesn't acknowledge its address during the write cycle.
+*/
+bool AT24CModel::Write(
+	uint8_t			inDeviceAddress,
+	const uint8_t*	inData,
+	uint16_t		inLength)
+{
+	SChip*	chip = FindChip(inDeviceAddress);
+	bool	success = chip != NULL;
+	if (success &&
+		SimNow() < chip->busyUntil)
+	{
+		simStats.ackPollNacks++;
+		success = false;
+	}
+	if (success &&
+		inLength > 2)
+	{
+		chip->busyUntil = SimNow() + (uint64_t)simTiming.at24cWriteCycle * 1000;
+		simStats.deviceBusy += (uint64_t)simTiming.at24cWriteCycle * 1000;
+		simStats.eepromWrites++;
+	}
+	if (success &&
+		inLength >= 2)
+	{
+		uint32_t	highBits = (uint32_t)(inDeviceAddress & chip->addressMask) << 16;
+		uint32_t	address = (highBits | ((uint32_t)inData[0] << 8) | inData[1]) % chip->capacity;
+		uint32_t	pageStart = address & ~(uint32_t)(chip->pageSize - 1);
+		uint32_t	pageOffset = address - pageStart;
+		uint8_t*	memory = &mMemory[chip->offset];
+		for (uint16_t i = 2; i < inLength; i++)
+		{
+			memory[pageStart + pageOffset] = inData[i];
+			pageOffset = (pageOffset + 1) % chip->pageSize;
+		}
+		chip->address = pageStart + pageOffset;
+	}
+	return(success);
+}
+
+/************************************ Read ************************************/
+/*
+*	Sequential read from the current data address, wrapping at the end of the
+*	chip's memory.
+*/
+bool AT24CModel::Read(
+	uint8_t		inDeviceAddress,
+	uint8_t*	outData,
+	uint8_t		inLength)
+{
+	SChip*	chip = FindChip(inDeviceAddress);
+	bool	success = chip != NULL &&
+						SimNow() >= chip->busyUntil;
+	if (success)
+	{
+		const uint8_t*	memory = &mMemory[chip->offset];
+		for (uint8_t i = 0; i < inLength; i++)
+		{
+			outData[i] = memory[chip->address];
+			chip->address = (chip->address + 1) % chip->capacity;
+		}
+	}
+	return(success);
+}
+
+/******************************** SdCardModel *********************************/
+SdCardModel::SdCardModel(void)
+	: MemoryModel(0x1000000, 0)
+{
+}
+
+/********************************* ReadBlock **********************************/
+bool SdCardModel::ReadBlock(
+	uint32_t	inBlock,
+	uint8_t*	outData)
+{
+	bool	success = inBlock < GetCapacity()/512;
+	if (success)
+	{
+		simStats.sdBlockReads++;
+		memcpy(outData, &mMemory[inBlock*512], 512);
+	}
+	return(success);
+}
+
+/********************************* WriteBlock *********************************/
+bool SdCardModel::WriteBlock(
+	uint32_t		inBlock,
+	const uint8_t*	inData)
+{
+	bool	success = inBlock < GetCapacity()/512;
+	if (success)
+	{
+		simStats.sdBlockWrites++;
+		memcpy(&mMemory[inBlock*512], inData, 512);
+	}
+	return(success);
+}
@@ -0,0 +1,218 @@
+/*
+*	SimModels.h, Copyright Jonathan Mackey 2019
+*	In-memory models of the devices HexLoader loads: a NOR Flash chip driven
+*	by SPI commands, an AT24C EEPROM driven by I2C transmissions, and an SD
+*	card driven by block reads and writes.
+*
+*	Each model is busy for the time its operations take on the real device,
+*	as set in simTiming, measured against the simulator's clock (see SimNow.)
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef SimModels_h
+#define SimModels_h
+
+#include <inttypes.h>
+#include <vector>
+
+/*
+*	Device and bus times in microseconds unless noted otherwise.  The NOR
+*	Flash times are for a Winbond W25Q64.  kTypicalTiming uses the datasheet
+*	typical times, kMaxTiming the maximums (the ones the SPIMem timeouts are
+*	based on.)  The AT24C datasheets only specify a maximum write cycle.
+*/
+struct SimTiming
+{
+	uint32_t	spiByteNs;		// SPI.transfer of a byte, including overhead
+	uint32_t	spiBulkByteNs;	// A byte of a buffer transfer (18 AVR cycles)
+	uint32_t	pageProgram;
+	uint32_t	sectorErase;	// 4KB
+	uint32_t	block32KErase;
+	uint32_t	block64KErase;
+	uint32_t	chipErase;		// ms
+	uint32_t	at24cWriteCycle;
+	uint32_t	sdReadBlock;	// Includes the 512 byte SPI transfer
+	uint32_t	sdWriteBlock;	// Single block write (CMD24)
+	uint32_t	sdWriteData;	// One block of a multiple block write (CMD25)
+	uint32_t	sdWriteStartStop;
+	uint32_t	usbLatencyTimer;// USB-serial chip, e.g. FTDI's default is 16ms
+	uint32_t	usbTurnaround;	// Host receives data until it's sent (USB frames)
+	uint16_t	usbPacketSize;	// USB-serial chip to host, 62 for FTDI
+};
+
+extern const SimTiming	kTypicalTiming;
+extern const SimTiming	kMaxTiming;
+extern SimTiming		simTiming;
+
+/*
+*	Operation counts and the time the devices were busy, for the benchmark
+*	report.
+*/
+struct SimStats
+{
+	uint32_t	pagePrograms;
+	uint32_t	sectorErases;
+	uint32_t	block32KErases;
+	uint32_t	block64KErases;
+	uint32_t	chipErases;
+	uint32_t	statusReads;
+	uint32_t	eepromWrites;
+	uint32_t	ackPollNacks;
+	uint32_t	sdBlockReads;
+	uint32_t	sdBlockWrites;
+	uint32_t	sdMultipleBlockWrites;
+	uint64_t	deviceBusy;		// ns
+};
+
+extern SimStats		simStats;
+
+/*
+*	The memory common to all models.  The contents can be loaded from and
+*	saved to an image file so that the result of a download can be examined.
+*/
+class MemoryModel
+{
+public:
+							MemoryModel(
+								uint32_t				inCapacity,
+								uint8_t					inErasedValue);
+	void					SetCapacity(
+								uint32_t				inCapacity);
+	uint32_t				GetCapacity(void) const
+								{return((uint32_t)mMemory.size());}
+	uint8_t*				GetMemory(void)
+								{return(mMemory.data());}
+	bool					LoadImage(
+								const char*				inPath);
+	bool					SaveImage(
+								const char*				inPath) const;
+protected:
+	std::vector<uint8_t>	mMemory;
+	uint8_t					mErasedValue;
+};
+
+/*
+*	NOR Flash model of a Winbond W25Qxx.  Implements the commands used by
+*	SPIMem.  Programming only clears bits, erasing sets them.
+*/
+class NorFlashModel : public MemoryModel
+{
+public:
+							NorFlashModel(void);
+	void					SetCSPin(
+								uint8_t					inPin)
+								{mCSPin = inPin;}
+	uint8_t					GetCSPin(void) const
+								{return(mCSPin);}
+	void					Select(
+								bool					inSelected);
+	uint8_t					Transfer(
+								uint8_t					inData);
+protected:
+	enum EPhase
+	{
+		eCommandPhase,
+		eAddressPhase,
+		eDataPhase,
+		eIgnorePhase
+	};
+	uint64_t	mBusyUntil;		// ns
+	uint64_t	mPendingBusy;	// Busy time starting when CS goes high
+	uint32_t	mAddress;
+	uint8_t		mCSPin;
+	uint8_t		mCommand;
+	uint8_t		mPhase;
+	uint8_t		mAddressBytes;	// Address bytes remaining
+	uint8_t		mIndex;			// Index within the data phase
+	uint8_t		mStatus1;
+	bool		mSelected;
+	bool		m4ByteMode;		// 4 byte addresses (chips larger than 16MB)
+
+	void					ExecuteOnAddress(void);
+	uint8_t					ReadSFDP(
+								uint32_t				inAddr);
+};
+
+/*
+*	AT24C EEPROM model, one or more chips on the bus.  Page writes wrap
+*	within the page as they do on the chip.  Each chip has its own write
+*	cycle.
+*/
+class AT24CModel : public MemoryModel
+{
+public:
+							AT24CModel(void);
+	/*
+	*	Adds a chip.  The chips' memory follows each other in the order
+	*	they're added, the same as an AT24CBank.  Chips larger than 64KB take
+	*	the data address bits above 16 from the low bits of the device
+	*	address.
+	*/
+	void					AddChip(
+								uint8_t					inDeviceAddress,
+								uint16_t				inCapacity);	// KB
+	/*
+	*	Returns false if inDeviceAddress isn't one of the chips or the chip is
+	*	busy with a write cycle (NACK.)
+	*/
+	bool					Write(
+								uint8_t					inDeviceAddress,
+								const uint8_t*			inData,
+								uint16_t				inLength);
+	bool					Read(
+								uint8_t					inDeviceAddress,
+								uint8_t*				outData,
+								uint8_t					inLength);
+protected:
+	struct SChip
+	{
+		uint32_t	offset;		// Of the chip's memory within mMemory
+		uint32_t	capacity;
+		uint32_t	address;	// The chip's current data address
+		uint64_t	busyUntil;	// ns
+		uint16_t	pageSize;
+		uint8_t		deviceAddress;
+		uint8_t		addressMask;	// Device address bits that are data address bits
+	};
+	std::vector<SChip>	mChips;
+
+	SChip*					FindChip(
+								uint8_t					inDeviceAddress);
+};
+
+/*
+*	SD card model, 512 byte blocks.
+*/
+class SdCardModel : public MemoryModel
+{
+public:
+							SdCardModel(void);
+	bool					ReadBlock(
+								uint32_t				inBlock,
+								uint8_t*				outData);
+	bool					WriteBlock(
+								uint32_t				inBlock,
+								const uint8_t*			inData);
+};
+
+extern NorFlashModel	simFlash;
+extern AT24CModel		simEEPROM;
+extern SdCardModel		simCard;
+
+#endif // SimModels_h
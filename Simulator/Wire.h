@@ -0,0 +1,76 @@
+/*
+*	Wire.h, Copyright Jonathan Mackey 2019
+*	Wire (TwoWire) stand-in.  Transmissions go to the AT24C model.
+*
+*	GNU license:
+*	This program is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*	Please maintain this license information along with authorship and copyright
+*	notices in any redistribution of this code.
+*
+*/
+#ifndef Wire_h
+#define Wire_h
+
+#include "Arduino.h"
+
+#ifndef BUFFER_LENGTH
+#define BUFFER_LENGTH	32	// Same as the AVR Wire library
+#endif
+
+class TwoWire
+{
+public:
+							TwoWire(void);
+	void					begin(void){}
+	void					setClock(
+								uint32_t				inClock)
+								{mClock = inClock;}
+	void					beginTransmission(
+								uint8_t					inAddress);
+	size_t					write(
+								uint8_t					inData);
+	size_t					write(
+								const uint8_t*			inData,
+								size_t					inLength);
+	/*
+	*	Returns 0 on success, 1 if the data didn't fit in the buffer, 2 if the
+	*	address was NACKed (as the AT24C does while busy writing.)
+	*/
+	uint8_t					endTransmission(
+								bool					inSendStop = true);
+	uint8_t					requestFrom(
+								uint8_t					inAddress,
+								uint8_t					inQuantity,
+								uint8_t					inSendStop = true);
+	int						available(void)
+								{return(mRxLength - mRxIndex);}
+	int						read(void)
+								{return(mRxIndex < mRxLength ? mBuffer[mRxIndex++] : -1);}
+	// Simulator only
+	uint32_t				GetClock(void) const
+								{return(mClock);}
+protected:
+	uint32_t	mClock;
+	uint8_t		mBuffer[BUFFER_LENGTH];
+	uint8_t		mAddress;
+	uint16_t	mTxLength;
+	uint8_t		mRxIndex;
+	uint8_t		mRxLength;
+	bool		mOverflow;
+};
+
+extern TwoWire	Wire;
+
+#endif // Wire_h